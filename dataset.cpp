@@ -0,0 +1,121 @@
+/**
+ * The dataset command.
+ *
+ *   dataset cache [options] <csv> <cache>
+ *     Converts a CSV file once into a dataset cache (dataset_cache.hpp),
+ *     which later runs load with load_dataset_cache(), an mmap.
+ *     --no-header       the first line is data, columns are named 0, 1, ...
+ *     --delimiter <c>   field separator, ',' by default
+ *     --bins <n>        quantile bins per column, 1 to 65535, 255 by default
+ *     --presort         also store the rows of every column in order of value
+ *     --threads <n>     threads for parsing and summaries, all by default
+ *
+ *   dataset info <cache>
+ *     Prints the rows, and every column's dtype, range, missing count,
+ *     bin count and categories.
+ */
+
+//Project
+#include <random_forest/csv.hpp>
+#include <random_forest/dataset_cache.hpp>
+
+//STL
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+
+namespace ml = ayasdi::ml;
+
+namespace {
+
+int usage(){
+ std::cerr << "usage: dataset cache [--no-header] [--delimiter <c>] [--bins <n>] [--presort] [--threads <n>] <csv> <cache>\n"
+              "       dataset info <cache>\n";
+ return 2;
+}
+
+//The count s spells, or 0 unless it is all digits and in [1, max]
+std::size_t count_argument( const std::string& s, std::size_t max){
+ if( s.empty() || s.size() > 19 || s.find_first_not_of( "0123456789") != std::string::npos){ return 0; }
+ const unsigned long long n = std::stoull( s);
+ return n <= max ? n : 0;
+}
+
+const char* dtype_name( ml::dtype t){
+ switch( t){
+  case ml::dtype::uint8:   return "uint8";
+  case ml::dtype::uint16:  return "uint16";
+  case ml::dtype::float32: return "float32";
+  default:                 return "float64";
+ }
+}
+
+int cache( const std::vector< std::string>& args){
+ ml::csv_options csv;
+ ml::cache_options options;
+ std::vector< std::string> paths;
+ for( std::size_t i = 0; i < args.size(); ++i){
+  const std::string& a = args[ i];
+  const bool has_value = i+1 < args.size();
+  if( a == "--no-header"){ csv.header = false; }
+  else if( a == "--presort"){ options.presort = true; }
+  else if( a == "--delimiter" && has_value && args[ i+1].size() == 1){ csv.delimiter = args[ ++i][ 0]; }
+  else if( a == "--bins" && has_value){
+   options.n_bins = count_argument( args[ ++i], ml::max_cache_bins);
+   if( !options.n_bins){
+    std::cerr << "dataset cache: --bins must be a count from 1 to " << ml::max_cache_bins << "\n";
+    return usage();
+   }
+  }
+  else if( a == "--threads" && has_value){ csv.n_threads = options.n_threads = std::stoul( args[ ++i]); }
+  else if( a.size() > 1 && a[ 0] == '-'){ return usage(); }
+  else { paths.push_back( a); }
+ }
+ if( paths.size() != 2){ return usage(); }
+ const auto start = std::chrono::steady_clock::now();
+ const ml::csv_table table = ml::read_csv( paths[ 0], csv);
+ const auto parsed = std::chrono::steady_clock::now();
+ //Lets cached_csv() reuse the cache when parsing with the same options
+ options.parse_hash = ml::csv_options_hash( csv);
+ ml::save_dataset_cache( table, paths[ 1], options);
+ const auto saved = std::chrono::steady_clock::now();
+ std::cout << paths[ 1] << ": " << table.dataset.height() << " rows, " << table.dataset.width() << " columns, "
+           << std::chrono::duration< double>( parsed - start).count() << " s parsing, "
+           << std::chrono::duration< double>( saved - parsed).count() << " s writing\n";
+ return 0;
+}
+
+int info( const std::vector< std::string>& args){
+ if( args.size() != 1){ return usage(); }
+ const auto cache = ml::load_dataset_cache( args[ 0]);
+ std::cout << cache.dataset.height() << " rows\n";
+ for( std::size_t j = 0; j < cache.dataset.width(); ++j){
+  const auto& s = cache.summaries[ j];
+  std::cout << cache.names[ j] << "\t" << dtype_name( cache.dataset.column( j).type())
+            << "\t[" << s.min << ", " << s.max << "]\tmissing " << s.n_missing
+            << "\tbins " << (s.bin_edges.empty() ? 0 : s.bin_edges.size()-1);
+  if( !cache.dictionaries[ j].empty()){ std::cout << "\tcategories " << cache.dictionaries[ j].size(); }
+  if( cache.dataset.column( j).order()){ std::cout << "\tpresorted"; }
+  std::cout << "\n";
+ }
+ return 0;
+}
+
+} //end namespace
+
+int main( int argc, char** argv){
+ if( argc < 2){ return usage(); }
+ const std::string command = argv[ 1];
+ const std::vector< std::string> args( argv+2, argv+argc);
+ try {
+  if( command == "cache"){ return cache( args); }
+  if( command == "info"){ return info( args); }
+ } catch( const std::exception& e){
+  std::cerr << "dataset " << command << ": " << e.what() << "\n";
+  return 1;
+ }
+ return usage();
+}
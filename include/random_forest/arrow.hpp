@@ -0,0 +1,433 @@
+#pragma once
+/**
+ * Zero copy ingestion of Apache Arrow arrays and DLPack tensors into a
+ * columnar_dataset.
+ *
+ * Both are C ABIs for handing a buffer from one library to another along
+ * with a release callback, so pandas, polars, pyarrow or torch data reaches
+ * the trainer without a round trip through a dense double matrix.
+ *
+ * Arrow: a struct array (a record batch) becomes one column per child, a
+ * primitive array a single column. A stream of record batches (a table) is
+ * viewed in place when it holds a single batch and concatenated otherwise.
+ * Children of type uint8, uint16, float32 and float64 without nulls are
+ * viewed in place. Everything else is copied into the narrowest exact
+ * dtype: other integers, booleans, dictionary encoded columns (as their
+ * codes) and any column with nulls, whose null slots become NaN, the
+ * missing value of columnar_dataset. Batches may encode a column with
+ * different dictionaries, so concatenation maps the codes into one
+ * dictionary merged in order of first appearance; only utf8 dictionaries
+ * can be merged.
+ *
+ * DLPack: a 1-D or 2-D CPU tensor, rows by columns, with any strides.
+ * Columns of the four columnar dtypes are viewed in place, others copied.
+ *
+ * The importers take ownership of what they are given: the ArrowArray or
+ * stream is moved out of (its release set to null) and the DLManagedTensor's
+ * deleter is called once the last column viewing it goes away, or straight
+ * away if the import throws.
+ */
+
+//Project
+#include <random_forest/columnar_dataset.hpp>
+
+//STL
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring> //strerror
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+/**
+ * The Arrow C data interface, as specified at
+ * https://arrow.apache.org/docs/format/CDataInterface.html
+ */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+ const char* format;
+ const char* name;
+ const char* metadata;
+ int64_t flags;
+ int64_t n_children;
+ struct ArrowSchema** children;
+ struct ArrowSchema* dictionary;
+ void (*release)( struct ArrowSchema*);
+ void* private_data;
+};
+
+struct ArrowArray {
+ int64_t length;
+ int64_t null_count;
+ int64_t offset;
+ int64_t n_buffers;
+ int64_t n_children;
+ const void** buffers;
+ struct ArrowArray** children;
+ struct ArrowArray* dictionary;
+ void (*release)( struct ArrowArray*);
+ void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+#ifndef ARROW_C_STREAM_INTERFACE
+#define ARROW_C_STREAM_INTERFACE
+
+struct ArrowArrayStream {
+ int (*get_schema)( struct ArrowArrayStream*, struct ArrowSchema* out);
+ int (*get_next)( struct ArrowArrayStream*, struct ArrowArray* out);
+ const char* (*get_last_error)( struct ArrowArrayStream*);
+ void (*release)( struct ArrowArrayStream*);
+ void* private_data;
+};
+
+#endif  // ARROW_C_STREAM_INTERFACE
+
+/**
+ * The DLPack tensor structs, as in dlpack.h version 0.8
+ */
+#ifndef DLPACK_DLPACK_H_
+#define DLPACK_DLPACK_H_
+
+typedef enum {
+ kDLCPU = 1,
+ kDLCUDA = 2,
+ kDLCUDAHost = 3,
+} DLDeviceType;
+
+typedef struct {
+ DLDeviceType device_type;
+ int32_t device_id;
+} DLDevice;
+
+typedef enum {
+ kDLInt = 0U,
+ kDLUInt = 1U,
+ kDLFloat = 2U,
+ kDLOpaqueHandle = 3U,
+ kDLBfloat = 4U,
+ kDLComplex = 5U,
+ kDLBool = 6U,
+} DLDataTypeCode;
+
+typedef struct {
+ uint8_t code;
+ uint8_t bits;
+ uint16_t lanes;
+} DLDataType;
+
+typedef struct {
+ void* data;
+ DLDevice device;
+ int32_t ndim;
+ DLDataType dtype;
+ int64_t* shape;
+ int64_t* strides;
+ uint64_t byte_offset;
+} DLTensor;
+
+typedef struct DLManagedTensor {
+ DLTensor dl_tensor;
+ void* manager_ctx;
+ void (*deleter)( struct DLManagedTensor* self);
+} DLManagedTensor;
+
+#endif  // DLPACK_DLPACK_H_
+
+namespace ayasdi{
+namespace ml {
+
+namespace detail {
+
+inline bool arrow_valid( const std::uint8_t* validity, std::int64_t i){
+ return !validity || (validity[ i >> 3] >> (i & 7)) & 1;
+}
+
+//Copies a primitive array into the narrowest exact column, nulls as NaN
+template< typename T>
+column arrow_copy( const ArrowArray& a, std::int64_t offset, std::size_t length){
+ const auto validity = static_cast< const std::uint8_t*>( a.buffers[ 0]);
+ const T* values = static_cast< const T*>( a.buffers[ 1]);
+ std::vector< double> copy( length);
+ for( std::size_t i = 0; i < length; ++i){
+  copy[ i] = arrow_valid( validity, offset+i) ? (double)values[ offset+i] : std::numeric_limits< double>::quiet_NaN();
+ }
+ return narrow_column( copy.data(), length);
+}
+
+template< typename T>
+column arrow_column_of( const ArrowArray& a, std::int64_t offset, std::size_t length, bool has_nulls,
+                        const std::shared_ptr< void>& owner){
+ if( !has_nulls){ return column( static_cast< const T*>( a.buffers[ 1]) + offset, length, 1, owner); }
+ return arrow_copy< T>( a, offset, length);
+}
+
+inline column arrow_booleans( const ArrowArray& a, std::int64_t offset, std::size_t length){
+ const auto validity = static_cast< const std::uint8_t*>( a.buffers[ 0]);
+ const auto bits = static_cast< const std::uint8_t*>( a.buffers[ 1]);
+ std::vector< double> copy( length);
+ for( std::size_t i = 0; i < length; ++i){
+  copy[ i] = arrow_valid( validity, offset+i) ? (double)arrow_valid( bits, offset+i) :
+                                                std::numeric_limits< double>::quiet_NaN();
+ }
+ return narrow_column( copy.data(), length);
+}
+
+/**
+ * One column from a primitive or dictionary array. offset is the logical
+ * offset of the parent, if any, which applies on top of the array's own.
+ */
+inline column arrow_column( const ArrowSchema& schema, const ArrowArray& a, std::int64_t parent_offset,
+                            std::size_t length, const std::shared_ptr< void>& owner){
+ const std::string format = schema.format ? schema.format : "";
+ const std::string name = schema.name ? schema.name : "";
+ if( a.n_buffers != 2 || !a.buffers){
+  throw std::invalid_argument( "import_arrow: unsupported column '" + name + "' of format '" + format + "'");
+ }
+ const std::int64_t offset = a.offset + parent_offset;
+ if( a.length < parent_offset + (std::int64_t)length){ throw std::invalid_argument( "import_arrow: column '" + name + "' too short"); }
+ //null_count may be -1 for not computed, then the bitmap decides
+ bool has_nulls = a.null_count != 0 && a.buffers[ 0];
+ if( has_nulls && a.null_count < 0){
+  has_nulls = false;
+  const auto validity = static_cast< const std::uint8_t*>( a.buffers[ 0]);
+  for( std::size_t i = 0; i < length && !has_nulls; ++i){ has_nulls = !arrow_valid( validity, offset+i); }
+ }
+ if( !a.buffers[ 1] && length){ throw std::invalid_argument( "import_arrow: column '" + name + "' has no data"); }
+ //A dictionary encoded column is categorical, its indices are the category codes
+ if( format.size() == 1){
+  switch( format[ 0]){
+   case 'C': return arrow_column_of< std::uint8_t>( a, offset, length, has_nulls, owner);
+   case 'S': return arrow_column_of< std::uint16_t>( a, offset, length, has_nulls, owner);
+   case 'f': return arrow_column_of< float>( a, offset, length, has_nulls, owner);
+   case 'g': return arrow_column_of< double>( a, offset, length, has_nulls, owner);
+   case 'c': return arrow_copy< std::int8_t>( a, offset, length);
+   case 's': return arrow_copy< std::int16_t>( a, offset, length);
+   case 'i': return arrow_copy< std::int32_t>( a, offset, length);
+   case 'l': return arrow_copy< std::int64_t>( a, offset, length);
+   case 'I': return arrow_copy< std::uint32_t>( a, offset, length);
+   case 'L': return arrow_copy< std::uint64_t>( a, offset, length);
+   case 'b': return arrow_booleans( a, offset, length);
+  }
+ }
+ throw std::invalid_argument( "import_arrow: unsupported column '" + name + "' of format '" + format + "'");
+}
+
+template< typename Offset>
+std::vector< std::string> arrow_strings( const ArrowArray& a){
+ const Offset* offsets = static_cast< const Offset*>( a.buffers[ 1]) + a.offset;
+ const char* data = static_cast< const char*>( a.buffers[ 2]);
+ std::vector< std::string> strings( a.length);
+ for( std::int64_t k = 0; k < a.length; ++k){
+  if( offsets[ k+1] > offsets[ k]){ strings[ k].assign( data + offsets[ k], offsets[ k+1] - offsets[ k]); }
+ }
+ return strings;
+}
+
+/**
+ * The dictionaries of a batch's columns, empty for a column which is not
+ * dictionary encoded, and the format of the first dictionary which is not
+ * utf8 or large utf8, if any.
+ */
+struct arrow_dictionaries {
+ std::vector< std::vector< std::string> > values;
+ std::string unsupported;
+};
+
+inline arrow_dictionaries dictionaries_of( const ArrowSchema& schema, const ArrowArray& batch){
+ arrow_dictionaries result;
+ const bool record_batch = schema.format && std::string( schema.format) == "+s";
+ //A malformed batch is left for import_arrow() to reject
+ if( record_batch && batch.n_children != schema.n_children){ return result; }
+ const std::int64_t width = record_batch ? schema.n_children : 1;
+ result.values.resize( width);
+ for( std::int64_t j = 0; j < width; ++j){
+  const ArrowSchema& field = record_batch ? *schema.children[ j] : schema;
+  const ArrowArray& column = record_batch ? *batch.children[ j] : batch;
+  if( !field.dictionary || !column.dictionary){ continue; }
+  const std::string format = field.dictionary->format ? field.dictionary->format : "";
+  const ArrowArray& d = *column.dictionary;
+  const bool strings = (format == "u" || format == "U") && d.n_buffers == 3 && d.buffers;
+  if( strings && (d.length == 0 || (d.buffers[ 1] && d.buffers[ 2]))){
+   result.values[ j] = format == "u" ? arrow_strings< std::int32_t>( d) : arrow_strings< std::int64_t>( d);
+  }
+  else if( result.unsupported.empty()){ result.unsupported = format; }
+ }
+ return result;
+}
+
+template< typename T>
+column dlpack_copy( const char* data, std::size_t rows, std::int64_t row_stride){
+ std::vector< double> copy( rows);
+ for( std::size_t i = 0; i < rows; ++i){ copy[ i] = *reinterpret_cast< const T*>( data + (std::int64_t)i*row_stride); }
+ return narrow_column( copy.data(), rows);
+}
+
+//Column starting at data, rows elements row_stride bytes apart
+inline column dlpack_column( const DLDataType& type, const char* data, std::size_t rows, std::int64_t row_stride,
+                             const std::shared_ptr< void>& owner){
+ const std::size_t size = type.bits/8;
+ //Viewable if the stride is a whole, non negative number of elements
+ const bool view = row_stride >= 0 && row_stride % size == 0;
+ const std::size_t stride = row_stride/size;
+ switch( type.code*256 + type.bits){
+  case kDLUInt*256 + 8:   return view ? column( reinterpret_cast< const std::uint8_t*>( data), rows, stride, owner) :
+                                        dlpack_copy< std::uint8_t>( data, rows, row_stride);
+  case kDLUInt*256 + 16:  return view ? column( reinterpret_cast< const std::uint16_t*>( data), rows, stride, owner) :
+                                        dlpack_copy< std::uint16_t>( data, rows, row_stride);
+  case kDLFloat*256 + 32: return view ? column( reinterpret_cast< const float*>( data), rows, stride, owner) :
+                                        dlpack_copy< float>( data, rows, row_stride);
+  case kDLFloat*256 + 64: return view ? column( reinterpret_cast< const double*>( data), rows, stride, owner) :
+                                        dlpack_copy< double>( data, rows, row_stride);
+  case kDLUInt*256 + 32:  return dlpack_copy< std::uint32_t>( data, rows, row_stride);
+  case kDLUInt*256 + 64:  return dlpack_copy< std::uint64_t>( data, rows, row_stride);
+  case kDLInt*256 + 8:    return dlpack_copy< std::int8_t>( data, rows, row_stride);
+  case kDLInt*256 + 16:   return dlpack_copy< std::int16_t>( data, rows, row_stride);
+  case kDLInt*256 + 32:   return dlpack_copy< std::int32_t>( data, rows, row_stride);
+  case kDLInt*256 + 64:   return dlpack_copy< std::int64_t>( data, rows, row_stride);
+  case kDLBool*256 + 8:   return dlpack_copy< std::uint8_t>( data, rows, row_stride);
+ }
+ throw std::invalid_argument( "import_dlpack: unsupported element type");
+}
+
+} //end namespace detail
+
+/**
+ * Imports an Arrow array, moving it out of *array. schema is only read and
+ * stays the caller's. Columns viewing the array's buffers keep it alive and
+ * it is released with the last of them.
+ * Throws std::invalid_argument for column types other than integers,
+ * booleans, floats and dictionaries, or malformed arrays.
+ */
+inline columnar_dataset import_arrow( ArrowArray* array, const ArrowSchema& schema){
+ if( !array || !array->release){ throw std::invalid_argument( "import_arrow: array already released"); }
+ std::shared_ptr< ArrowArray> owner( new ArrowArray( *array), []( ArrowArray* a){
+     if( a->release){ a->release( a); }
+     delete a;
+ });
+ array->release = nullptr;
+ const std::string format = schema.format ? schema.format : "";
+ columnar_dataset dataset;
+ if( format != "+s"){
+  dataset.add_column( detail::arrow_column( schema, *owner, 0, owner->length, owner));
+  return dataset;
+ }
+ if( owner->n_children != schema.n_children){ throw std::invalid_argument( "import_arrow: schema does not match the array"); }
+ if( owner->null_count > 0){ throw std::invalid_argument( "import_arrow: struct arrays with null rows are not supported"); }
+ for( std::int64_t j = 0; j < owner->n_children; ++j){
+  dataset.add_column( detail::arrow_column( *schema.children[ j], *owner->children[ j], owner->offset,
+                                            owner->length, owner));
+ }
+ return dataset;
+}
+
+/**
+ * Imports a stream of Arrow record batches, moving it out of *stream.
+ * A single batch is imported as by import_arrow(), several are
+ * concatenated column by column into narrowest exact copies, with the codes
+ * of dictionary encoded columns mapped into a merged dictionary. Throws
+ * std::runtime_error if the stream reports an error, std::invalid_argument
+ * for several batches with dictionaries other than utf8.
+ */
+inline columnar_dataset import_arrow_stream( ArrowArrayStream* stream){
+ if( !stream || !stream->release){ throw std::invalid_argument( "import_arrow_stream: stream already released"); }
+ std::shared_ptr< ArrowArrayStream> owner( new ArrowArrayStream( *stream), []( ArrowArrayStream* s){
+     if( s->release){ s->release( s); }
+     delete s;
+ });
+ stream->release = nullptr;
+ auto check = [&]( int error){
+     if( !error){ return; }
+     const char* message = owner->get_last_error ? owner->get_last_error( owner.get()) : nullptr;
+     throw std::runtime_error( std::string( "import_arrow_stream: ") + (message ? message : std::strerror( error)));
+ };
+ ArrowSchema schema_struct;
+ check( owner->get_schema( owner.get(), &schema_struct));
+ std::shared_ptr< ArrowSchema> schema( new ArrowSchema( schema_struct), []( ArrowSchema* s){
+     if( s->release){ s->release( s); }
+     delete s;
+ });
+ std::vector< columnar_dataset> batches;
+ //Read before the import, which may release the dictionaries
+ std::vector< detail::arrow_dictionaries> dictionaries;
+ for( ;;){
+  ArrowArray batch;
+  check( owner->get_next( owner.get(), &batch));
+  if( !batch.release){ break; }
+  try { dictionaries.push_back( detail::dictionaries_of( *schema, batch)); }
+  catch( ...){ batch.release( &batch); throw; }
+  batches.push_back( import_arrow( &batch, *schema));
+ }
+ if( batches.size() == 1){ return std::move( batches[ 0]); }
+ for( auto& d: dictionaries){
+  if( !d.unsupported.empty()){
+   throw std::invalid_argument( "import_arrow_stream: dictionaries of format '" + d.unsupported +
+                                "' cannot be merged across batches");
+  }
+ }
+ std::size_t rows = 0;
+ for( auto& b: batches){ rows += b.height(); }
+ columnar_dataset dataset;
+ const std::size_t width = batches.empty() ? 0 : batches[ 0].width();
+ std::vector< double> values( rows);
+ for( std::size_t j = 0; j < width; ++j){
+  std::size_t i = 0;
+  std::unordered_map< std::string, double> merged;
+  for( std::size_t b = 0; b < batches.size(); ++b){
+   //The merged code of each of this batch's codes, none if not dictionary encoded
+   std::vector< double> codes;
+   for( auto& category: dictionaries[ b].values[ j]){ codes.push_back( merged.emplace( category, merged.size()).first->second); }
+   for( std::size_t k = 0; k < batches[ b].height(); ++k){
+    double v = batches[ b]( k, j);
+    if( !codes.empty() && !std::isnan( v)){
+     if( v < 0 || v >= codes.size()){ throw std::invalid_argument( "import_arrow_stream: dictionary index out of range"); }
+     v = codes[ (std::size_t)v];
+    }
+    values[ i++] = v;
+   }
+  }
+  dataset.add_column( narrow_column( values.data(), rows));
+ }
+ return dataset;
+}
+
+/**
+ * Imports a DLPack tensor of shape (rows) or (rows, columns), taking
+ * ownership of it. Throws std::invalid_argument for tensors not in host
+ * memory, of more than two dimensions, or of vector or complex elements.
+ */
+inline columnar_dataset import_dlpack( DLManagedTensor* tensor){
+ if( !tensor){ throw std::invalid_argument( "import_dlpack: null tensor"); }
+ std::shared_ptr< DLManagedTensor> owner( tensor, []( DLManagedTensor* t){ if( t->deleter){ t->deleter( t); } });
+ const DLTensor& t = tensor->dl_tensor;
+ if( t.device.device_type != kDLCPU && t.device.device_type != kDLCUDAHost){
+  throw std::invalid_argument( "import_dlpack: tensor is not in host memory");
+ }
+ if( t.ndim < 1 || t.ndim > 2){ throw std::invalid_argument( "import_dlpack: expected a 1-D or 2-D tensor"); }
+ if( t.dtype.lanes != 1 || t.dtype.bits == 0 || t.dtype.bits % 8){ throw std::invalid_argument( "import_dlpack: unsupported element type"); }
+ const std::size_t size = t.dtype.bits/8;
+ const std::size_t rows = t.shape[ 0];
+ const std::size_t cols = t.ndim == 2 ? t.shape[ 1] : 1;
+ //Null strides mean compact row major; strides are in elements
+ const std::int64_t row_stride = (t.strides ? t.strides[ 0] : (std::int64_t)cols)*size;
+ const std::int64_t col_stride = (t.ndim == 2 && t.strides ? t.strides[ 1] : 1)*size;
+ const char* base = static_cast< const char*>( t.data) + t.byte_offset;
+ columnar_dataset dataset;
+ for( std::size_t j = 0; j < cols; ++j){
+  dataset.add_column( detail::dlpack_column( t.dtype, base + (std::int64_t)j*col_stride, rows, row_stride, owner));
+ }
+ return dataset;
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -0,0 +1,135 @@
+#pragma once
+/**
+ * Ahead of time compilation of a trained forest into C++ source.
+ *
+ * write_cpp() emits a standalone translation unit exporting
+ *
+ *    int <function_name>( const double* x);
+ *
+ * which returns the same class index as random_forest_classifier::predict()
+ * for the row x. Features and thresholds are literals, so the compiler sees
+ * the whole forest and no node is loaded from memory at run time.
+ *
+ * Two styles are available:
+ *  nested_if:  every tree is a function of nested if statements.
+ *  branchless: every tree is a constant table walked for exactly the depth
+ *              of the tree; leaves point to themselves, so the loop has no
+ *              data dependent branch and the child index is selected by the
+ *              comparison result.
+ *
+ * Thresholds are printed with max_digits10 digits, which round trips
+ * every double exactly.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+
+//STL
+#include <ostream>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <ios>
+#include <algorithm>
+
+namespace ayasdi{
+namespace ml {
+
+enum class codegen_style { nested_if, branchless };
+
+struct codegen_options {
+ codegen_style style=codegen_style::nested_if;
+ std::string function_name="rf_predict";
+};
+
+namespace detail {
+
+inline std::ostream& write_literal( std::ostream& out, double v){
+ if( std::isinf( v)){ return out << (v < 0 ? "-" : "") << "std::numeric_limits< double>::infinity()"; }
+ if( std::isnan( v)){ return out << "std::numeric_limits< double>::quiet_NaN()"; }
+ //The caller's precision is restored, only the literal needs every digit
+ const std::streamsize precision = out.precision( std::numeric_limits< double>::max_digits10);
+ out << v;
+ out.precision( precision);
+ return out;
+}
+
+template< typename Label_type>
+void write_nested_if( std::ostream& out, const decision_tree< Label_type>& t, std::size_t node, std::size_t indent){
+ const auto& n = t[ node];
+ const std::string pad( indent, ' ');
+ if( n.is_leaf()){
+  out << pad << "return " << (long long)n.template class_label< Label_type>() << ";\n";
+  return;
+ }
+ out << pad << "if( x[ " << n.split_ << "] < ";
+ write_literal( out, n.split_value_) << "){\n";
+ write_nested_if( out, t, n.left_child_index(), indent+1);
+ out << pad << "} else {\n";
+ write_nested_if( out, t, n.right_child_index(), indent+1);
+ out << pad << "}\n";
+}
+
+template< typename Label_type>
+std::size_t depth( const decision_tree< Label_type>& t, std::size_t node){
+ const auto& n = t[ node];
+ if( n.is_leaf()){ return 0; }
+ return 1 + std::max( depth( t, n.left_child_index()), depth( t, n.right_child_index()));
+}
+
+template< typename Label_type>
+void write_branchless( std::ostream& out, const decision_tree< Label_type>& t){
+ const std::size_t n = t.size();
+ out << " static const unsigned feature[ " << n << "] = {";
+ for( std::size_t i = 0; i < n; ++i){ out << (i ? ", " : " ") << (t[ i].is_leaf() ? 0 : t[ i].split_); }
+ out << " };\n static const double threshold[ " << n << "] = {";
+ for( std::size_t i = 0; i < n; ++i){
+  out << (i ? ", " : " ");
+  //Leaves compare against anything, both children are the leaf itself
+  write_literal( out, t[ i].is_leaf() ? 0.0 : t[ i].split_value_);
+ }
+ out << " };\n static const unsigned child[ " << 2*n << "] = {";
+ for( std::size_t i = 0; i < n; ++i){
+  const bool leaf = t[ i].is_leaf();
+  out << (i ? ", " : " ") << (leaf ? i : t[ i].left_child_index()) << ", " << (leaf ? i : t[ i].right_child_index());
+ }
+ out << " };\n static const int label[ " << n << "] = {";
+ for( std::size_t i = 0; i < n; ++i){
+  out << (i ? ", " : " ") << (t[ i].is_leaf() ? (long long)t[ i].template class_label< Label_type>() : 0);
+ }
+ out << " };\n"
+     << " unsigned i = 0;\n"
+     << " for( unsigned d = 0; d < " << depth( t, 0) << "; ++d){ i = child[ 2*i + !(x[ feature[ i]] < threshold[ i])]; }\n"
+     << " return label[ i];\n";
+}
+
+} //end namespace detail
+
+/**
+ * Writes forest as a C++ translation unit, see the top of this file.
+ */
+template< typename Label_type>
+void write_cpp( const random_forest_classifier< Label_type>& forest, std::ostream& out,
+                const codegen_options& options=codegen_options()){
+ out << "//Generated from a random_forest_classifier with " << forest.size() << " trees. Do not edit.\n"
+     << "#include <limits>\n\n"
+     << "namespace {\n\n";
+ for( std::size_t t = 0; t < forest.size(); ++t){
+  out << "inline int tree_" << t << "( const double* x){\n";
+  if( options.style == codegen_style::branchless){ detail::write_branchless( out, forest[ t]); }
+  else { detail::write_nested_if( out, forest[ t], 0, 1); }
+  out << "}\n\n";
+ }
+ out << "} //end anonymous namespace\n\n"
+     << "int " << options.function_name << "( const double* x){\n"
+     << " unsigned votes[ " << std::max< std::size_t>( 1, forest.n_classes()) << "] = { 0 };\n";
+ for( std::size_t t = 0; t < forest.size(); ++t){ out << " votes[ tree_" << t << "( x)]++;\n"; }
+ out << " int best = 0;\n"
+     << " for( int c = 1; c < " << forest.n_classes() << "; ++c){ if( votes[ c] > votes[ best]){ best = c; } }\n"
+     << " return best;\n"
+     << "}\n";
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -0,0 +1,291 @@
+#pragma once
+/**
+ * A column major dataset where every column has its own element type.
+ *
+ * Columns such as months or days of the week fit in a uint8, so storing
+ * everything as double wastes memory bandwidth during split search. A column
+ * is a typed, strided, possibly non-owning view; narrow_column() picks the
+ * narrowest of uint8, uint16, float32 and float64 which represents every
+ * value of a column exactly.
+ *
+ * Code that wants the element type dispatches with visit(), which calls a
+ * generic functor with a column_view< T> of the concrete type.
+ *
+ * Missing values are NaN, so only float columns hold them. Every predictor
+ * sends a row left when x < threshold, which is false for NaN, so missing
+ * values always go right; split search orders them last to match.
+ */
+
+//Project
+#include <random_forest/matrix.hpp>
+
+//STL
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+namespace ayasdi{
+namespace ml {
+
+enum class dtype : std::uint8_t { uint8=0, uint16=1, float32=2, float64=3 };
+
+template< typename T> struct dtype_of;
+template<> struct dtype_of< std::uint8_t>  { static constexpr dtype value = dtype::uint8; };
+template<> struct dtype_of< std::uint16_t> { static constexpr dtype value = dtype::uint16; };
+template<> struct dtype_of< float>         { static constexpr dtype value = dtype::float32; };
+template<> struct dtype_of< double>        { static constexpr dtype value = dtype::float64; };
+
+inline std::size_t size_of( dtype t){
+ switch( t){
+  case dtype::uint8:  return 1;
+  case dtype::uint16: return 2;
+  case dtype::float32: return 4;
+  default: return 8;
+ }
+}
+
+/**
+ * Typed, strided read only view of one column.
+ * Stride is in elements.
+ */
+template< typename T>
+struct column_view {
+ typedef T value_type;
+ const T* data;
+ std::size_t size;
+ std::size_t stride;
+ //Every row in ascending order of value, missing values last, or null if not known
+ const std::uint32_t* order;
+ T operator[]( std::size_t i) const { return data[ i*stride]; }
+};
+
+/**
+ * Strict weak order on column values with missing (NaN) values last.
+ */
+template< typename T>
+bool missing_last( T a, T b){ return a < b || (b != b && a == a); }
+
+/**
+ * Sorts the distinct rows [begin, end) of column by value, missing values
+ * last. With a presorted order of the whole column and rows making up a
+ * large part of it, marks the rows and collects them in that order, which
+ * is linear in the column size instead of n log n compares. marks is
+ * scratch, all zero between calls.
+ */
+template< typename T, typename Row_index_iterator>
+void sort_rows( const column_view< T>& column, Row_index_iterator begin, Row_index_iterator end,
+                std::vector< std::uint8_t>& marks){
+ const std::size_t n = std::distance( begin, end);
+ if( !column.order || n < 64 || n*std::log2( n) < column.size){
+  std::sort( begin, end, [&]( std::size_t a, std::size_t b){ return missing_last( column[ a], column[ b]); });
+  return;
+ }
+ marks.resize( column.size);
+ for( auto i = begin; i != end; ++i){ marks[ *i] = 1; }
+ auto out = begin;
+ for( std::size_t k = 0; k < column.size && out != end; ++k){
+  const std::size_t row = column.order[ k];
+  if( marks[ row]){
+   marks[ row] = 0;
+   *out++ = row;
+  }
+ }
+}
+
+/**
+ * Type erased column. Either views memory owned elsewhere or shares
+ * ownership of its storage.
+ */
+class column {
+public:
+ column(): type_( dtype::float64), data_( nullptr), size_( 0), stride_( 1) {}
+
+ //Non owning view
+ template< typename T>
+ column( const T* data, std::size_t size, std::size_t stride=1):
+ type_( dtype_of< T>::value), data_( data), size_( size), stride_( stride) {}
+
+ //View of memory kept alive by owner, e.g. an imported foreign buffer
+ template< typename T>
+ column( const T* data, std::size_t size, std::size_t stride, std::shared_ptr< void> owner):
+ type_( dtype_of< T>::value), data_( data), size_( size), stride_( stride), storage_( std::move( owner)) {}
+
+ //Takes ownership of values
+ template< typename T>
+ explicit column( std::vector< T>&& values):
+ type_( dtype_of< T>::value), size_( values.size()), stride_( 1) {
+     auto storage = std::make_shared< std::vector< T> >( std::move( values));
+     data_ = storage->data();
+     storage_ = storage;
+ }
+
+ dtype type() const { return type_; }
+ std::size_t size() const { return size_; }
+ std::size_t stride() const { return stride_; }
+ const void* data() const { return data_; }
+ bool owns_data() const { return (bool)storage_; }
+
+ //Every row in ascending order of value, missing values last, or null if not known
+ const std::uint32_t* order() const { return order_; }
+ //Sets the order of the rows, kept alive by owner
+ void order( const std::uint32_t* rows, std::shared_ptr< void> owner){
+     order_ = rows;
+     order_storage_ = std::move( owner);
+ }
+
+ template< typename T>
+ column_view< T> view() const {
+     if( dtype_of< T>::value != type_){ throw std::logic_error( "column: wrong element type"); }
+     return column_view< T>{ static_cast< const T*>( data_), size_, stride_, order_ };
+ }
+
+ //Element as a double, dispatching on the type every call.
+ double operator[]( std::size_t i) const {
+     switch( type_){
+      case dtype::uint8:   return static_cast< const std::uint8_t*>( data_)[ i*stride_];
+      case dtype::uint16:  return static_cast< const std::uint16_t*>( data_)[ i*stride_];
+      case dtype::float32: return static_cast< const float*>( data_)[ i*stride_];
+      default:             return static_cast< const double*>( data_)[ i*stride_];
+     }
+ }
+
+private:
+ dtype type_;
+ const void* data_;
+ std::size_t size_;
+ std::size_t stride_;
+ std::shared_ptr< void> storage_;
+ const std::uint32_t* order_ = nullptr;
+ std::shared_ptr< void> order_storage_;
+}; //end class column
+
+/**
+ * Calls f( column_view< T>) with T the element type of c.
+ */
+template< typename Functor>
+auto visit( const column& c, Functor&& f) -> decltype( f( c.view< double>())) {
+ switch( c.type()){
+  case dtype::uint8:   return f( c.view< std::uint8_t>());
+  case dtype::uint16:  return f( c.view< std::uint16_t>());
+  case dtype::float32: return f( c.view< float>());
+  default:             return f( c.view< double>());
+ }
+}
+
+/**
+ * The narrowest dtype that represents every value[ i*stride] exactly.
+ */
+template< typename T>
+dtype narrowest_dtype( const T* values, std::size_t size, std::size_t stride=1){
+ bool integral=true, fits_float=true;
+ double max_value=0;
+ for( std::size_t i = 0; i < size; ++i){
+  const double v = values[ i*stride];
+  if( integral && !(v >= 0 && v == std::floor( v))){ integral = false; }
+  if( integral){ max_value = std::max( max_value, v); }
+  if( fits_float && !std::isnan( v) && (double)(float)v != v){ fits_float = false; }
+  if( !integral && !fits_float){ return dtype::float64; }
+ }
+ if( integral && max_value <= std::numeric_limits< std::uint8_t>::max()){ return dtype::uint8; }
+ if( integral && max_value <= std::numeric_limits< std::uint16_t>::max()){ return dtype::uint16; }
+ return fits_float ? dtype::float32 : dtype::float64;
+}
+
+namespace detail {
+template< typename To, typename T>
+column narrow_copy( const T* values, std::size_t size, std::size_t stride){
+ std::vector< To> copy( size);
+ for( std::size_t i = 0; i < size; ++i){ copy[ i] = static_cast< To>( values[ i*stride]); }
+ return column( std::move( copy));
+}
+} //end namespace detail
+
+/**
+ * Copies values into an owning column of the narrowest exact dtype.
+ */
+template< typename T>
+column narrow_column( const T* values, std::size_t size, std::size_t stride=1){
+ switch( narrowest_dtype( values, size, stride)){
+  case dtype::uint8:   return detail::narrow_copy< std::uint8_t>( values, size, stride);
+  case dtype::uint16:  return detail::narrow_copy< std::uint16_t>( values, size, stride);
+  case dtype::float32: return detail::narrow_copy< float>( values, size, stride);
+  default:             return detail::narrow_copy< double>( values, size, stride);
+ }
+}
+
+class columnar_dataset {
+public:
+ /**
+ * A row of the dataset, usable as the Datapoint of decision_tree::vote()
+ */
+ class row_view {
+ public:
+  row_view( const columnar_dataset& d, std::size_t i): d_( d), i_( i) {}
+  double operator[]( std::size_t j) const { return d_.columns_[ j][ i_]; }
+ private:
+  const columnar_dataset& d_;
+  std::size_t i_;
+ };
+
+ columnar_dataset(): n_rows( 0) {}
+
+ void add_column( ml::column c){
+     if( columns_.empty()){ n_rows = c.size(); }
+     if( c.size() != n_rows){ throw std::invalid_argument( "columnar_dataset: column length mismatch"); }
+     columns_.push_back( std::move( c));
+ }
+
+ std::size_t height() const { return n_rows; }
+ std::size_t width() const { return columns_.size(); }
+
+ const ml::column& column( std::size_t j) const { return columns_[ j]; }
+ double operator()( std::size_t i, std::size_t j) const { return columns_[ j][ i]; }
+ row_view row( std::size_t i) const { return row_view( *this, i); }
+
+ //Bytes of column data, the quantity split search streams through.
+ std::size_t bytes() const {
+     std::size_t b = 0;
+     for( auto& c: columns_){ b += c.size()*size_of( c.type()); }
+     return b;
+ }
+
+private:
+ std::vector< ml::column> columns_;
+ std::size_t n_rows;
+}; //end class columnar_dataset
+
+/**
+ * Copies any dataset providing d( i, j), height() and width()
+ * into a columnar_dataset with the narrowest exact dtype per column.
+ */
+template< typename Dataset>
+columnar_dataset make_columnar( const Dataset& d){
+ columnar_dataset result;
+ std::vector< double> values( d.height());
+ for( std::size_t j = 0; j < d.width(); ++j){
+  for( std::size_t i = 0; i < d.height(); ++i){ values[ i] = d( i, j); }
+  result.add_column( narrow_column( values.data(), values.size()));
+ }
+ return result;
+}
+
+/**
+ * Columns of m as non-owning strided columns, without a copy.
+ * T must be one of the column element types.
+ */
+template< typename T>
+columnar_dataset columnar_view( const Matrix_view< T>& m){
+ columnar_dataset result;
+ for( std::size_t j = 0; j < m.width(); ++j){
+  result.add_column( column( (const T*)&m( 0, j), m.height(), m.row_stride()));
+ }
+ return result;
+}
+
+} //end namespace ml
+} //end namespace ayasdi
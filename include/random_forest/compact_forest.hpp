@@ -0,0 +1,251 @@
+#pragma once
+/**
+ * Frozen, compact representation of a trained forest for inference.
+ *
+ * A dtree_node takes 24 bytes. A compact_node takes 8:
+ *   float threshold        split threshold, for a leaf the leaf index
+ *   uint16 feature         split feature, leaf_feature for a leaf
+ *   uint16 right_offset    distance to the right child
+ * The nodes of a tree are stored in preorder, so the left child of a node
+ * is always the next node and only the right child needs an offset. Leaf
+ * labels are kept in a separate array, indexed by the leaf index.
+ *
+ * A split whose right child is 65535 nodes or more away is a far split:
+ * its right_offset is far_offset, and the node after it is an extension
+ * node holding the real offset in its threshold bits, so its left child is
+ * two nodes on. Far splits only occur above left subtrees that large, so
+ * traversal almost never takes that branch.
+ *
+ * Limits: fewer than 65535 features, and fewer than 2^32 nodes between a
+ * split and its right child. freeze() throws std::length_error otherwise.
+ *
+ * Thresholds are rounded down to float. Predictions equal those of the
+ * source forest whenever every threshold is representable as a float, which
+ * is the case for integer or float32 data; exact() reports this.
+ *
+ * compact_forest owns its arrays, compact_forest_view only points to them,
+ * so the same traversal code runs over memory owned elsewhere.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/matrix.hpp>
+
+//STL
+#include <vector>
+#include <cstdint>
+#include <cstring> //memcpy
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+namespace ayasdi{
+namespace ml {
+
+struct compact_node {
+ static constexpr std::uint16_t leaf_feature = 0xFFFF;
+ static constexpr std::uint16_t far_offset = 0xFFFF;
+
+ float threshold;
+ std::uint16_t feature;
+ std::uint16_t right_offset;
+
+ bool is_leaf() const { return feature == leaf_feature; }
+ bool is_far() const { return right_offset == far_offset; }
+ std::uint32_t leaf_index() const {
+     std::uint32_t i;
+     std::memcpy( &i, &threshold, sizeof( i));
+     return i;
+ }
+ static compact_node leaf( std::uint32_t leaf_index){
+     compact_node n;
+     std::memcpy( &n.threshold, &leaf_index, sizeof( leaf_index));
+     n.feature = leaf_feature;
+     n.right_offset = 0;
+     return n;
+ }
+ //The node after a far split; entered by mistake it only moves on one node
+ static compact_node extension( std::uint32_t offset){
+     compact_node n;
+     std::memcpy( &n.threshold, &offset, sizeof( offset));
+     n.feature = 0;
+     n.right_offset = 1;
+     return n;
+ }
+};
+static_assert( sizeof( compact_node) == 8, "compact_node must be 8 bytes");
+
+/**
+ * Largest float not above v, so that values equal to a threshold still go right.
+ */
+inline float float_threshold( double v){
+ float f = static_cast< float>( v);
+ if( (double)f > v){ f = std::nextafter( f, -std::numeric_limits< float>::infinity()); }
+ return f;
+}
+
+/**
+ * Non owning view of a frozen forest.
+ * Tree t occupies nodes[ tree_offsets[ t], tree_offsets[ t+1]).
+ */
+template< typename Label_type>
+struct compact_forest_view {
+ const compact_node* nodes;
+ const std::uint64_t* tree_offsets;
+ const Label_type* leaf_labels;
+ std::size_t n_trees;
+ std::size_t n_classes;
+
+ std::size_t size() const { return n_trees; }
+
+ /**
+ * Index into leaf_labels of the leaf of tree t reached by p.
+ */
+ template< typename Datapoint>
+ std::uint32_t leaf( std::size_t t, const Datapoint& p) const{
+    const compact_node* n = nodes + tree_offsets[ t];
+    while( !n->is_leaf()){
+     const bool left = p[ n->feature] < n->threshold;
+     if( !n->is_far()){ n += left ? 1 : n->right_offset; }
+     else { n += left ? 2 : n[ 1].leaf_index(); }
+    }
+    return n->leaf_index();
+ }
+
+ template< typename Datapoint>
+ Label_type vote( std::size_t t, const Datapoint& p) const{ return leaf_labels[ leaf( t, p)]; }
+
+ template< typename Datapoint,
+           typename = typename std::enable_if< !is_matrix_view< Datapoint>::value>::type>
+ Label_type predict( const Datapoint& p) const{
+    std::vector< std::uint32_t> votes( n_classes);
+    for( std::size_t t = 0; t < n_trees; ++t){ votes[ (std::size_t)vote( t, p)]++; }
+    return std::max_element( votes.begin(), votes.end()) - votes.begin();
+ }
+
+ /**
+ * Labels of every row of X into out, tree major within blocks of
+ * PREDICT_BLOCK_ROWS rows as in random_forest_classifier::predict().
+ */
+ template< typename T>
+ void predict( const Matrix_view< T>& X, Label_type* out) const{
+    std::vector< std::uint32_t> block_votes( PREDICT_BLOCK_ROWS*n_classes);
+    for( std::size_t begin = 0; begin < X.height(); begin += PREDICT_BLOCK_ROWS){
+     const std::size_t end = std::min< std::size_t>( X.height(), begin+PREDICT_BLOCK_ROWS);
+     std::fill( block_votes.begin(), block_votes.end(), 0);
+     for( std::size_t t = 0; t < n_trees; ++t){
+      for( std::size_t i = begin; i < end; ++i){
+       block_votes[ (i-begin)*n_classes + (std::size_t)vote( t, X.row( i))]++;
+      }
+     }
+     for( std::size_t i = begin; i < end; ++i){
+      auto row_votes = block_votes.begin() + (i-begin)*n_classes;
+      out[ i] = std::max_element( row_votes, row_votes+n_classes) - row_votes;
+     }
+    }
+ }
+}; //end struct compact_forest_view
+
+template< typename Label_type>
+class compact_forest {
+public:
+ typedef compact_forest_view< Label_type> view_type;
+
+ compact_forest(): n_classes_( 0), exact_( true) { tree_offsets.push_back( 0); }
+
+ view_type view() const {
+     return view_type{ nodes.data(), tree_offsets.data(), leaf_labels.data(), size(), n_classes_ };
+ }
+
+ std::size_t size() const { return tree_offsets.size()-1; }
+ std::size_t n_classes() const { return n_classes_; }
+ bool exact() const { return exact_; }
+ //Bytes used by the nodes and leaf labels
+ std::size_t bytes() const {
+     return nodes.size()*sizeof( compact_node) + leaf_labels.size()*sizeof( Label_type) +
+            tree_offsets.size()*sizeof( std::uint64_t);
+ }
+
+ template< typename Datapoint,
+           typename = typename std::enable_if< !is_matrix_view< Datapoint>::value>::type>
+ Label_type predict( const Datapoint& p) const{ return view().predict( p); }
+ template< typename T>
+ void predict( const Matrix_view< T>& X, Label_type* out) const{ view().predict( X, out); }
+ template< typename T>
+ std::vector< Label_type> predict( const Matrix_view< T>& X) const{
+     std::vector< Label_type> labels( X.height());
+     predict( X, labels.data());
+     return labels;
+ }
+
+ std::vector< compact_node> nodes;
+ std::vector< std::uint64_t> tree_offsets;
+ std::vector< Label_type> leaf_labels;
+
+private:
+ template< typename L>
+ friend compact_forest< L> freeze( const random_forest_classifier< L>& forest);
+
+ /**
+ * Appends the subtree at node in preorder.
+ */
+ void add_subtree( const decision_tree< Label_type>& t, std::size_t node){
+    const auto& n = t[ node];
+    if( n.is_leaf()){
+     const Label_type label = n.template class_label< Label_type>();
+     //predict() and the SIMD kernels index their votes by label
+     if( (std::size_t)label >= n_classes_){
+      throw std::out_of_range( "compact_forest: a leaf votes for a class beyond n_classes()");
+     }
+     nodes.push_back( compact_node::leaf( leaf_labels.size()));
+     leaf_labels.push_back( label);
+     return;
+    }
+    if( n.split_ >= compact_node::leaf_feature){
+     throw std::length_error( "compact_forest: feature index does not fit in 16 bits");
+    }
+    const std::size_t position = nodes.size();
+    compact_node c;
+    c.threshold = float_threshold( n.split_value_);
+    c.feature = n.split_;
+    c.right_offset = 0;
+    exact_ = exact_ && ((double)c.threshold == n.split_value_);
+    nodes.push_back( c);
+    add_subtree( t, n.left_child_index());
+    std::size_t offset = nodes.size() - position;
+    if( offset >= compact_node::far_offset){
+     //Offsets inside the left subtree are relative, so it can move on by one
+     if( ++offset > std::numeric_limits< std::uint32_t>::max()){
+      throw std::length_error( "compact_forest: left subtree too large for a 32 bit offset, limit max_depth");
+     }
+     nodes.insert( nodes.begin() + position + 1, compact_node::extension( offset));
+     nodes[ position].right_offset = compact_node::far_offset;
+    }
+    else { nodes[ position].right_offset = offset; }
+    add_subtree( t, n.right_child_index());
+ }
+
+ std::size_t n_classes_;
+ bool exact_;
+}; //end class compact_forest
+
+/**
+ * Freezes a trained forest into the compact inference layout.
+ * Throws std::out_of_range if a leaf label is not below forest.n_classes().
+ */
+template< typename Label_type>
+compact_forest< Label_type> freeze( const random_forest_classifier< Label_type>& forest){
+ compact_forest< Label_type> result;
+ result.n_classes_ = forest.n_classes();
+ for( auto& t: forest){
+  if( t.size()){ result.add_subtree( t, 0); }
+  else { result.nodes.push_back( compact_node::leaf( result.leaf_labels.size())); result.leaf_labels.push_back( Label_type()); }
+  result.tree_offsets.push_back( result.nodes.size());
+ }
+ return result;
+}
+
+} //end namespace ml
+} //end namespace ayasdi
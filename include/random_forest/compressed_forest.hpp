@@ -0,0 +1,449 @@
+#pragma once
+/**
+ * Lossless compression of a trained forest.
+ *
+ * compress() applies three reductions:
+ *  1. Thresholds are snapped onto a per feature table of the distinct
+ *     thresholds the forest uses, so a node stores a bin id into its
+ *     feature's table instead of a double.
+ *  2. Bin ids are stored as uint8 when every table has at most 256
+ *     entries, as uint16 otherwise.
+ *  3. Structurally identical subtrees, within and across trees, are
+ *     merged into one shared node of a DAG (hash consing, bottom up).
+ *     Leaves are shared by label, and a node whose two children are the
+ *     same shared node is replaced by that child.
+ *
+ * Nodes are stored as parallel arrays: feature (uint16), bin id and two
+ * 32 bit child references. A reference with the high bit set is a leaf,
+ * the remaining bits index leaf_labels. Predictions are identical to those
+ * of the source forest, thresholds are kept as doubles in the tables.
+ * Leaf class distributions are not kept, compressed forests predict labels.
+ *
+ * serialize_compressed() writes these arrays as they are, all little
+ * endian, no padding:
+ *
+ *   magic "RFCOMPRS", format version (uint32), byte order tag 0x01020304,
+ *   sizeof( Label_type) (uint16), label kind (uint16: 0 signed, 1 unsigned,
+ *   2 floating point), number of classes and bytes per bin id (uint64),
+ *   then thresholds, feature_offsets, features, the bin ids, children,
+ *   leaf_labels and roots, each a uint64 element count and the elements.
+ *
+ * so a stored forest takes bytes() plus 92 bytes. Reading checks every
+ * count, reference and label, so a truncated or corrupt image throws
+ * std::runtime_error instead of producing a forest that walks out of
+ * bounds.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/matrix.hpp>
+
+//STL
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include <type_traits>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <cstring> //memcpy, memcmp
+#include <cerrno>
+#include <system_error>
+
+namespace ayasdi{
+namespace ml {
+
+namespace detail {
+template< typename Label_type> class forest_compressor;
+template< typename Label_type> class compressed_serializer;
+} //end namespace detail
+
+template< typename Label_type>
+class compressed_forest {
+public:
+ typedef std::uint32_t reference;
+ static constexpr reference leaf_bit = reference( 1) << 31;
+
+ std::size_t size() const { return roots.size(); }
+ std::size_t n_classes() const { return n_classes_; }
+ //Number of shared internal nodes
+ std::size_t n_nodes() const { return features.size(); }
+ //Bytes per bin id, 1 or 2
+ std::size_t bin_width() const { return bins8.size() || bins16.empty() ? 1 : 2; }
+ std::size_t bytes() const {
+     return thresholds.size()*sizeof( double) + feature_offsets.size()*sizeof( std::uint32_t) +
+            features.size()*sizeof( std::uint16_t) + bins8.size() + bins16.size()*sizeof( std::uint16_t) +
+            children.size()*sizeof( reference) + leaf_labels.size()*sizeof( Label_type) +
+            roots.size()*sizeof( reference);
+ }
+
+ //Threshold of internal node n
+ double threshold( reference n) const {
+     const std::size_t bin = bins8.size() ? bins8[ n] : bins16[ n];
+     return thresholds[ feature_offsets[ features[ n]] + bin];
+ }
+
+ template< typename Datapoint>
+ Label_type vote( std::size_t t, const Datapoint& p) const{
+    reference r = roots[ t];
+    while( !(r & leaf_bit)){ r = children[ 2*r + !(p[ features[ r]] < threshold( r))]; }
+    return leaf_labels[ r & ~leaf_bit];
+ }
+
+ template< typename Datapoint,
+           typename = typename std::enable_if< !is_matrix_view< Datapoint>::value>::type>
+ Label_type predict( const Datapoint& p) const{
+    std::vector< std::uint32_t> votes( n_classes_);
+    for( std::size_t t = 0; t < size(); ++t){ votes[ (std::size_t)vote( t, p)]++; }
+    return std::max_element( votes.begin(), votes.end()) - votes.begin();
+ }
+
+ /**
+ * Labels of every row of X into out, tree major within blocks of
+ * PREDICT_BLOCK_ROWS rows as in random_forest_classifier::predict().
+ */
+ template< typename T>
+ void predict( const Matrix_view< T>& X, Label_type* out) const{
+    std::vector< std::uint32_t> block_votes( PREDICT_BLOCK_ROWS*n_classes_);
+    for( std::size_t begin = 0; begin < X.height(); begin += PREDICT_BLOCK_ROWS){
+     const std::size_t end = std::min< std::size_t>( X.height(), begin+PREDICT_BLOCK_ROWS);
+     std::fill( block_votes.begin(), block_votes.end(), 0);
+     for( std::size_t t = 0; t < size(); ++t){
+      for( std::size_t i = begin; i < end; ++i){
+       block_votes[ (i-begin)*n_classes_ + (std::size_t)vote( t, X.row( i))]++;
+      }
+     }
+     for( std::size_t i = begin; i < end; ++i){
+      auto row_votes = block_votes.begin() + (i-begin)*n_classes_;
+      out[ i] = std::max_element( row_votes, row_votes+n_classes_) - row_votes;
+     }
+    }
+ }
+
+ template< typename T>
+ std::vector< Label_type> predict( const Matrix_view< T>& X) const{
+    std::vector< Label_type> labels( X.height());
+    predict( X, labels.data());
+    return labels;
+ }
+
+ //Thresholds of feature j are [feature_offsets[ j], feature_offsets[ j+1])
+ std::vector< double> thresholds;
+ std::vector< std::uint32_t> feature_offsets;
+ //Internal nodes, exactly one of bins8 and bins16 is used
+ std::vector< std::uint16_t> features;
+ std::vector< std::uint8_t> bins8;
+ std::vector< std::uint16_t> bins16;
+ //children[ 2*n] and children[ 2*n+1] are the left and right child of node n
+ std::vector< reference> children;
+ std::vector< Label_type> leaf_labels;
+ std::vector< reference> roots;
+
+private:
+ friend class detail::forest_compressor< Label_type>;
+ friend class detail::compressed_serializer< Label_type>;
+
+ std::size_t n_classes_=0;
+}; //end class compressed_forest
+
+namespace detail {
+
+template< typename Label_type>
+class forest_compressor {
+public:
+ typedef compressed_forest< Label_type> result_type;
+ typedef typename result_type::reference reference;
+
+ explicit forest_compressor( const random_forest_classifier< Label_type>& forest): forest_( forest) {}
+
+ result_type operator()(){
+     result.n_classes_ = forest_.n_classes();
+     build_tables();
+     for( auto& t: forest_){ result.roots.push_back( t.size() ? add( t, 0) : add_leaf( Label_type())); }
+     if( wide){ result.bins16.swap( bins); }
+     else { result.bins8.assign( bins.begin(), bins.end()); }
+     return result;
+ }
+
+private:
+ struct node_key {
+  std::uint16_t feature, bin;
+  reference left, right;
+  bool operator==( const node_key& k) const {
+      return feature == k.feature && bin == k.bin && left == k.left && right == k.right;
+  }
+ };
+ struct node_key_hash {
+  std::size_t operator()( const node_key& k) const {
+      std::uint64_t h = (std::uint64_t( k.feature) << 16 | k.bin) * 0x9E3779B97F4A7C15ull;
+      h ^= (std::uint64_t( k.left) << 32 | k.right) + 0x7F4A7C159E3779B9ull + (h << 6) + (h >> 2);
+      return h;
+  }
+ };
+
+ //Sorted distinct thresholds of every feature
+ void build_tables(){
+     std::vector< std::vector< double> > tables;
+     for( auto& t: forest_){
+      for( std::size_t i = 0; i < t.size(); ++i){
+       if( t[ i].is_leaf()){ continue; }
+       if( t[ i].split_ >= std::numeric_limits< std::uint16_t>::max()){
+        throw std::length_error( "compress: feature index does not fit in 16 bits");
+       }
+       if( tables.size() <= t[ i].split_){ tables.resize( t[ i].split_+1); }
+       tables[ t[ i].split_].push_back( t[ i].split_value_);
+      }
+     }
+     result.feature_offsets.assign( 1, 0);
+     for( auto& table: tables){
+      std::sort( table.begin(), table.end());
+      table.erase( std::unique( table.begin(), table.end()), table.end());
+      if( table.size() > std::numeric_limits< std::uint16_t>::max()+std::size_t( 1)){
+       throw std::length_error( "compress: more than 65536 distinct thresholds for one feature");
+      }
+      wide = wide || table.size() > 256;
+      result.thresholds.insert( result.thresholds.end(), table.begin(), table.end());
+      result.feature_offsets.push_back( result.thresholds.size());
+     }
+ }
+
+ reference add_leaf( Label_type label){
+     auto it = leaves.find( label);
+     if( it != leaves.end()){ return it->second; }
+     //Checked once per distinct label, predict() indexes its votes by label
+     if( (std::size_t)label >= result.n_classes_){
+      throw std::out_of_range( "compress: a leaf votes for a class beyond n_classes()");
+     }
+     const reference r = result.leaf_labels.size() | result_type::leaf_bit;
+     result.leaf_labels.push_back( label);
+     leaves.emplace( label, r);
+     return r;
+ }
+
+ reference add( const decision_tree< Label_type>& t, std::size_t i){
+     const auto& n = t[ i];
+     if( n.is_leaf()){ return add_leaf( n.template class_label< Label_type>()); }
+     const reference left = add( t, n.left_child_index());
+     const reference right = add( t, n.right_child_index());
+     //Both ways lead to the same subtree, the test is redundant
+     if( left == right){ return left; }
+     const auto begin = result.thresholds.begin() + result.feature_offsets[ n.split_];
+     const auto end = result.thresholds.begin() + result.feature_offsets[ n.split_+1];
+     const node_key key{ (std::uint16_t)n.split_, (std::uint16_t)(std::lower_bound( begin, end, n.split_value_) - begin),
+                         left, right };
+     auto it = nodes.find( key);
+     if( it != nodes.end()){ return it->second; }
+     const reference r = result.features.size();
+     if( r >= result_type::leaf_bit){ throw std::length_error( "compress: too many nodes"); }
+     result.features.push_back( key.feature);
+     bins.push_back( key.bin);
+     result.children.push_back( left);
+     result.children.push_back( right);
+     nodes.emplace( key, r);
+     return r;
+ }
+
+ const random_forest_classifier< Label_type>& forest_;
+ result_type result;
+ std::vector< std::uint16_t> bins;
+ bool wide=false;
+ std::unordered_map< node_key, reference, node_key_hash> nodes;
+ std::unordered_map< Label_type, reference> leaves;
+}; //end class forest_compressor
+
+constexpr char compressed_magic[ 8] = { 'R', 'F', 'C', 'O', 'M', 'P', 'R', 'S' };
+constexpr std::uint32_t compressed_format_version = 1;
+constexpr std::uint32_t compressed_byte_order = 0x01020304;
+
+template< typename Label_type>
+class compressed_serializer {
+public:
+ typedef compressed_forest< Label_type> forest_type;
+ typedef typename forest_type::reference reference;
+
+ static std::string write( const forest_type& f){
+     if( !little_endian()){ throw std::runtime_error( "serialize_compressed: big endian hosts are not supported"); }
+     std::string out;
+     out.append( compressed_magic, sizeof( compressed_magic));
+     put( out, compressed_format_version);
+     put( out, compressed_byte_order);
+     put( out, (std::uint16_t)sizeof( Label_type));
+     put( out, label_kind());
+     put( out, (std::uint64_t)f.n_classes_);
+     put( out, (std::uint64_t)f.bin_width());
+     put_array( out, f.thresholds);
+     put_array( out, f.feature_offsets);
+     put_array( out, f.features);
+     if( f.bin_width() == 1){ put_array( out, f.bins8); }
+     else { put_array( out, f.bins16); }
+     put_array( out, f.children);
+     put_array( out, f.leaf_labels);
+     put_array( out, f.roots);
+     return out;
+ }
+
+ static forest_type read( const void* data, std::size_t size){
+     if( !little_endian()){ throw std::runtime_error( "deserialize_compressed: big endian hosts are not supported"); }
+     reader in{ static_cast< const char*>( data), static_cast< const char*>( data) + size };
+     char magic[ sizeof( compressed_magic)];
+     in.bytes( magic, sizeof( magic));
+     if( std::memcmp( magic, compressed_magic, sizeof( magic)) || in.get< std::uint32_t>() != compressed_format_version ||
+         in.get< std::uint32_t>() != compressed_byte_order){
+      throw std::runtime_error( "deserialize_compressed: not a compressed forest of this format version");
+     }
+     if( in.get< std::uint16_t>() != sizeof( Label_type) || in.get< std::uint16_t>() != label_kind()){
+      throw std::runtime_error( "deserialize_compressed: label type mismatch");
+     }
+     forest_type f;
+     f.n_classes_ = in.get< std::uint64_t>();
+     const std::uint64_t bin_width = in.get< std::uint64_t>();
+     if( bin_width != 1 && bin_width != 2){ throw std::runtime_error( "deserialize_compressed: corrupt bin width"); }
+     in.array( f.thresholds);
+     in.array( f.feature_offsets);
+     in.array( f.features);
+     if( bin_width == 1){ in.array( f.bins8); }
+     else { in.array( f.bins16); }
+     in.array( f.children);
+     in.array( f.leaf_labels);
+     in.array( f.roots);
+     if( in.remaining()){ throw std::runtime_error( "deserialize_compressed: trailing bytes after the forest"); }
+     check( f);
+     return f;
+ }
+
+private:
+ struct reader {
+  const char* p;
+  const char* end;
+
+  std::size_t remaining() const { return end-p; }
+  void bytes( void* to, std::size_t n){
+      if( n > remaining()){ throw std::runtime_error( "deserialize_compressed: truncated forest"); }
+      std::memcpy( to, p, n);
+      p += n;
+  }
+  template< typename T>
+  T get(){ T v; bytes( &v, sizeof( v)); return v; }
+  template< typename Array>
+  void array( Array& a){
+      const std::uint64_t n = get< std::uint64_t>();
+      if( n > remaining()/sizeof( typename Array::value_type)){
+       throw std::runtime_error( "deserialize_compressed: truncated forest");
+      }
+      a.resize( n);
+      if( n){ bytes( &a[ 0], n*sizeof( typename Array::value_type)); }
+  }
+ };
+
+ /**
+ * Tables rising to the thresholds, bin ids inside their feature's table,
+ * children before their parents (which rules out cycles) and leaf
+ * references and labels in range.
+ */
+ static void check( const forest_type& f){
+     const std::size_t n_nodes = f.features.size();
+     const auto& offsets = f.feature_offsets;
+     //A default constructed forest has no tables at all
+     if( offsets.empty() ? !f.thresholds.empty() : (offsets.front() != 0 || offsets.back() != f.thresholds.size() ||
+                                                     !std::is_sorted( offsets.begin(), offsets.end()))){
+      throw std::runtime_error( "deserialize_compressed: corrupt threshold tables");
+     }
+     if( std::max( f.bins8.size(), f.bins16.size()) != n_nodes || f.children.size() != 2*n_nodes){
+      throw std::runtime_error( "deserialize_compressed: corrupt node arrays");
+     }
+     auto check_reference = [&]( reference r, std::size_t below){
+      if( r & forest_type::leaf_bit ? (r & ~forest_type::leaf_bit) >= f.leaf_labels.size() : r >= below){
+       throw std::runtime_error( "deserialize_compressed: reference out of range");
+      }
+     };
+     for( std::size_t n = 0; n < n_nodes; ++n){
+      const std::size_t feature = f.features[ n];
+      const std::size_t bin = f.bins8.size() ? f.bins8[ n] : f.bins16[ n];
+      if( feature+1 >= offsets.size() || bin >= offsets[ feature+1] - offsets[ feature]){
+       throw std::runtime_error( "deserialize_compressed: threshold out of range");
+      }
+      check_reference( f.children[ 2*n], n);
+      check_reference( f.children[ 2*n+1], n);
+     }
+     for( auto r: f.roots){ check_reference( r, n_nodes); }
+     for( auto l: f.leaf_labels){
+      const double label = l;
+      if( !(label >= 0 && label < f.n_classes_)){
+       throw std::runtime_error( "deserialize_compressed: leaf label out of range");
+      }
+     }
+ }
+
+ static std::uint16_t label_kind(){
+     return std::is_floating_point< Label_type>::value ? 2 : (std::is_signed< Label_type>::value ? 0 : 1);
+ }
+
+ template< typename T>
+ static void put( std::string& out, T v){ out.append( reinterpret_cast< const char*>( &v), sizeof( v)); }
+
+ template< typename Array>
+ static void put_array( std::string& out, const Array& a){
+     put( out, (std::uint64_t)a.size());
+     out.append( reinterpret_cast< const char*>( a.data()), a.size()*sizeof( typename Array::value_type));
+ }
+
+ static bool little_endian(){
+     const std::uint32_t x = compressed_byte_order;
+     unsigned char first;
+     std::memcpy( &first, &x, 1);
+     return first == 0x04;
+ }
+}; //end class compressed_serializer
+
+} //end namespace detail
+
+/**
+ * Compresses a trained forest, see the top of this file.
+ * Throws std::length_error if a feature index needs more than 16 bits
+ * or a feature has more than 65536 distinct thresholds, and
+ * std::out_of_range if a leaf label is not below forest.n_classes().
+ */
+template< typename Label_type>
+compressed_forest< Label_type> compress( const random_forest_classifier< Label_type>& forest){
+ return detail::forest_compressor< Label_type>( forest)();
+}
+
+/**
+ * The compressed forest as a byte string, see the top of this file.
+ */
+template< typename Label_type>
+std::string serialize_compressed( const compressed_forest< Label_type>& forest){
+ return detail::compressed_serializer< Label_type>::write( forest);
+}
+
+/**
+ * The compressed forest serialized in the size bytes at data. Throws
+ * std::runtime_error if they are not a complete, valid compressed forest.
+ */
+template< typename Label_type>
+compressed_forest< Label_type> deserialize_compressed( const void* data, std::size_t size){
+ return detail::compressed_serializer< Label_type>::read( data, size);
+}
+
+template< typename Label_type>
+void save_compressed( const compressed_forest< Label_type>& forest, const std::string& path){
+ std::ofstream out( path, std::ios::binary | std::ios::trunc);
+ if( !out){ throw std::system_error( errno, std::generic_category(), "save_compressed: " + path); }
+ const std::string bytes = serialize_compressed( forest);
+ out.write( bytes.data(), bytes.size());
+ if( !out){ throw std::runtime_error( "save_compressed: write failed"); }
+}
+
+template< typename Label_type>
+compressed_forest< Label_type> load_compressed( const std::string& path){
+ std::ifstream in( path, std::ios::binary);
+ if( !in){ throw std::system_error( errno, std::generic_category(), "load_compressed: " + path); }
+ const std::string bytes( (std::istreambuf_iterator< char>( in)), std::istreambuf_iterator< char>());
+ return deserialize_compressed< Label_type>( bytes.data(), bytes.size());
+}
+
+} //end namespace ml
+} //end namespace ayasdi
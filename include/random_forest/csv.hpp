@@ -0,0 +1,469 @@
+#pragma once
+/**
+ * Parallel CSV loading straight into a columnar_dataset.
+ *
+ * The file is memory mapped and cut into chunks of about chunk_bytes at
+ * newline boundaries. A first parallel pass counts the rows of every chunk,
+ * which gives each chunk its first row; a second parses every chunk into
+ * the column major buffers at those rows, so no chunk waits for another.
+ *
+ * Fields may be quoted, with "" for a quote inside quotes, but may not hold
+ * newlines. A field which reads as a decimal number is a number, quoted or
+ * not; numbers with at most 15 significant digits and a small exponent take
+ * an exact fast path, others go through strtod_l in the "C" locale, so the
+ * decimal point is '.' whatever LC_NUMERIC is. An empty field, or one of
+ * csv_options::missing_values, is missing (NaN).
+ *
+ * A column holding any other field is categorical: its fields are
+ * dictionary encoded as codes 0, 1, ... in order of first appearance in the
+ * file, and csv_table::dictionaries holds the strings. Chunks build their
+ * own dictionaries, which are merged and the codes remapped afterwards.
+ * Only chunks which read numbers in a column that turns out categorical
+ * are parsed again.
+ *
+ * Every column is finally narrowed to the smallest exact dtype, so small
+ * integers and category codes take a byte per row.
+ */
+
+//Project
+#include <random_forest/columnar_dataset.hpp>
+#include <random_forest/parallel.hpp>
+
+//STL
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring> //memchr
+#include <cmath>
+#include <cerrno>
+#include <limits>
+#include <utility>
+#include <stdexcept>
+#include <system_error>
+
+//POSIX
+#include <locale.h> //newlocale
+#include <stdlib.h> //strtod_l
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ayasdi{
+namespace ml {
+
+/**
+ * A whole file mapped read only. Move only.
+ */
+class mapped_file {
+public:
+ explicit mapped_file( const std::string& path, int advice=MADV_NORMAL){
+     const int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC);
+     if( fd < 0){ throw std::system_error( errno, std::generic_category(), "mapped_file: " + path); }
+     struct stat st;
+     if( ::fstat( fd, &st) < 0){
+      const int e = errno;
+      ::close( fd);
+      throw std::system_error( e, std::generic_category(), "mapped_file: fstat");
+     }
+     size_ = st.st_size;
+     //An empty file maps to nothing
+     void* data = size_ ? ::mmap( nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+     const int e = errno;
+     ::close( fd);
+     if( data == MAP_FAILED){ throw std::system_error( e, std::generic_category(), "mapped_file: mmap"); }
+     data_ = data;
+     if( data_){ ::madvise( data_, size_, advice); }
+ }
+ mapped_file( mapped_file&& m): data_( m.data_), size_( m.size_) { m.data_ = nullptr; }
+ mapped_file& operator=( mapped_file&& m){
+     std::swap( data_, m.data_);
+     std::swap( size_, m.size_);
+     return *this;
+ }
+ mapped_file( const mapped_file&) = delete;
+ mapped_file& operator=( const mapped_file&) = delete;
+ ~mapped_file(){ if( data_){ ::munmap( data_, size_); } }
+
+ const char* data() const { return static_cast< const char*>( data_); }
+ std::size_t size() const { return size_; }
+
+private:
+ void* data_=nullptr;
+ std::size_t size_=0;
+}; //end class mapped_file
+
+struct csv_options {
+ char delimiter = ',';
+ //The first line names the columns
+ bool header = true;
+ //Fields read as missing values besides the empty field
+ std::vector< std::string> missing_values = { "NA", "NaN", "nan", "NULL", "null" };
+ std::size_t chunk_bytes = std::size_t( 1) << 22;
+ //0 for hardware_threads()
+ std::size_t n_threads = 0;
+};
+
+/**
+ * A parsed CSV file. Column j is named names[ j]; if it is categorical,
+ * dictionaries[ j] holds the string of every code, otherwise it is empty.
+ */
+struct csv_table {
+ std::vector< std::string> names;
+ columnar_dataset dataset;
+ std::vector< std::vector< std::string> > dictionaries;
+
+ std::size_t index( const std::string& name) const {
+     auto i = std::find( names.begin(), names.end(), name);
+     if( i == names.end()){ throw std::invalid_argument( "csv_table: no column " + name); }
+     return i - names.begin();
+ }
+
+ //Every column but the named one, sharing their storage
+ columnar_dataset features( const std::string& label) const {
+     const std::size_t skip = index( label);
+     columnar_dataset features;
+     for( std::size_t j = 0; j < dataset.width(); ++j){
+      if( j != skip){ features.add_column( dataset.column( j)); }
+     }
+     return features;
+ }
+
+ //The named column as class indices, for a categorical or non-negative integer column
+ std::vector< std::size_t> labels( const std::string& name) const {
+     const ml::column& c = dataset.column( index( name));
+     std::vector< std::size_t> labels( c.size());
+     for( std::size_t i = 0; i < labels.size(); ++i){
+      const double v = c[ i];
+      if( !(v >= 0 && v == std::floor( v))){ throw std::invalid_argument( "csv_table: " + name + " is not a label column"); }
+      labels[ i] = v;
+     }
+     return labels;
+ }
+};
+
+namespace detail {
+
+//strtod in the "C" locale, whatever the process set LC_NUMERIC to
+inline double strtod_c( const char* s){
+ static const locale_t c_locale = ::newlocale( LC_ALL_MASK, "C", (locale_t)0);
+ return ::strtod_l( s, nullptr, c_locale);
+}
+
+/**
+ * Parses [p, end) as a decimal number, false if it is anything else.
+ * Up to 15 significant digits times a power of ten up to 22 are both
+ * exact doubles, so their product or quotient is correctly rounded;
+ * other numbers fall back to strtod_c().
+ */
+inline bool parse_double( const char* p, const char* end, double& out){
+ static const double powers[ 23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+ while( p != end && (*p == ' ' || *p == '\t')){ ++p; }
+ while( p != end && (end[ -1] == ' ' || end[ -1] == '\t')){ --end; }
+ const char* start = p;
+ const bool negative = p != end && *p == '-';
+ if( p != end && (*p == '-' || *p == '+')){ ++p; }
+ std::uint64_t mantissa = 0;
+ int digits = 0, exponent = 0;
+ bool any = false;
+ for( ; p != end && *p >= '0' && *p <= '9'; ++p, any = true){
+  if( digits < 19){ mantissa = 10*mantissa + (*p-'0'); digits += (mantissa != 0); }
+  else { ++exponent; ++digits; }
+ }
+ if( p != end && *p == '.'){
+  for( ++p; p != end && *p >= '0' && *p <= '9'; ++p, any = true){
+   if( digits < 19){ mantissa = 10*mantissa + (*p-'0'); digits += (mantissa != 0); --exponent; }
+   else { ++digits; }
+  }
+ }
+ if( !any){ return false; }
+ if( p != end && (*p == 'e' || *p == 'E')){
+  ++p;
+  const bool negative_exponent = p != end && *p == '-';
+  if( p != end && (*p == '-' || *p == '+')){ ++p; }
+  if( p == end){ return false; }
+  int e = 0;
+  for( ; p != end && *p >= '0' && *p <= '9'; ++p){ e = std::min( 10*e + (*p-'0'), 100000); }
+  exponent += negative_exponent ? -e : e;
+ }
+ if( p != end){ return false; }
+ if( digits <= 15 && exponent >= -22 && exponent <= 22){
+  const double m = (double)mantissa;
+  out = exponent < 0 ? m/powers[ -exponent] : m*powers[ exponent];
+  if( negative){ out = -out; }
+  return true;
+ }
+ const std::string copy( start, end);
+ out = strtod_c( copy.c_str());
+ return true;
+}
+
+struct csv_dictionary {
+ std::unordered_map< std::string, std::uint32_t> codes;
+ std::vector< std::string> strings;
+
+ std::uint32_t code( const std::string& s){
+     auto i = codes.find( s);
+     if( i != codes.end()){ return i->second; }
+     const std::uint32_t c = strings.size();
+     codes.emplace( s, c);
+     strings.push_back( s);
+     return c;
+ }
+};
+
+constexpr std::uint8_t csv_numbers = 1, csv_strings = 2;
+
+struct csv_chunk {
+ const char* begin;
+ const char* end;
+ std::size_t first_row = 0;
+ std::size_t n_rows = 0;
+ //Per column, csv_numbers and csv_strings if any field was one
+ std::vector< std::uint8_t> kinds;
+ std::vector< csv_dictionary> dictionaries;
+};
+
+/**
+ * Calls f( line_begin, line_end) for every non empty line of [p, end),
+ * without its line terminator.
+ */
+template< typename F>
+void for_each_line( const char* p, const char* end, F&& f){
+ while( p != end){
+  const char* eol = static_cast< const char*>( std::memchr( p, '\n', end-p));
+  const char* next = eol ? eol+1 : end;
+  if( !eol){ eol = end; }
+  if( eol != p && eol[ -1] == '\r'){ --eol; }
+  if( eol != p){ f( p, eol); }
+  p = next;
+ }
+}
+
+/**
+ * Splits a line into fields, calling f( j, begin, end, quoted) for each.
+ * Quoted fields are passed without their quotes; "" inside them is
+ * unescaped into scratch. Returns the number of fields.
+ */
+template< typename F>
+std::size_t for_each_field( const char* p, const char* end, char delimiter, std::string& scratch, F&& f){
+ std::size_t j = 0;
+ for( ;;){
+  const char* field_end;
+  if( p != end && *p == '"'){
+   const char* q = ++p;
+   bool escaped = false;
+   for( ;;){
+    q = static_cast< const char*>( std::memchr( q, '"', end-q));
+    if( !q){ throw std::runtime_error( "read_csv: unterminated quote"); }
+    if( q+1 != end && q[ 1] == '"'){ escaped = true; q += 2; continue; }
+    break;
+   }
+   if( q+1 != end && q[ 1] != delimiter){ throw std::runtime_error( "read_csv: text after a closing quote"); }
+   if( escaped){
+    scratch.clear();
+    for( const char* c = p; c != q; ++c){
+     scratch.push_back( *c);
+     if( *c == '"'){ ++c; }
+    }
+    f( j, scratch.data(), scratch.data() + scratch.size(), true);
+   } else { f( j, p, q, true); }
+   field_end = q+1;
+  } else {
+   field_end = static_cast< const char*>( std::memchr( p, delimiter, end-p));
+   if( !field_end){ field_end = end; }
+   f( j, p, field_end, false);
+  }
+  ++j;
+  if( field_end == end){ return j; }
+  p = field_end+1;
+ }
+}
+
+class csv_parser {
+public:
+ csv_parser( const csv_options& options, std::size_t width, std::vector< std::vector< double> >& columns):
+ options_( options), width_( width), columns_( columns) {}
+
+ /**
+ * Parses every row of the chunk into the columns. Fields of columns
+ * marked in as_string are dictionary encoded even if they read as numbers.
+ */
+ void parse( csv_chunk& chunk, const std::vector< bool>& as_string) const{
+     chunk.kinds.assign( width_, 0);
+     chunk.dictionaries.assign( width_, csv_dictionary());
+     std::string scratch, key;
+     std::size_t row = chunk.first_row;
+     for_each_line( chunk.begin, chunk.end, [&]( const char* line, const char* line_end){
+      const std::size_t n = for_each_field( line, line_end, options_.delimiter, scratch,
+                                            [&]( std::size_t j, const char* b, const char* e, bool){
+       if( j >= width_){ return; }
+       double& out = columns_[ j][ row];
+       if( !as_string[ j] && parse_double( b, e, out)){
+        chunk.kinds[ j] |= csv_numbers;
+        return;
+       }
+       key.assign( b, e);
+       if( key.empty() || missing( key)){
+        out = std::numeric_limits< double>::quiet_NaN();
+        return;
+       }
+       chunk.kinds[ j] |= csv_strings;
+       out = chunk.dictionaries[ j].code( key);
+      });
+      if( n != width_){
+       throw std::runtime_error( "read_csv: row " + std::to_string( row) + " has " + std::to_string( n) +
+                                 " fields, expected " + std::to_string( width_));
+      }
+      ++row;
+     });
+ }
+
+private:
+ bool missing( const std::string& s) const{
+     return std::find( options_.missing_values.begin(), options_.missing_values.end(), s) !=
+            options_.missing_values.end();
+ }
+
+ const csv_options& options_;
+ std::size_t width_;
+ std::vector< std::vector< double> >& columns_;
+}; //end class csv_parser
+
+//A column of values, without a copy when they need a double anyway
+inline column narrowed( std::vector< double>&& values){
+ if( narrowest_dtype( values.data(), values.size()) == dtype::float64){ return column( std::move( values)); }
+ column c = narrow_column( values.data(), values.size());
+ std::vector< double>().swap( values);
+ return c;
+}
+
+} //end namespace detail
+
+/**
+ * Parses the CSV text in [data, data+size), see the top of this file.
+ * Throws std::runtime_error for rows with the wrong number of fields or
+ * malformed quotes.
+ */
+inline csv_table read_csv( const char* data, std::size_t size, const csv_options& options=csv_options()){
+ csv_table table;
+ const char* p = data;
+ const char* end = data + size;
+ //The first non empty line fixes the number of columns
+ const char* first = p;
+ const char* first_end;
+ const char* next;
+ for( ;; first = next){
+  if( first == end){ return table; }
+  const char* eol = static_cast< const char*>( std::memchr( first, '\n', end-first));
+  next = eol ? eol+1 : end;
+  first_end = eol ? eol : end;
+  if( first_end != first && first_end[ -1] == '\r'){ --first_end; }
+  if( first_end != first){ break; }
+ }
+ std::string scratch;
+ detail::for_each_field( first, first_end, options.delimiter, scratch, [&]( std::size_t j, const char* b, const char* e, bool){
+  table.names.push_back( options.header ? std::string( b, e) : std::to_string( j));
+ });
+ p = options.header ? next : first;
+ const std::size_t width = table.names.size();
+
+ //Chunks end just after a newline
+ std::vector< detail::csv_chunk> chunks;
+ const std::size_t chunk_bytes = std::max< std::size_t>( 1, options.chunk_bytes);
+ while( p != end){
+  const char* e = p + std::min< std::size_t>( chunk_bytes, end-p);
+  if( e != end){
+   e = static_cast< const char*>( std::memchr( e, '\n', end-e));
+   e = e ? e+1 : end;
+  }
+  chunks.emplace_back();
+  chunks.back().begin = p;
+  chunks.back().end = e;
+  p = e;
+ }
+ parallel_for( chunks.size(), options.n_threads, 1, [&]( std::size_t begin, std::size_t end){
+  for( std::size_t c = begin; c < end; ++c){
+   detail::for_each_line( chunks[ c].begin, chunks[ c].end, [&]( const char*, const char*){ ++chunks[ c].n_rows; });
+  }
+ });
+ std::size_t n_rows = 0;
+ for( auto& c: chunks){
+  c.first_row = n_rows;
+  n_rows += c.n_rows;
+ }
+
+ std::vector< std::vector< double> > columns( width, std::vector< double>( n_rows));
+ const detail::csv_parser parser( options, width, columns);
+ std::vector< bool> as_string( width, false);
+ parallel_for( chunks.size(), options.n_threads, 1, [&]( std::size_t begin, std::size_t end){
+  for( std::size_t c = begin; c < end; ++c){ parser.parse( chunks[ c], as_string); }
+ });
+
+ //A column with any string is categorical; chunks which read numbers in it parse again
+ std::vector< std::uint8_t> kinds( width, 0);
+ for( auto& c: chunks){
+  for( std::size_t j = 0; j < width; ++j){ kinds[ j] |= c.kinds[ j]; }
+ }
+ std::vector< std::size_t> again;
+ for( std::size_t j = 0; j < width; ++j){ as_string[ j] = kinds[ j] & detail::csv_strings; }
+ for( std::size_t c = 0; c < chunks.size(); ++c){
+  for( std::size_t j = 0; j < width; ++j){
+   if( as_string[ j] && (chunks[ c].kinds[ j] & detail::csv_numbers)){ again.push_back( c); break; }
+  }
+ }
+ parallel_for( again.size(), options.n_threads, 1, [&]( std::size_t begin, std::size_t end){
+  for( std::size_t k = begin; k < end; ++k){ parser.parse( chunks[ again[ k]], as_string); }
+ });
+
+ //Global codes in order of first appearance, then every chunk's codes remapped to them
+ table.dictionaries.resize( width);
+ std::vector< std::vector< std::vector< double> > > remaps( chunks.size(), std::vector< std::vector< double> >( width));
+ for( std::size_t j = 0; j < width; ++j){
+  if( !as_string[ j]){ continue; }
+  detail::csv_dictionary global;
+  for( std::size_t c = 0; c < chunks.size(); ++c){
+   for( auto& s: chunks[ c].dictionaries[ j].strings){ remaps[ c][ j].push_back( global.code( s)); }
+  }
+  table.dictionaries[ j] = std::move( global.strings);
+ }
+ parallel_for( chunks.size(), options.n_threads, 1, [&]( std::size_t begin, std::size_t end){
+  for( std::size_t c = begin; c < end; ++c){
+   for( std::size_t j = 0; j < width; ++j){
+    const auto& remap = remaps[ c][ j];
+    if( remap.empty()){ continue; }
+    double* values = columns[ j].data() + chunks[ c].first_row;
+    for( std::size_t i = 0; i < chunks[ c].n_rows; ++i){
+     if( values[ i] == values[ i]){ values[ i] = remap[ (std::size_t)values[ i]]; }
+    }
+   }
+  }
+ });
+ chunks.clear();
+
+ std::vector< column> result( width);
+ parallel_for( width, options.n_threads, 1, [&]( std::size_t begin, std::size_t end){
+  for( std::size_t j = begin; j < end; ++j){ result[ j] = detail::narrowed( std::move( columns[ j])); }
+ });
+ for( auto& c: result){ table.dataset.add_column( std::move( c)); }
+ return table;
+}
+
+/**
+ * Maps the file at path and parses it with read_csv(). Throws
+ * std::system_error if it cannot be read.
+ */
+inline csv_table read_csv( const std::string& path, const csv_options& options=csv_options()){
+ const mapped_file file( path, MADV_SEQUENTIAL);
+ return read_csv( file.data(), file.size(), options);
+}
+
+} //end namespace ml
+} //end namespace ayasdi
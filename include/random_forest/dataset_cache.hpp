@@ -0,0 +1,482 @@
+#pragma once
+/**
+ * Binary column major dataset caches.
+ *
+ * Parsing a CSV file again for every experiment costs far more than the
+ * training setup it feeds. A dataset cache holds the parsed table in the
+ * layout columnar_dataset uses, so loading it is an mmap: the columns view
+ * the mapping and processes loading the same cache share its pages. Caches
+ * are written to a temporary file renamed over the target, so a mapped
+ * cache never changes under its readers and a failed write leaves no
+ * partial cache behind.
+ *
+ * Besides the values, every column stores its dtype, name, minimum and
+ * maximum, missing count, quantile bin edges and, for categorical columns,
+ * its dictionary. Optionally it also stores the order of its rows by
+ * value, which split search uses to skip sorting large nodes (sort_rows()).
+ *
+ * Layout, all little endian:
+ *
+ *   offset  size
+ *        0     8  magic "RFDATA\0\0"
+ *        8     4  format version (dataset_cache_version)
+ *       12     4  byte order tag 0x01020304
+ *       16     8  number of rows
+ *       24     8  number of columns
+ *       32     8  file size
+ *       40     8  cache_options::n_bins it was written with
+ *       48     1  1 if written with cache_options::presort, else 0
+ *       49     7  reserved, zero
+ *       56     8  cache_options::parse_hash it was written with
+ *       64        a cache_column for every column, then the sections they
+ *                 point to, each starting on a 64 byte boundary
+ *
+ * Strings are a uint64 length followed by the bytes; a dictionary is a
+ * uint64 count followed by that many strings. Loading checks every
+ * section and presorted row against the file, so a truncated or corrupt
+ * cache throws std::runtime_error.
+ */
+
+//Project
+#include <random_forest/columnar_dataset.hpp>
+#include <random_forest/csv.hpp>
+#include <random_forest/parallel.hpp>
+
+//STL
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio> //rename, remove
+#include <cstring> //memcpy, memcmp
+#include <cmath>
+#include <cerrno>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+//POSIX
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace ayasdi{
+namespace ml {
+
+constexpr std::uint32_t dataset_cache_version = 1;
+
+struct dataset_cache_header {
+ char magic[ 8];
+ std::uint32_t version;
+ std::uint32_t byte_order;
+ std::uint64_t n_rows;
+ std::uint64_t n_columns;
+ std::uint64_t file_size;
+ std::uint64_t n_bins;
+ std::uint8_t presort;
+ std::uint8_t reserved[ 7];
+ std::uint64_t parse_hash;
+};
+static_assert( sizeof( dataset_cache_header) == 64, "dataset_cache_header must be 64 bytes");
+
+/**
+ * Where a column's sections are, offsets from the start of the file; a
+ * zero offset is an absent section.
+ */
+struct cache_column {
+ std::uint8_t type;
+ std::uint8_t reserved[ 7];
+ //Over the values which are not missing, NaN if there are none
+ double min;
+ double max;
+ std::uint64_t n_missing;
+ std::uint64_t values;
+ std::uint64_t order;
+ std::uint64_t bin_edges;
+ std::uint64_t n_bin_edges;
+ std::uint64_t name;
+ std::uint64_t dictionary;
+};
+static_assert( sizeof( cache_column) == 80, "cache_column must be 80 bytes");
+
+//Largest cache_options::n_bins
+constexpr std::size_t max_cache_bins = 65535;
+
+struct cache_options {
+ //Quantile bins per column, in [1, max_cache_bins], whose n_bins+1 edges are stored with duplicates removed
+ std::size_t n_bins = 255;
+ //Store the order of the rows of every column by value
+ bool presort = false;
+ //0 for hardware_threads()
+ std::size_t n_threads = 0;
+ //csv_options_hash() of the options the table was parsed with, 0 if unknown
+ std::uint64_t parse_hash = 0;
+};
+
+/**
+ * A nonzero hash of the csv_options that change the parsed table, which
+ * are all but chunk_bytes and n_threads (64 bit FNV-1a).
+ */
+inline std::uint64_t csv_options_hash( const csv_options& csv){
+ std::uint64_t h = 0xCBF29CE484222325ull;
+ auto add = [&]( const void* data, std::size_t size){
+  for( std::size_t i = 0; i < size; ++i){
+   h ^= static_cast< const unsigned char*>( data)[ i];
+   h *= 0x100000001B3ull;
+  }
+ };
+ add( &csv.delimiter, 1);
+ const char header = csv.header;
+ add( &header, 1);
+ for( auto& s: csv.missing_values){
+  const std::uint64_t n = s.size();
+  add( &n, sizeof( n));
+  add( s.data(), s.size());
+ }
+ return h ? h : 1;
+}
+
+struct column_summary {
+ double min = std::numeric_limits< double>::quiet_NaN();
+ double max = std::numeric_limits< double>::quiet_NaN();
+ std::size_t n_missing = 0;
+ std::vector< double> bin_edges;
+};
+
+/**
+ * A loaded cache: the table, whose columns view the mapped file, and a
+ * summary of every column.
+ */
+struct dataset_cache : csv_table {
+ std::vector< column_summary> summaries;
+ //The options it was written with, n_threads aside
+ cache_options options;
+};
+
+namespace detail {
+
+constexpr char dataset_cache_magic[ 8] = { 'R', 'F', 'D', 'A', 'T', 'A', '\0', '\0' };
+constexpr std::uint32_t dataset_cache_byte_order = 0x01020304;
+
+inline bool cache_little_endian(){
+ const std::uint32_t x = dataset_cache_byte_order;
+ unsigned char first;
+ std::memcpy( &first, &x, 1);
+ return first == 0x04;
+}
+
+inline std::uint64_t cache_align( std::uint64_t offset){ return (offset + 63) & ~std::uint64_t( 63); }
+
+//Writes sections to a stream, each 64 byte aligned
+class cache_writer {
+public:
+ cache_writer( std::ostream& out, std::uint64_t offset): out_( out), offset_( offset) {}
+
+ std::uint64_t section( const void* data, std::size_t size){
+     static const char zeros[ 64] = {};
+     write( zeros, cache_align( offset_) - offset_);
+     const std::uint64_t offset = offset_;
+     write( data, size);
+     return offset;
+ }
+ std::uint64_t string( const std::string& s){
+     const std::uint64_t offset = section( nullptr, 0);
+     put( s);
+     return offset;
+ }
+ std::uint64_t strings( const std::vector< std::string>& strings){
+     const std::uint64_t offset = section( nullptr, 0);
+     const std::uint64_t n = strings.size();
+     write( &n, sizeof( n));
+     for( auto& s: strings){ put( s); }
+     return offset;
+ }
+ std::uint64_t size() const { return offset_; }
+
+private:
+ void write( const void* data, std::size_t size){
+     if( size){ out_.write( static_cast< const char*>( data), size); }
+     offset_ += size;
+ }
+ void put( const std::string& s){
+     const std::uint64_t n = s.size();
+     write( &n, sizeof( n));
+     write( s.data(), s.size());
+ }
+
+ std::ostream& out_;
+ std::uint64_t offset_;
+}; //end class cache_writer
+
+//Bounds checked reads of a mapped cache
+class cache_reader {
+public:
+ cache_reader( const char* data, std::size_t size): data_( data), size_( size) {}
+
+ const char* at( std::uint64_t offset, std::uint64_t count, std::size_t element_size) const{
+     if( offset > size_ || count > (size_-offset)/element_size){ throw std::runtime_error( "load_dataset_cache: corrupt cache"); }
+     return data_ + offset;
+ }
+ template< typename T>
+ T get( std::uint64_t& offset) const{
+     T v;
+     std::memcpy( &v, at( offset, 1, sizeof( T)), sizeof( T));
+     offset += sizeof( T);
+     return v;
+ }
+ std::string string( std::uint64_t& offset) const{
+     const std::uint64_t n = get< std::uint64_t>( offset);
+     const char* p = at( offset, n, 1);
+     offset += n;
+     return std::string( p, n);
+ }
+ std::vector< std::string> strings( std::uint64_t offset) const{
+     const std::uint64_t n = get< std::uint64_t>( offset);
+     //Every string takes at least its length
+     at( offset, n, sizeof( std::uint64_t));
+     std::vector< std::string> strings( n);
+     for( auto& s: strings){ s = string( offset); }
+     return strings;
+ }
+
+private:
+ const char* data_;
+ std::size_t size_;
+}; //end class cache_reader
+
+/**
+ * Reorders [begin, end) so that the element at each of the sorted
+ * positions [k_begin, k_end) is the one a full sort would put there, in
+ * O(n log k) instead of O(n log n).
+ */
+template< typename Iterator, typename K_iterator>
+void select( Iterator begin, Iterator end, K_iterator k_begin, K_iterator k_end, std::size_t offset=0){
+ if( k_begin == k_end || begin == end){ return; }
+ const K_iterator middle = k_begin + (k_end-k_begin)/2;
+ const Iterator nth = begin + (*middle - offset);
+ std::nth_element( begin, nth, end);
+ select( begin, nth, k_begin, middle, offset);
+ select( nth+1, end, middle+1, k_end, offset + (nth+1-begin));
+}
+
+//Summary of a column, with its rows in order of value when order is not null
+inline column_summary summarize( const column& c, std::size_t n_bins, std::vector< std::uint32_t>* order){
+ column_summary summary;
+ std::vector< double> values( c.size());
+ for( std::size_t i = 0; i < values.size(); ++i){ values[ i] = c[ i]; }
+ if( order){
+  //Sorting the pairs themselves keeps the compares in cache
+  std::vector< std::pair< double, std::uint32_t> > pairs( values.size());
+  for( std::size_t i = 0; i < pairs.size(); ++i){ pairs[ i] = std::make_pair( values[ i], (std::uint32_t)i); }
+  std::sort( pairs.begin(), pairs.end(), []( const std::pair< double, std::uint32_t>& a, const std::pair< double, std::uint32_t>& b){
+   return missing_last( a.first, b.first);
+  });
+  order->resize( pairs.size());
+  for( std::size_t k = 0; k < pairs.size(); ++k){
+   values[ k] = pairs[ k].first;
+   (*order)[ k] = pairs[ k].second;
+  }
+ }
+ const auto missing = std::partition( values.begin(), values.end(), []( double v){ return v == v; });
+ summary.n_missing = values.end() - missing;
+ values.erase( missing, values.end());
+ if( values.empty()){ return summary; }
+ //Edge k is the value at rank k*n/n_bins, the last the maximum
+ std::vector< std::size_t> ranks;
+ for( std::size_t k = 0; k <= n_bins; ++k){
+  const std::size_t rank = std::min( values.size()-1, k*values.size()/n_bins);
+  if( ranks.empty() || ranks.back() != rank){ ranks.push_back( rank); }
+ }
+ if( !order){ select( values.begin(), values.end(), ranks.begin(), ranks.end()); }
+ summary.min = values[ ranks.front()];
+ summary.max = values[ ranks.back()];
+ for( auto rank: ranks){
+  if( summary.bin_edges.empty() || summary.bin_edges.back() != values[ rank]){ summary.bin_edges.push_back( values[ rank]); }
+ }
+ return summary;
+}
+
+} //end namespace detail
+
+/**
+ * Writes table to path as a dataset cache, through a temporary file in
+ * the same directory which replaces path once complete. Throws
+ * std::invalid_argument if options.n_bins is 0 or above max_cache_bins,
+ * std::length_error for tables of 2^32 rows or more when presorting, and
+ * std::system_error if the file cannot be written.
+ */
+inline void save_dataset_cache( const csv_table& table, const std::string& path, const cache_options& options=cache_options()){
+ if( !detail::cache_little_endian()){ throw std::runtime_error( "save_dataset_cache: big endian hosts are not supported"); }
+ const columnar_dataset& dataset = table.dataset;
+ const std::size_t width = dataset.width();
+ if( options.n_bins == 0 || options.n_bins > max_cache_bins){
+  throw std::invalid_argument( "save_dataset_cache: n_bins must be in [1, " + std::to_string( max_cache_bins) + "]");
+ }
+ if( options.presort && dataset.height() > std::numeric_limits< std::uint32_t>::max()){
+  throw std::length_error( "save_dataset_cache: too many rows to presort");
+ }
+ std::vector< column_summary> summaries( width);
+ std::vector< std::vector< std::uint32_t> > orders( width);
+ parallel_for( width, options.n_threads, 1, [&]( std::size_t begin, std::size_t end){
+  for( std::size_t j = begin; j < end; ++j){
+   summaries[ j] = detail::summarize( dataset.column( j), options.n_bins, options.presort ? &orders[ j] : nullptr);
+  }
+ });
+
+ const std::string temporary = path + ".tmp." + std::to_string( ::getpid());
+ std::ofstream file( temporary, std::ios::binary | std::ios::trunc);
+ if( !file){ throw std::system_error( errno, std::generic_category(), "save_dataset_cache: " + temporary); }
+ try {
+  //The header and column table go first, once the sections are written
+  const std::uint64_t table_end = sizeof( dataset_cache_header) + width*sizeof( cache_column);
+  file.write( std::string( table_end, '\0').data(), table_end);
+  detail::cache_writer out( file, table_end);
+  std::vector< cache_column> columns( width);
+  for( std::size_t j = 0; j < width; ++j){
+   const ml::column& c = dataset.column( j);
+   cache_column& d = columns[ j];
+   std::memset( &d, 0, sizeof( d));
+   d.type = (std::uint8_t)c.type();
+   d.min = summaries[ j].min;
+   d.max = summaries[ j].max;
+   d.n_missing = summaries[ j].n_missing;
+   //Columns may be strided views, the cache is contiguous
+   d.values = visit( c, [&]( const auto& view){
+    typedef typename std::decay< decltype( view)>::type::value_type T;
+    std::vector< T> values( view.size);
+    for( std::size_t i = 0; i < view.size; ++i){ values[ i] = view[ i]; }
+    return out.section( values.data(), values.size()*sizeof( T));
+   });
+   if( options.presort){ d.order = out.section( orders[ j].data(), orders[ j].size()*sizeof( std::uint32_t)); }
+   std::vector< std::uint32_t>().swap( orders[ j]);
+   d.bin_edges = out.section( summaries[ j].bin_edges.data(), summaries[ j].bin_edges.size()*sizeof( double));
+   d.n_bin_edges = summaries[ j].bin_edges.size();
+   d.name = out.string( j < table.names.size() ? table.names[ j] : std::to_string( j));
+   if( j < table.dictionaries.size() && !table.dictionaries[ j].empty()){ d.dictionary = out.strings( table.dictionaries[ j]); }
+  }
+  dataset_cache_header h;
+  std::memset( &h, 0, sizeof( h));
+  std::memcpy( h.magic, detail::dataset_cache_magic, sizeof( h.magic));
+  h.version = dataset_cache_version;
+  h.byte_order = detail::dataset_cache_byte_order;
+  h.n_rows = dataset.height();
+  h.n_columns = width;
+  h.file_size = out.size();
+  h.n_bins = options.n_bins;
+  h.presort = options.presort;
+  h.parse_hash = options.parse_hash;
+  file.seekp( 0);
+  file.write( reinterpret_cast< const char*>( &h), sizeof( h));
+  if( width){ file.write( reinterpret_cast< const char*>( columns.data()), width*sizeof( cache_column)); }
+  file.close();
+  if( !file){ throw std::runtime_error( "save_dataset_cache: write failed"); }
+  if( std::rename( temporary.c_str(), path.c_str()) < 0){
+   throw std::system_error( errno, std::generic_category(), "save_dataset_cache: " + path);
+  }
+ } catch( ...){
+  file.close();
+  std::remove( temporary.c_str());
+  throw;
+ }
+}
+
+/**
+ * Maps the dataset cache at path. Its columns view the mapping, which
+ * stays until the last of them is gone. Throws std::system_error if the
+ * file cannot be read, std::runtime_error if it is not a valid cache.
+ */
+inline dataset_cache load_dataset_cache( const std::string& path){
+ if( !detail::cache_little_endian()){ throw std::runtime_error( "load_dataset_cache: big endian hosts are not supported"); }
+ auto file = std::make_shared< mapped_file>( path);
+ const detail::cache_reader in( file->data(), file->size());
+ dataset_cache_header h;
+ std::memcpy( &h, in.at( 0, 1, sizeof( h)), sizeof( h));
+ if( std::memcmp( h.magic, detail::dataset_cache_magic, sizeof( h.magic)) || h.version != dataset_cache_version ||
+     h.byte_order != detail::dataset_cache_byte_order){
+  throw std::runtime_error( "load_dataset_cache: not a dataset cache of this format version");
+ }
+ if( h.file_size != file->size()){ throw std::runtime_error( "load_dataset_cache: truncated cache"); }
+ const char* descriptors = in.at( sizeof( h), h.n_columns, sizeof( cache_column));
+ dataset_cache cache;
+ cache.options.n_bins = h.n_bins;
+ cache.options.presort = h.presort;
+ cache.options.parse_hash = h.parse_hash;
+ std::vector< cache_column> columns( h.n_columns);
+ for( std::uint64_t j = 0; j < h.n_columns; ++j){
+  cache_column& d = columns[ j];
+  std::memcpy( &d, descriptors + j*sizeof( d), sizeof( d));
+  //Sections are 64 byte aligned, so the values and orders are aligned for their type
+  if( d.type > (std::uint8_t)dtype::float64 || d.values % 64 || d.order % 64){
+   throw std::runtime_error( "load_dataset_cache: corrupt cache");
+  }
+  in.at( d.values, h.n_rows, size_of( (dtype)d.type));
+  if( d.order){ in.at( d.order, h.n_rows, sizeof( std::uint32_t)); }
+  column_summary summary;
+  summary.min = d.min;
+  summary.max = d.max;
+  summary.n_missing = d.n_missing;
+  const char* edges = in.at( d.bin_edges, d.n_bin_edges, sizeof( double));
+  summary.bin_edges.resize( d.n_bin_edges);
+  if( d.n_bin_edges){ std::memcpy( &summary.bin_edges[ 0], edges, d.n_bin_edges*sizeof( double)); }
+  cache.summaries.push_back( std::move( summary));
+  std::uint64_t name = d.name;
+  cache.names.push_back( in.string( name));
+  cache.dictionaries.push_back( d.dictionary ? in.strings( d.dictionary) : std::vector< std::string>());
+ }
+ //A presorted order must hold every row once, or sort_rows() would index out of bounds
+ parallel_for( columns.size(), 0, 1, [&]( std::size_t begin, std::size_t end){
+  std::vector< std::uint8_t> seen;
+  for( std::size_t j = begin; j < end; ++j){
+   if( !columns[ j].order){ continue; }
+   const auto order = reinterpret_cast< const std::uint32_t*>( file->data() + columns[ j].order);
+   seen.assign( h.n_rows, 0);
+   for( std::uint64_t k = 0; k < h.n_rows; ++k){
+    if( order[ k] >= h.n_rows || seen[ order[ k]]){ throw std::runtime_error( "load_dataset_cache: corrupt row order"); }
+    seen[ order[ k]] = 1;
+   }
+  }
+ });
+ for( auto& d: columns){
+  const char* values = file->data() + d.values;
+  column c;
+  switch( (dtype)d.type){
+   case dtype::uint8:   c = column( reinterpret_cast< const std::uint8_t*>( values), h.n_rows, 1, file); break;
+   case dtype::uint16:  c = column( reinterpret_cast< const std::uint16_t*>( values), h.n_rows, 1, file); break;
+   case dtype::float32: c = column( reinterpret_cast< const float*>( values), h.n_rows, 1, file); break;
+   default:             c = column( reinterpret_cast< const double*>( values), h.n_rows, 1, file); break;
+  }
+  if( d.order){ c.order( reinterpret_cast< const std::uint32_t*>( file->data() + d.order), file); }
+  cache.dataset.add_column( std::move( c));
+ }
+ return cache;
+}
+
+/**
+ * The table of the CSV file at csv_path through the cache at cache_path:
+ * parses the CSV and writes the cache only when the cache is missing,
+ * older than the CSV or written with other options, csv ones included
+ * (csv_options_hash()), then maps the cache.
+ */
+inline dataset_cache cached_csv( const std::string& csv_path, const std::string& cache_path,
+                                 const csv_options& csv=csv_options(), const cache_options& options=cache_options()){
+ struct stat source, cached;
+ if( ::stat( csv_path.c_str(), &source) < 0){ throw std::system_error( errno, std::generic_category(), "cached_csv: " + csv_path); }
+ const bool newer = ::stat( cache_path.c_str(), &cached) == 0 &&
+                    (cached.st_mtim.tv_sec > source.st_mtim.tv_sec ||
+                     (cached.st_mtim.tv_sec == source.st_mtim.tv_sec && cached.st_mtim.tv_nsec > source.st_mtim.tv_nsec));
+ cache_options written( options);
+ written.parse_hash = csv_options_hash( csv);
+ if( newer){
+  dataset_cache cache = load_dataset_cache( cache_path);
+  if( cache.options.n_bins == written.n_bins && cache.options.presort == written.presort &&
+      cache.options.parse_hash == written.parse_hash){ return cache; }
+ }
+ save_dataset_cache( read_csv( csv_path, csv), cache_path, written);
+ return load_dataset_cache( cache_path);
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -2,6 +2,9 @@
 #include <tuple>
 #include <vector>
 #include <iostream>
+#include <stdexcept>
+//Project
+#include <random_forest/matrix.hpp> //aligned_vector
 
 namespace ayasdi{
 namespace ml {
@@ -9,10 +12,11 @@ namespace ml {
 //Forward declarations
 template< typename Label_type>
 class decision_tree; //necessary only for friend declaration below
+namespace detail { class forest_serializer; }
 
 class dtree_node{
 public:
- dtree_node( std::size_t split, double split_value, int left_child_index=0, int right_child_index=0):
+ dtree_node( std::size_t split=0, double split_value=0, int left_child_index=0, int right_child_index=0):
  split_( split), split_value_( split_value), left_child_index_( left_child_index), right_child_index_( right_child_index) {}
  
  bool operator!=( const dtree_node& b) const{ return !(this->operator==( b)); }
@@ -37,9 +41,11 @@ public:
  std::size_t split_=0; 
  double split_value_=0;
 private:
+ int left_child_index_=0;
  int right_child_index_=0;   
  template< typename Label_type>
- friend decision_tree< Label_type>;
+ friend class decision_tree;
+ friend class detail::forest_serializer;
 }; //end struct dtree_node
 
 template< typename Label_type>
@@ -53,11 +59,15 @@ public:
  //Access a node
  node& operator[]( std::size_t i){ return tree_nodes[ i]; }
 
+ const node& operator[]( std::size_t i) const { return tree_nodes[ i]; }
+
  //Size of the tree
- std::size_t size() { return tree_nodes.size(); }
+ std::size_t size() const { return tree_nodes.size(); }
 
  //Equality operator
- bool operator==( const decision_tree& f) const { return f.tree_nodes == tree_nodes; }
+ bool operator==( const decision_tree& f) const {
+     return f.tree_nodes == tree_nodes && f.distributions == distributions && f.covers == covers;
+ }
  //Inequality operator
  bool operator!=( const decision_tree& f) const { return !(f == *this); }
 
@@ -85,33 +95,40 @@ public:
 
 /** 
  * inserts the left and right node into the tree
+ * Inserting may reallocate the node storage, so the parent is
+ * re-fetched by index before the second insertion.
  */
  std::tuple<node&,node&>
  insert_children( node& parent){
-     auto& left_child = insert_left_child( parent);
-     auto& right_child = insert_right_child( parent);		
-     return std::forward_as_tuple(left_child, right_child);
+     const std::size_t parent_index = index_of( parent);
+     insert_left_child( parent);
+     insert_right_child( tree_nodes[ parent_index]);
+     const auto& p = tree_nodes[ parent_index];
+     return std::forward_as_tuple( tree_nodes[ p.left_child_index_], 
+                                   tree_nodes[ p.right_child_index_]);
  }
+
+ //Position of a node in the tree storage
+ std::size_t index_of( const node& n) const { return &n - tree_nodes.data(); }
  
  //Set data of leaf node to be a leaf node.
  //TODO: This needs to be carefully handled.
- void generate_leaf_node( Label_type label){
-  split_value_ = label;
+ void generate_leaf_node( node& n, Label_type label){
+  n.split_value_ = label;
  }
  
  //Set data of node to be an internal decision node of tree
- void set_split( std::size_t& column_index, double& split_threshold_value){
+ void set_split( node& n, std::size_t column_index, double split_threshold_value){
   n.split_ = column_index;
   n.split_value_ = split_threshold_value;
  }
  
  /**
  * Input: a datapoint which provides a double operator[]()
- * This function walks the decision tree and returns the 
- * class_label() supported by this tree. 
+ * Walks the decision tree and returns the leaf p lands in.
  */
  template< typename Datapoint>
- inline Label_type vote( Datapoint& p) const{
+ inline const node& leaf( const Datapoint& p) const{
     const node* current_node = &root();
     while( current_node->is_not_leaf()){
         if( p[ current_node->split_] < current_node->split_value_){
@@ -120,8 +137,55 @@ public:
             current_node = &tree_nodes[ current_node->right_child_index()];
         }
     }
-    return current_node->class_label();
+    return *current_node;
+ }
+
+ /**
+ * Input: a datapoint which provides a double operator[]()
+ * This function walks the decision tree and returns the 
+ * class_label() supported by this tree. 
+ */
+ template< typename Datapoint>
+ inline Label_type vote( const Datapoint& p) const{
+    return leaf( p).template class_label< Label_type>();
+ }
+
+ /**
+ * Stores the training class distribution of leaf n, counts[ 0..n_classes)
+ * normalized to sum to one. The distributions of all leaves live in one
+ * contiguous array, n_classes floats per leaf, and the leaf's split_
+ * (unused by leaves otherwise) holds the position of its distribution.
+ */
+ template< typename Count>
+ void set_leaf_distribution( node& n, const Count* counts, std::size_t n_classes){
+     if( distributions.empty()){ n_distribution_classes = n_classes; }
+     if( n_classes != n_distribution_classes){
+      throw std::invalid_argument( "decision_tree: leaf distributions must all have the same number of classes");
+     }
+     double total = 0;
+     for( std::size_t c = 0; c < n_classes; ++c){ total += counts[ c]; }
+     n.split_ = distributions.size()/n_classes;
+     for( std::size_t c = 0; c < n_classes; ++c){
+      distributions.push_back( total > 0 ? counts[ c]/total : 0.0);
+     }
+ }
+
+ //True if every leaf carries a class distribution
+ bool has_distributions() const { return !distributions.empty(); }
+
+ //Class distribution of leaf n, n_distribution_classes floats
+ const float* leaf_distribution( const node& n) const { return distributions.data() + n.split_*n_distribution_classes; }
+
+  /**
+ * Cover of a node: the (weighted) number of training rows reaching it,
+ * as recorded by the trainers. Kept beside the nodes, not in them.
+ */
+ void set_cover( std::size_t i, double cover){
+     if( covers.size() < tree_nodes.size()){ covers.resize( tree_nodes.size(), 0.0); }
+     covers[ i] = cover;
  }
+ bool has_covers() const { return !covers.empty(); }
+ double cover( std::size_t i) const { return i < covers.size() ? covers[ i] : 0.0; }
 
  /**
  * Returns the root of the tree.
@@ -154,13 +218,50 @@ public:
  * Reserve space for the tree.
  */
  void reserve( int size){ tree_nodes.reserve( size); }
+
+ /**
+ * Rearranges the nodes in memory, the tree itself is unchanged.
+ * order[ k] is the current index of the node to place at index k,
+ * order must be a permutation with order[ 0] == 0 (the root stays first).
+ */
+ void permute( const std::vector< std::size_t>& order){
+     if( order.size() != tree_nodes.size() || (order.size() && order[ 0] != 0)){
+      throw std::invalid_argument( "decision_tree::permute: not a permutation fixing the root");
+     }
+     std::vector< std::size_t> new_index( order.size());
+     for( std::size_t k = 0; k < order.size(); ++k){ new_index[ order[ k]] = k; }
+     Storage permuted;
+     permuted.reserve( tree_nodes.capacity());
+     for( auto old_index: order){
+      node n = tree_nodes[ old_index];
+      if( n.is_not_leaf()){
+       n.left_child_index_ = new_index[ n.left_child_index_];
+       n.right_child_index_ = new_index[ n.right_child_index_];
+      }
+      permuted.push_back( n);
+     }
+     tree_nodes.swap( permuted);
+     if( !covers.empty()){
+      std::vector< double> permuted_covers( covers.size());
+      for( std::size_t k = 0; k < order.size(); ++k){ permuted_covers[ k] = covers[ order[ k]]; }
+      covers.swap( permuted_covers);
+     }
+ }
  
 private:
+ friend class detail::forest_serializer;
+
  node& insert(){
     tree_nodes.emplace_back(); 
     return tree_nodes.back();
  }
- std::vector<node> tree_nodes; 
+ //Cache line aligned, so that a block of nodes at the front of the
+ //tree starts on a line boundary.
+ typedef aligned_vector< node> Storage;
+ Storage tree_nodes; 
+ aligned_vector< float> distributions;
+ std::vector< double> covers;
+ std::size_t n_distribution_classes=0;
 }; //end class decision_tree
 
 } //ml namespace
@@ -0,0 +1,446 @@
+#pragma once
+/**
+ * Data parallel training of a random_forest_classifier across processes.
+ *
+ * Every worker owns a horizontal shard of the rows. Training proceeds one
+ * tree level at a time: for each open node a worker builds a histogram of
+ * (feature, bin, class) counts over its own rows and sends it to the
+ * coordinator. The coordinator sums the histograms, picks the split for
+ * every open node and broadcasts the decisions back. Workers then move their
+ * rows to the chosen children. Rows never leave the worker that owns them.
+ *
+ * Features are discretized into at most n_bins bins whose cut points are
+ * computed by the coordinator from the global per feature min/max, so the
+ * thresholds stored in the tree are exactly the cut points and
+ * decision_tree::vote() reproduces the training partition.
+ *
+ * Bootstrap weights are drawn per (tree, global row id), so the trained
+ * forest does not depend on how the rows are sharded.
+ *
+ * Transport is a stream socket, typically a Unix domain socket.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+
+//STL
+#include <vector>
+#include <algorithm>
+#include <numeric> //iota, accumulate
+#include <cmath>
+#include <string>
+#include <cstring> //memcpy
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <system_error>
+#include <stdexcept>
+
+//POSIX
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace ayasdi{
+namespace ml {
+namespace distributed {
+
+struct distributed_params {
+ rf_train_params forest;
+ //Number of histogram bins per feature, at most 256.
+ std::size_t n_bins=64;
+};
+
+/**
+ * A connected stream socket carrying tagged, length prefixed messages.
+ * Owns the file descriptor.
+ */
+class socket_channel {
+public:
+ enum tag : std::uint32_t { summary=1, bin_edges, begin_tree, histogram, decisions, shutdown };
+
+ explicit socket_channel( int fd=-1): fd_( fd) {}
+ socket_channel( const socket_channel&) = delete;
+ socket_channel& operator=( const socket_channel&) = delete;
+ socket_channel( socket_channel&& c): fd_( c.fd_) { c.fd_ = -1; }
+ socket_channel& operator=( socket_channel&& c){
+     if( this != &c){ close(); fd_ = c.fd_; c.fd_ = -1; }
+     return *this;
+ }
+ ~socket_channel(){ close(); }
+
+ int fd() const { return fd_; }
+
+ void close(){
+     if( fd_ >= 0){ ::close( fd_); }
+     fd_ = -1;
+ }
+
+ template< typename T>
+ void send( tag t, const std::vector< T>& payload){
+     static_assert( std::is_trivially_copyable< T>::value, "payload must be trivially copyable");
+     const std::uint64_t header[ 2] = { t, payload.size()*sizeof( T) };
+     write_all( header, sizeof( header));
+     write_all( payload.data(), header[ 1]);
+ }
+
+ /**
+ * Receives the next message into payload, returns its tag.
+ * Throws if the message size is not a multiple of sizeof( T).
+ */
+ template< typename T>
+ tag receive( std::vector< T>& payload){
+     std::uint64_t header[ 2];
+     read_all( header, sizeof( header));
+     if( header[ 1] % sizeof( T)){ throw std::runtime_error( "socket_channel: malformed message"); }
+     payload.resize( header[ 1]/sizeof( T));
+     read_all( payload.data(), header[ 1]);
+     return static_cast< tag>( header[ 0]);
+ }
+
+ template< typename T>
+ void expect( tag t, std::vector< T>& payload){
+     if( receive( payload) != t){ throw std::runtime_error( "socket_channel: unexpected message"); }
+ }
+
+private:
+ void write_all( const void* buffer, std::size_t n){
+     auto p = static_cast< const char*>( buffer);
+     while( n){
+         auto w = ::send( fd_, p, n, MSG_NOSIGNAL);
+         if( w < 0){
+             if( errno == EINTR){ continue; }
+             throw std::system_error( errno, std::generic_category(), "socket_channel::send");
+         }
+         p += w; n -= w;
+     }
+ }
+ void read_all( void* buffer, std::size_t n){
+     auto p = static_cast< char*>( buffer);
+     while( n){
+         auto r = ::recv( fd_, p, n, 0);
+         if( r < 0){
+             if( errno == EINTR){ continue; }
+             throw std::system_error( errno, std::generic_category(), "socket_channel::receive");
+         }
+         if( r == 0){ throw std::runtime_error( "socket_channel: connection closed"); }
+         p += r; n -= r;
+     }
+ }
+ int fd_;
+}; //end class socket_channel
+
+/**
+ * Unix domain socket helpers.
+ */
+inline sockaddr_un unix_address( const std::string& path){
+ sockaddr_un address;
+ std::memset( &address, 0, sizeof( address));
+ address.sun_family = AF_UNIX;
+ if( path.size() >= sizeof( address.sun_path)){ throw std::invalid_argument( "unix socket path too long"); }
+ std::memcpy( address.sun_path, path.c_str(), path.size());
+ return address;
+}
+
+inline socket_channel listen_unix( const std::string& path, int backlog=64){
+ socket_channel s( ::socket( AF_UNIX, SOCK_STREAM, 0));
+ if( s.fd() < 0){ throw std::system_error( errno, std::generic_category(), "socket"); }
+ auto address = unix_address( path);
+ ::unlink( path.c_str());
+ if( ::bind( s.fd(), (sockaddr*)&address, sizeof( address)) < 0 || ::listen( s.fd(), backlog) < 0){
+     throw std::system_error( errno, std::generic_category(), "listen_unix");
+ }
+ return s;
+}
+
+inline socket_channel accept_unix( socket_channel& listener){
+ int fd;
+ do { fd = ::accept( listener.fd(), nullptr, nullptr); } while( fd < 0 && errno == EINTR);
+ if( fd < 0){ throw std::system_error( errno, std::generic_category(), "accept_unix"); }
+ return socket_channel( fd);
+}
+
+inline socket_channel connect_unix( const std::string& path){
+ socket_channel s( ::socket( AF_UNIX, SOCK_STREAM, 0));
+ if( s.fd() < 0){ throw std::system_error( errno, std::generic_category(), "socket"); }
+ auto address = unix_address( path);
+ if( ::connect( s.fd(), (sockaddr*)&address, sizeof( address)) < 0){
+     throw std::system_error( errno, std::generic_category(), "connect_unix");
+ }
+ return s;
+}
+
+/**
+ * A connected pair of channels, for running workers in threads or
+ * forked children on one host.
+ */
+inline std::pair< socket_channel, socket_channel> channel_pair(){
+ int fds[ 2];
+ if( ::socketpair( AF_UNIX, SOCK_STREAM, 0, fds) < 0){
+     throw std::system_error( errno, std::generic_category(), "socketpair");
+ }
+ return std::make_pair( socket_channel( fds[ 0]), socket_channel( fds[ 1]));
+}
+
+namespace detail {
+
+//Bootstrap weight of a row, Poisson(1) distributed, a pure function of
+//(seed, tree, row) so that sharding does not change the forest.
+inline std::uint32_t bootstrap_weight( std::uint64_t seed, std::uint64_t tree, std::uint64_t row){
+ std::uint64_t z = seed + 0x9E3779B97F4A7C15ULL*(tree*0x100000001B3ULL + row + 1);
+ z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+ z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+ z ^= (z >> 31);
+ double u = (z >> 11)*(1.0/9007199254740992.0);
+ //Inverse CDF of Poisson(1)
+ double p = std::exp( -1.0);
+ double cdf = p;
+ std::uint32_t k = 0;
+ while( u > cdf && k < 16){ ++k; p /= k; cdf += p; }
+ return k;
+}
+
+inline double impurity( const std::uint64_t* counts, std::size_t n_classes, double n, bool gini){
+ if( n <= 0){ return 0.0; }
+ double result = gini ? 1.0 : 0.0;
+ for( std::size_t c = 0; c < n_classes; ++c){
+  const double p = counts[ c]/n;
+  if( gini){ result -= p*p; }
+  else if( p > 0){ result -= p*std::log( p); }
+ }
+ return result;
+}
+
+} //end namespace detail
+
+/**
+ * Runs a worker over its shard until the coordinator shuts it down.
+ * shard( i, j) is row i feature j, labels[ i] is a class index in [0, n_classes).
+ * first_row is the global id of the first row of this shard.
+ */
+template< typename Dataset, typename Labels>
+void run_worker( socket_channel& coordinator, const Dataset& shard, const Labels& labels,
+                 std::uint64_t first_row=0){
+ const std::size_t n_rows = shard.height();
+ const std::size_t n_features = shard.width();
+
+ //Summary: n_rows, n_features, n_classes, min[ n_features], max[ n_features]
+ std::vector< double> summary( 3+2*n_features);
+ std::size_t n_classes = 0;
+ for( std::size_t i = 0; i < n_rows; ++i){ n_classes = std::max< std::size_t>( n_classes, labels[ i]+1); }
+ summary[ 0] = n_rows; summary[ 1] = n_features; summary[ 2] = n_classes;
+ for( std::size_t j = 0; j < n_features; ++j){
+  double lo = std::numeric_limits< double>::infinity(), hi = -lo;
+  for( std::size_t i = 0; i < n_rows; ++i){
+   lo = std::min< double>( lo, shard( i, j));
+   hi = std::max< double>( hi, shard( i, j));
+  }
+  summary[ 3+j] = lo; summary[ 3+n_features+j] = hi;
+ }
+ coordinator.send( socket_channel::summary, summary);
+
+ //Bin edges: [ n_classes, n_bins, cut points of feature 0, ..., cut points of feature n-1]
+ //each feature has n_bins-1 cut points.
+ std::vector< double> edges;
+ coordinator.expect( socket_channel::bin_edges, edges);
+ n_classes = edges[ 0];
+ const std::size_t n_bins = edges[ 1];
+ const std::size_t n_cuts = n_bins-1;
+
+ //Discretize the shard once, column major.
+ std::vector< std::uint8_t> codes( n_rows*n_features);
+ for( std::size_t j = 0; j < n_features; ++j){
+  auto cut_begin = edges.begin()+2+j*n_cuts;
+  for( std::size_t i = 0; i < n_rows; ++i){
+   codes[ j*n_rows+i] = std::upper_bound( cut_begin, cut_begin+n_cuts, (double)shard( i, j)) - cut_begin;
+  }
+ }
+
+ std::vector< std::uint64_t> message;
+ std::vector< std::int32_t> split_decisions;
+ std::vector< std::uint32_t> weights( n_rows);
+ std::vector< std::int64_t> slot( n_rows);
+ std::vector< std::int64_t> next_slot;
+ std::vector< std::uint64_t> hist;
+ while( coordinator.receive( message) == socket_channel::begin_tree){
+  const std::uint64_t tree_index = message[ 0];
+  const std::uint64_t seed = message[ 1];
+  const bool bootstrap = message[ 2];
+  for( std::size_t i = 0; i < n_rows; ++i){
+   weights[ i] = bootstrap ? detail::bootstrap_weight( seed, tree_index, first_row+i) : 1;
+   slot[ i] = weights[ i] ? 0 : -1;
+  }
+  std::size_t n_open = 1;
+  while( n_open){
+   //hist[ open node][ feature][ bin][ class]
+   hist.assign( n_open*n_features*n_bins*n_classes, 0);
+   for( std::size_t j = 0; j < n_features; ++j){
+    const std::uint8_t* column = codes.data()+j*n_rows;
+    for( std::size_t i = 0; i < n_rows; ++i){
+     if( slot[ i] < 0){ continue; }
+     hist[ ((slot[ i]*n_features+j)*n_bins+column[ i])*n_classes+labels[ i]] += weights[ i];
+    }
+   }
+   coordinator.send( socket_channel::histogram, hist);
+
+   //decisions: (feature, bin) per open node, feature < 0 for a leaf.
+   //Children of split nodes are opened in order, left before right.
+   coordinator.expect( socket_channel::decisions, split_decisions);
+   next_slot.assign( n_open, -1);
+   std::size_t next_open = 0;
+   for( std::size_t s = 0; s < n_open; ++s){
+    if( split_decisions[ 2*s] >= 0){ next_slot[ s] = next_open; next_open += 2; }
+   }
+   for( std::size_t i = 0; i < n_rows; ++i){
+    if( slot[ i] < 0){ continue; }
+    const auto s = slot[ i];
+    const auto feature = split_decisions[ 2*s];
+    if( feature < 0){ slot[ i] = -1; continue; }
+    const bool left = codes[ feature*n_rows+i] < split_decisions[ 2*s+1];
+    slot[ i] = next_slot[ s] + (left ? 0 : 1);
+   }
+   n_open = next_open;
+  }
+ }
+}
+
+/**
+ * Trains forest.params().n_estimators trees over the shards owned by workers,
+ * then shuts the workers down. Class labels are the indices 0..n_classes-1.
+ */
+template< typename Label_type>
+void run_coordinator( std::vector< socket_channel>& workers, const distributed_params& p,
+                      random_forest_classifier< Label_type>& forest){
+ typedef typename random_forest_classifier< Label_type>::tree tree;
+ if( p.n_bins < 2 || p.n_bins > 256){ throw std::invalid_argument( "n_bins must be in [2, 256]"); }
+ const auto& params = p.forest;
+ const bool gini = (params.criterion != "entropy");
+
+ //Reduce the shard summaries
+ std::vector< double> summary;
+ std::size_t n_features = 0, n_classes = 0;
+ std::uint64_t n_rows = 0;
+ std::vector< double> lo, hi;
+ for( auto& w: workers){
+  w.expect( socket_channel::summary, summary);
+  if( lo.empty()){
+   n_features = summary[ 1];
+   lo.assign( n_features, std::numeric_limits< double>::infinity());
+   hi.assign( n_features, -std::numeric_limits< double>::infinity());
+  }
+  if( summary[ 1] != n_features){ throw std::runtime_error( "workers disagree on the number of features"); }
+  n_rows += summary[ 0];
+  n_classes = std::max< std::size_t>( n_classes, summary[ 2]);
+  for( std::size_t j = 0; j < n_features; ++j){
+   lo[ j] = std::min( lo[ j], summary[ 3+j]);
+   hi[ j] = std::max( hi[ j], summary[ 3+n_features+j]);
+  }
+ }
+
+ //Equal width cut points. Duplicate cut points (constant features) give empty bins.
+ const std::size_t n_bins = p.n_bins;
+ const std::size_t n_cuts = n_bins-1;
+ std::vector< double> edges( 2+n_features*n_cuts);
+ edges[ 0] = n_classes; edges[ 1] = n_bins;
+ for( std::size_t j = 0; j < n_features; ++j){
+  const double width = (hi[ j]-lo[ j])/n_bins;
+  for( std::size_t k = 0; k < n_cuts; ++k){ edges[ 2+j*n_cuts+k] = lo[ j] + width*(k+1); }
+ }
+ for( auto& w: workers){ w.send( socket_channel::bin_edges, edges); }
+
+ forest.n_classes( n_classes);
+ std::mt19937 gen( params.random_seed);
+ const std::size_t max_depth = params.max_depth ? params.max_depth : MAX_TREE_HEIGHT;
+ const std::size_t subset_size = features_per_split( params, n_features);
+ std::vector< std::size_t> columns( n_features);
+
+ std::vector< std::uint64_t> hist, received;
+ std::vector< std::int32_t> split_decisions;
+ std::vector< std::uint64_t> left( n_classes), right( n_classes);
+ for( std::size_t t = 0; t < params.n_estimators; ++t){
+  const std::vector< std::uint64_t> begin = { t, (std::uint64_t)params.random_seed, params.bootstrap };
+  for( auto& w: workers){ w.send( socket_channel::begin_tree, begin); }
+  tree& current_tree = forest.insert_next_tree();
+  current_tree.insert_root();
+  //open node indices into current_tree and their depths
+  std::vector< std::size_t> open( 1, 0), next_open;
+  std::vector< std::size_t> depth( 1, 0), next_depth;
+  while( !open.empty()){
+   const std::size_t stride = n_features*n_bins*n_classes;
+   hist.assign( open.size()*stride, 0);
+   for( auto& w: workers){
+    w.expect( socket_channel::histogram, received);
+    if( received.size() != hist.size()){ throw std::runtime_error( "histogram size mismatch"); }
+    for( std::size_t i = 0; i < hist.size(); ++i){ hist[ i] += received[ i]; }
+   }
+   split_decisions.assign( 2*open.size(), -1);
+   next_open.clear(); next_depth.clear();
+   for( std::size_t s = 0; s < open.size(); ++s){
+    const std::uint64_t* node_hist = hist.data()+s*stride;
+    //class totals of the node, from feature 0
+    std::fill( right.begin(), right.end(), 0);
+    for( std::size_t b = 0; b < n_bins; ++b){
+     for( std::size_t c = 0; c < n_classes; ++c){ right[ c] += node_hist[ b*n_classes+c]; }
+    }
+    const auto majority = std::max_element( right.begin(), right.end()) - right.begin();
+    const double total = std::accumulate( right.begin(), right.end(), 0.0);
+    const bool pure = std::count_if( right.begin(), right.end(), []( std::uint64_t x){ return x>0; }) <= 1;
+    double best_impurity = detail::impurity( right.data(), n_classes, total, gini)*total - params.min_impurity_split;
+    int best_feature = -1, best_bin = 0;
+    if( !pure && depth[ s] < max_depth && total >= params.min_samples_split){
+     std::iota( columns.begin(), columns.end(), 0);
+     std::shuffle( columns.begin(), columns.end(), gen);
+     for( std::size_t k = 0; k < subset_size; ++k){
+      const std::size_t j = columns[ k];
+      const std::uint64_t* feature_hist = node_hist+j*n_bins*n_classes;
+      std::fill( left.begin(), left.end(), 0);
+      std::vector< std::uint64_t> upper( right);
+      double n_left = 0;
+      //split "bin < b" for b in 1..n_bins-1
+      for( std::size_t b = 1; b < n_bins; ++b){
+       for( std::size_t c = 0; c < n_classes; ++c){
+        const auto x = feature_hist[ (b-1)*n_classes+c];
+        left[ c] += x; upper[ c] -= x; n_left += x;
+       }
+       const double n_right = total-n_left;
+       if( n_left == 0 || n_right == 0){ continue; }
+       if( n_left < params.min_samples_leaf || n_right < params.min_samples_leaf){ continue; }
+       const double impurity = n_left*detail::impurity( left.data(), n_classes, n_left, gini) +
+                               n_right*detail::impurity( upper.data(), n_classes, n_right, gini);
+       if( impurity < best_impurity){
+        best_impurity = impurity;
+        best_feature = j;
+        best_bin = b;
+       }
+      }
+     }
+    }
+    auto& node = current_tree[ open[ s]];
+    current_tree.set_cover( open[ s], total);
+    if( best_feature < 0){
+     current_tree.generate_leaf_node( node, (Label_type)majority);
+     current_tree.set_leaf_distribution( node, right.data(), n_classes);
+     continue;
+    }
+    current_tree.set_split( node, best_feature, edges[ 2+best_feature*n_cuts+best_bin-1]);
+    split_decisions[ 2*s] = best_feature;
+    split_decisions[ 2*s+1] = best_bin;
+    current_tree.insert_children( node);
+    const auto& parent = current_tree[ open[ s]];
+    next_open.push_back( parent.left_child_index());
+    next_open.push_back( parent.right_child_index());
+    next_depth.push_back( depth[ s]+1);
+    next_depth.push_back( depth[ s]+1);
+   }
+   for( auto& w: workers){ w.send( socket_channel::decisions, split_decisions); }
+   open.swap( next_open);
+   depth.swap( next_depth);
+  }
+ }
+ const std::vector< std::uint64_t> none;
+ for( auto& w: workers){ w.send( socket_channel::shutdown, none); }
+}
+
+} //end namespace distributed
+} //end namespace ml
+} //end namespace ayasdi
@@ -0,0 +1,193 @@
+#pragma once
+/**
+ * Dense matrices.
+ *
+ * Matrix_view is a non-owning strided view: element (i, j) lives at
+ * data()[ i*row_stride() + j*col_stride()], so column major, row major and
+ * sliced numpy arrays are all views without a copy.
+ *
+ * Matrix owns its storage. The storage is 64 byte aligned and the leading
+ * dimension is padded up to a whole cache line, so every column (or row,
+ * for row major matrices) starts on an aligned boundary and SIMD kernels
+ * may use aligned loads and read up to the padded length.
+ */
+
+//STL
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+namespace ayasdi{
+namespace ml{
+
+//Alignment, in bytes, of Matrix storage.
+constexpr std::size_t matrix_alignment = 64;
+
+template< typename T, std::size_t Alignment=matrix_alignment>
+struct aligned_allocator {
+ typedef T value_type;
+ template< typename U> struct rebind { typedef aligned_allocator< U, Alignment> other; };
+
+ aligned_allocator() = default;
+ template< typename U>
+ aligned_allocator( const aligned_allocator< U, Alignment>&) {}
+
+ T* allocate( std::size_t n){
+     if( n == 0){ return nullptr; }
+     void* p = nullptr;
+     #ifdef _WIN32
+     p = _aligned_malloc( n*sizeof( T), Alignment);
+     #else
+     if( posix_memalign( &p, Alignment, n*sizeof( T))){ p = nullptr; }
+     #endif
+     if( !p){ throw std::bad_alloc(); }
+     return static_cast< T*>( p);
+ }
+ void deallocate( T* p, std::size_t){
+     #ifdef _WIN32
+     _aligned_free( p);
+     #else
+     std::free( p);
+     #endif
+ }
+ template< typename U>
+ bool operator==( const aligned_allocator< U, Alignment>&) const { return true; }
+ template< typename U>
+ bool operator!=( const aligned_allocator< U, Alignment>&) const { return false; }
+};
+
+template< typename T>
+using aligned_vector = std::vector< T, aligned_allocator< T> >;
+
+enum class storage_order { column_major, row_major };
+
+//n rounded up to a whole number of cache lines of T
+template< typename T>
+inline std::size_t padded_length( std::size_t n){
+ const std::size_t per_line = matrix_alignment/sizeof( T) ? matrix_alignment/sizeof( T) : 1;
+ return ((n + per_line-1)/per_line)*per_line;
+}
+
+template< typename T>
+class Matrix_view {
+public:
+ typedef T value_type;
+
+ /**
+ * A row of a matrix, usable as the Datapoint of decision_tree::vote()
+ */
+ class row_view {
+ public:
+  row_view( T* p, std::size_t stride): p_( p), stride_( stride) {}
+  T& operator[]( std::size_t j) const { return p_[ j*stride_]; }
+ private:
+  T* p_;
+  std::size_t stride_;
+ };
+
+ Matrix_view(): n_rows( 0), n_cols( 0), r_stride( 1), c_stride( 0), ptr( nullptr) {}
+
+ //Packed column major
+ Matrix_view(T* raw_ptr, size_t rows, size_t cols):
+ n_rows( rows), n_cols( cols), r_stride( 1), c_stride( rows), ptr(raw_ptr) {}
+
+ //Arbitrary strides, in elements
+ Matrix_view(T* raw_ptr, size_t rows, size_t cols, size_t row_stride, size_t col_stride):
+ n_rows( rows), n_cols( cols), r_stride( row_stride), c_stride( col_stride), ptr(raw_ptr) {}
+
+ static Matrix_view column_major( T* p, size_t rows, size_t cols, size_t leading_dimension=0){
+     return Matrix_view( p, rows, cols, 1, leading_dimension ? leading_dimension : rows);
+ }
+ static Matrix_view row_major( T* p, size_t rows, size_t cols, size_t leading_dimension=0){
+     return Matrix_view( p, rows, cols, leading_dimension ? leading_dimension : cols, 1);
+ }
+ /**
+ * A view of an external buffer with strides in bytes, e.g. a numpy array.
+ * Throws if a stride is not a multiple of sizeof( T).
+ */
+ static Matrix_view from_buffer( T* p, size_t rows, size_t cols,
+                                 std::ptrdiff_t row_stride_bytes, std::ptrdiff_t col_stride_bytes){
+     if( row_stride_bytes < 0 || col_stride_bytes < 0 ||
+         row_stride_bytes % sizeof( T) || col_stride_bytes % sizeof( T)){
+         throw std::invalid_argument( "Matrix_view: strides must be non-negative multiples of the element size");
+     }
+     return Matrix_view( p, rows, cols, row_stride_bytes/sizeof( T), col_stride_bytes/sizeof( T));
+ }
+
+ T& operator()(size_t i, size_t j) const { return ptr[ i*r_stride + j*c_stride]; }
+ std::size_t height()const { return n_rows; };
+ std::size_t width()const { return n_cols; };
+ std::size_t row_stride() const { return r_stride; }
+ std::size_t col_stride() const { return c_stride; }
+ bool is_column_major() const { return r_stride == 1; }
+ bool is_row_major() const { return c_stride == 1; }
+ //True if the elements occupy exactly height()*width() consecutive slots
+ bool is_packed() const {
+     return (r_stride == 1 && (c_stride == n_rows || n_cols <= 1)) ||
+            (c_stride == 1 && (r_stride == n_cols || n_rows <= 1));
+ }
+
+ T* data() const { return ptr; }
+ //Contiguous columns, only meaningful when is_column_major()
+ T* begin( std::size_t j) const { return &((*this)(0,j)); }
+ T* end( std::size_t j) const { return begin(j)+n_rows; }
+
+ row_view row( std::size_t i) const { return row_view( ptr+i*r_stride, c_stride); }
+
+ //Rectangular slice, shares storage
+ Matrix_view block( size_t first_row, size_t first_col, size_t rows, size_t cols) const {
+     return Matrix_view( &(*this)( first_row, first_col), rows, cols, r_stride, c_stride);
+ }
+ Matrix_view transpose() const { return Matrix_view( ptr, n_cols, n_rows, c_stride, r_stride); }
+
+protected:
+ size_t n_rows;
+ size_t n_cols;
+ size_t r_stride;
+ size_t c_stride;
+ T* ptr;
+};
+
+/**
+ * Owning matrix with 64 byte aligned, padded columns (or rows).
+ */
+template< typename T>
+class Matrix : public Matrix_view<T>{
+public:
+ Matrix(): Matrix_view<T>() {}
+ Matrix(size_t rows, size_t cols, storage_order order=storage_order::column_major):
+ Matrix_view<T>( nullptr, rows, cols,
+                 order == storage_order::column_major ? 1 : padded_length< T>( cols),
+                 order == storage_order::column_major ? padded_length< T>( rows) : 1),
+ data_( order == storage_order::column_major ? padded_length< T>( rows)*cols : padded_length< T>( cols)*rows) {
+   this->ptr = data_.data();
+ }
+ Matrix( const Matrix& m): Matrix_view<T>( m), data_( m.data_) { this->ptr = data_.data(); }
+ Matrix( Matrix&& m): Matrix_view<T>( m), data_( std::move( m.data_)) { this->ptr = data_.data(); }
+ Matrix& operator=( Matrix m){
+     Matrix_view<T>::operator=( m);
+     data_.swap( m.data_);
+     this->ptr = data_.data();
+     return *this;
+ }
+ //The view of this matrix
+ Matrix_view<T> view() const { return *this; }
+private:
+ aligned_vector<T> data_;
+};
+
+/**
+ * True for Matrix_view and the types derived from it.
+ */
+template< typename M, typename = void>
+struct is_matrix_view : std::false_type {};
+
+template< typename M>
+struct is_matrix_view< M, typename std::enable_if< 
+    std::is_base_of< Matrix_view< typename M::value_type>, M>::value>::type> : std::true_type {};
+
+} //end namespace ml
+} //end namespace ayasdi
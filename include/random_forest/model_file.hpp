@@ -0,0 +1,302 @@
+#pragma once
+/**
+ * Memory mappable model files.
+ *
+ * A model file is the arrays of a compact_forest behind a fixed header,
+ * all little endian:
+ *
+ *   offset  size
+ *        0     8  magic "RFMODEL\0"
+ *        8     4  format version (model_format_version)
+ *       12     4  byte order tag 0x01020304
+ *       16     4  sizeof( compact_node)
+ *       20     2  sizeof( Label_type)
+ *       22     2  label kind: 0 signed, 1 unsigned, 2 floating point
+ *       24     8  number of trees
+ *       32     8  number of classes
+ *       40     8  number of nodes
+ *       48     8  number of leaves
+ *       56     8  flags, bit 0: thresholds are exact (compact_forest::exact())
+ *       64     8  file size
+ *       72    56  reserved, zero
+ *      128        nodes, then tree offsets (n_trees+1 uint64), then leaf
+ *                 labels, each section starting on a 64 byte boundary
+ *
+ * The sections are exactly the arrays compact_forest_view traverses, so
+ * loading is an mmap and a header check: mapped_model points its view into
+ * the mapping, and processes mapping the same file share its pages. Loading
+ * reads only the header and the first and last tree offsets. Files from an
+ * untrusted source should be loaded with verify set, which also reads every
+ * node and leaf label once, so that a corrupt file throws instead of walking
+ * out of the mapping.
+ */
+
+//Project
+#include <random_forest/compact_forest.hpp>
+
+//STL
+#include <string>
+#include <ostream>
+#include <fstream>
+#include <cstdint>
+#include <cstring> //memcpy, memcmp
+#include <limits>
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+//POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ayasdi{
+namespace ml {
+
+//2: right_offset far_offset marks a far split (compact_forest.hpp)
+constexpr std::uint32_t model_format_version = 2;
+
+struct model_header {
+ char magic[ 8];
+ std::uint32_t version;
+ std::uint32_t byte_order;
+ std::uint32_t node_size;
+ std::uint16_t label_size;
+ std::uint16_t label_kind;
+ std::uint64_t n_trees;
+ std::uint64_t n_classes;
+ std::uint64_t n_nodes;
+ std::uint64_t n_leaves;
+ std::uint64_t flags;
+ std::uint64_t file_size;
+ std::uint8_t reserved[ 56];
+};
+static_assert( sizeof( model_header) == 128, "model_header must be 128 bytes");
+
+namespace detail {
+
+constexpr char model_magic[ 8] = { 'R', 'F', 'M', 'O', 'D', 'E', 'L', '\0' };
+constexpr std::uint32_t model_byte_order = 0x01020304;
+constexpr std::uint64_t model_exact_flag = 1;
+constexpr std::uint64_t max_unchecked_classes = 1 << 16;
+
+inline std::uint64_t section_align( std::uint64_t offset){ return (offset + 63) & ~std::uint64_t( 63); }
+
+template< typename Label_type>
+std::uint16_t label_kind(){
+ return std::is_floating_point< Label_type>::value ? 2 : (std::is_signed< Label_type>::value ? 0 : 1);
+}
+
+struct model_sections {
+ std::uint64_t nodes, tree_offsets, leaf_labels, end;
+};
+
+/**
+ * Section offsets of the header's counts. Counts too large for any file
+ * give offsets of all ones, which no file size matches.
+ */
+template< typename Label_type>
+model_sections sections( const model_header& h){
+ model_sections s;
+ //With each section below 2^62 bytes the sums below cannot overflow
+ const std::uint64_t limit = std::uint64_t( 1) << 62;
+ if( h.n_nodes > limit/sizeof( compact_node) || h.n_trees >= limit/sizeof( std::uint64_t) ||
+     h.n_leaves > limit/sizeof( Label_type)){
+  s.nodes = s.tree_offsets = s.leaf_labels = s.end = std::numeric_limits< std::uint64_t>::max();
+  return s;
+ }
+ s.nodes = sizeof( model_header);
+ s.tree_offsets = section_align( s.nodes + h.n_nodes*sizeof( compact_node));
+ s.leaf_labels = section_align( s.tree_offsets + (h.n_trees+1)*sizeof( std::uint64_t));
+ s.end = s.leaf_labels + h.n_leaves*sizeof( Label_type);
+ return s;
+}
+
+/**
+ * Throws std::runtime_error unless the tree offsets rise to n_nodes, every
+ * right child lies inside its tree, every far split is followed by its
+ * extension node and every leaf index and label is in range, so that
+ * traversal stays inside the arrays.
+ */
+template< typename Label_type>
+void check_model( const compact_forest_view< Label_type>& f, std::uint64_t n_nodes, std::uint64_t n_leaves){
+ for( std::size_t t = 0; t < f.n_trees; ++t){
+  const std::uint64_t begin = f.tree_offsets[ t], end = f.tree_offsets[ t+1];
+  if( end <= begin || end > n_nodes){ throw std::runtime_error( "model_view: corrupt tree offsets"); }
+  for( std::uint64_t i = begin; i < end; ++i){
+   const compact_node& n = f.nodes[ i];
+   if( n.is_leaf()){
+    if( n.leaf_index() >= n_leaves){ throw std::runtime_error( "model_view: leaf index out of range"); }
+   }
+   else if( n.is_far()){
+    //The extension is next and the left child after it, so the right one is at least three nodes on
+    if( i+1 == end){ throw std::runtime_error( "model_view: corrupt far split"); }
+    const compact_node& extension = f.nodes[ i+1];
+    const std::uint64_t offset = extension.leaf_index();
+    if( extension.feature != 0 || extension.right_offset != 1 || offset < 3 || offset >= end-i){
+     throw std::runtime_error( "model_view: corrupt far split");
+    }
+    ++i;
+   }
+   //The left child is the next node, so the right one is at least two nodes on
+   else if( n.right_offset < 2 || n.right_offset >= end-i){
+    throw std::runtime_error( "model_view: child offset out of range");
+   }
+  }
+ }
+ for( std::uint64_t k = 0; k < n_leaves; ++k){
+  const double label = f.leaf_labels[ k];
+  if( !(label >= 0 && label < f.n_classes)){ throw std::runtime_error( "model_view: leaf label out of range"); }
+ }
+}
+
+inline bool little_endian_host(){
+ const std::uint32_t x = model_byte_order;
+ unsigned char first;
+ std::memcpy( &first, &x, 1);
+ return first == 0x04;
+}
+
+} //end namespace detail
+
+/**
+ * Writes f as a model file. Throws std::runtime_error on a big endian host
+ * or if the stream fails.
+ */
+template< typename Label_type>
+void write_model( const compact_forest< Label_type>& f, std::ostream& out){
+ if( !detail::little_endian_host()){ throw std::runtime_error( "write_model: big endian hosts are not supported"); }
+ model_header h;
+ std::memset( &h, 0, sizeof( h));
+ std::memcpy( h.magic, detail::model_magic, sizeof( h.magic));
+ h.version = model_format_version;
+ h.byte_order = detail::model_byte_order;
+ h.node_size = sizeof( compact_node);
+ h.label_size = sizeof( Label_type);
+ h.label_kind = detail::label_kind< Label_type>();
+ h.n_trees = f.size();
+ h.n_classes = f.n_classes();
+ h.n_nodes = f.nodes.size();
+ h.n_leaves = f.leaf_labels.size();
+ h.flags = f.exact() ? detail::model_exact_flag : 0;
+ const auto s = detail::sections< Label_type>( h);
+ h.file_size = s.end;
+
+ std::uint64_t position = 0;
+ auto write_at = [&]( std::uint64_t offset, const void* data, std::size_t bytes){
+  static const char zeros[ 64] = { 0 };
+  out.write( zeros, offset-position);
+  out.write( static_cast< const char*>( data), bytes);
+  position = offset+bytes;
+ };
+ write_at( 0, &h, sizeof( h));
+ write_at( s.nodes, f.nodes.data(), f.nodes.size()*sizeof( compact_node));
+ write_at( s.tree_offsets, f.tree_offsets.data(), f.tree_offsets.size()*sizeof( std::uint64_t));
+ write_at( s.leaf_labels, f.leaf_labels.data(), f.leaf_labels.size()*sizeof( Label_type));
+ if( !out){ throw std::runtime_error( "write_model: write failed"); }
+}
+
+template< typename Label_type>
+void save_model( const compact_forest< Label_type>& f, const std::string& path){
+ std::ofstream out( path, std::ios::binary | std::ios::trunc);
+ if( !out){ throw std::system_error( errno, std::generic_category(), "save_model: " + path); }
+ write_model( f, out);
+}
+
+/**
+ * The view of a model file image of size bytes at data, which must be
+ * 64 byte aligned (as a mapping is). Checks the header and the sizes, and
+ * with verify also the arrays (detail::check_model()), but copies nothing;
+ * throws std::runtime_error if the image is not a valid model for Label_type.
+ * A model with more classes than leaves may have at most 65536 of them,
+ * which bounds the vote buffers of predict() for unverified files.
+ */
+template< typename Label_type>
+compact_forest_view< Label_type> model_view( const void* data, std::size_t size, bool verify=false){
+ if( !detail::little_endian_host()){ throw std::runtime_error( "model_view: big endian hosts are not supported"); }
+ if( size < sizeof( model_header) || reinterpret_cast< std::uintptr_t>( data) % 64){
+  throw std::runtime_error( "model_view: truncated or misaligned model");
+ }
+ model_header h;
+ std::memcpy( &h, data, sizeof( h));
+ if( std::memcmp( h.magic, detail::model_magic, sizeof( h.magic)) || h.byte_order != detail::model_byte_order){
+  throw std::runtime_error( "model_view: not a model file");
+ }
+ if( h.version != model_format_version){ throw std::runtime_error( "model_view: unsupported format version"); }
+ if( h.node_size != sizeof( compact_node) || h.label_size != sizeof( Label_type) ||
+     h.label_kind != detail::label_kind< Label_type>()){
+  throw std::runtime_error( "model_view: label or node type mismatch");
+ }
+ const auto s = detail::sections< Label_type>( h);
+ if( h.file_size != s.end || size < s.end){ throw std::runtime_error( "model_view: truncated model"); }
+ if( (h.n_trees && !h.n_classes) || h.n_classes > std::max( h.n_leaves, detail::max_unchecked_classes)){
+  throw std::runtime_error( "model_view: class count out of range");
+ }
+ const char* base = static_cast< const char*>( data);
+ const compact_forest_view< Label_type> view{ reinterpret_cast< const compact_node*>( base + s.nodes),
+                                              reinterpret_cast< const std::uint64_t*>( base + s.tree_offsets),
+                                              reinterpret_cast< const Label_type*>( base + s.leaf_labels),
+                                              (std::size_t)h.n_trees, (std::size_t)h.n_classes };
+ if( view.tree_offsets[ 0] != 0 || view.tree_offsets[ view.n_trees] != h.n_nodes){
+  throw std::runtime_error( "model_view: corrupt tree offsets");
+ }
+ if( verify){ detail::check_model( view, h.n_nodes, h.n_leaves); }
+ return view;
+}
+
+/**
+ * A read only, shared mapping of a model file. Move only.
+ * verify is passed on to model_view().
+ */
+template< typename Label_type>
+class mapped_model {
+public:
+ typedef compact_forest_view< Label_type> view_type;
+
+ explicit mapped_model( const std::string& path, bool verify=false){
+     const int fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC);
+     if( fd < 0){ throw std::system_error( errno, std::generic_category(), "mapped_model: " + path); }
+     struct stat st;
+     if( ::fstat( fd, &st) < 0){
+      const int e = errno;
+      ::close( fd);
+      throw std::system_error( e, std::generic_category(), "mapped_model: fstat");
+     }
+     size_ = st.st_size;
+     data_ = size_ ? ::mmap( nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+     const int e = errno;
+     ::close( fd);
+     if( data_ == MAP_FAILED){
+      data_ = nullptr;
+      if( size_ == 0){ throw std::runtime_error( "mapped_model: empty file " + path); }
+      throw std::system_error( e, std::generic_category(), "mapped_model: mmap");
+     }
+     try { view_ = model_view< Label_type>( data_, size_, verify); }
+     catch( ...){ ::munmap( data_, size_); throw; }
+ }
+ mapped_model( mapped_model&& m): data_( m.data_), size_( m.size_), view_( m.view_) { m.data_ = nullptr; }
+ mapped_model& operator=( mapped_model&& m){
+     std::swap( data_, m.data_);
+     std::swap( size_, m.size_);
+     std::swap( view_, m.view_);
+     return *this;
+ }
+ mapped_model( const mapped_model&) = delete;
+ mapped_model& operator=( const mapped_model&) = delete;
+ ~mapped_model(){ if( data_){ ::munmap( data_, size_); } }
+
+ const view_type& view() const { return view_; }
+ std::size_t bytes() const { return size_; }
+
+private:
+ void* data_=nullptr;
+ std::size_t size_=0;
+ view_type view_ = view_type();
+}; //end class mapped_model
+
+} //end namespace ml
+} //end namespace ayasdi
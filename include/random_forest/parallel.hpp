@@ -0,0 +1,62 @@
+#pragma once
+/**
+ * Fork/join helpers for data parallel loops.
+ */
+
+//STL
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <exception>
+#include <algorithm>
+
+namespace ayasdi{
+namespace ml {
+
+//Number of hardware threads, at least 1.
+inline std::size_t hardware_threads(){
+ return std::max< std::size_t>( 1, std::thread::hardware_concurrency());
+}
+
+/**
+ * Calls f( begin, end) over consecutive chunks of [0, n) of at most grain
+ * items from n_threads threads, the calling thread included; 0 means
+ * hardware_threads(). Chunks are claimed from a shared counter, so uneven
+ * chunks balance out. The first exception thrown by f stops the loop and
+ * is rethrown once every thread has joined.
+ */
+template< typename F>
+void parallel_for( std::size_t n, std::size_t n_threads, std::size_t grain, const F& f){
+ if( grain == 0){ grain = 1; }
+ const std::size_t n_chunks = (n + grain-1)/grain;
+ if( n_threads == 0){ n_threads = hardware_threads(); }
+ n_threads = std::min( n_threads, n_chunks);
+ if( n_threads <= 1){
+  for( std::size_t begin = 0; begin < n; begin += grain){ f( begin, std::min( n, begin+grain)); }
+  return;
+ }
+ std::atomic< std::size_t> next_chunk( 0);
+ std::atomic< bool> failed( false);
+ std::exception_ptr error;
+ std::mutex error_lock;
+ auto work = [&](){
+  for( std::size_t c = next_chunk++; c < n_chunks && !failed; c = next_chunk++){
+   try { f( c*grain, std::min( n, (c+1)*grain)); }
+   catch( ...){
+    std::lock_guard< std::mutex> lock( error_lock);
+    if( !error){ error = std::current_exception(); }
+    failed = true;
+   }
+  }
+ };
+ std::vector< std::thread> threads;
+ threads.reserve( n_threads-1);
+ for( std::size_t t = 1; t < n_threads; ++t){ threads.emplace_back( work); }
+ work();
+ for( auto& t: threads){ t.join(); }
+ if( error){ std::rethrow_exception( error); }
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -0,0 +1,127 @@
+#pragma once
+/**
+ * Sparse random forest proximities.
+ *
+ * The proximity of rows i and j is the fraction of trees in which they
+ * land in the same leaf. proximity() never forms the n by n matrix:
+ *
+ *  1. apply() gives every row's leaf in every tree, in one blocked pass.
+ *  2. For every tree the rows are bucketed by leaf (a counting sort), so
+ *     the rows sharing a leaf with row i are one contiguous range.
+ *  3. In parallel over rows, the co-occurrence counts of row i are
+ *     accumulated over its buckets in a per thread scratch array and the
+ *     k largest are kept.
+ *
+ * Work is proportional to the sum over trees and rows of the size of the
+ * row's leaf, so it is linear in the rows for fully grown trees, while
+ * memory is one int32 per (row, tree) plus the k neighbors per row.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/matrix.hpp>
+#include <random_forest/parallel.hpp>
+
+//STL
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace ayasdi{
+namespace ml {
+
+/**
+ * The k nearest rows of every row by proximity, in compressed sparse row
+ * form: the neighbors of row i are neighbors[ offsets[ i]..offsets[ i+1]),
+ * in decreasing proximity, ties by increasing row. A row is not its own
+ * neighbor.
+ */
+struct sparse_proximity {
+ std::vector< std::size_t> offsets;
+ std::vector< std::uint32_t> neighbors;
+ std::vector< float> values;
+
+ std::size_t height() const { return offsets.size() ? offsets.size()-1 : 0; }
+ std::size_t size( std::size_t i) const { return offsets[ i+1]-offsets[ i]; }
+ const std::uint32_t* neighbors_of( std::size_t i) const { return neighbors.data()+offsets[ i]; }
+ const float* values_of( std::size_t i) const { return values.data()+offsets[ i]; }
+};
+
+/**
+ * Top k proximities of every row of X under forest, see the top of this
+ * file. n_threads is as in parallel_for(). Throws std::length_error if X
+ * has more rows than a uint32 can index.
+ */
+template< typename Label_type, typename T>
+sparse_proximity proximity( const random_forest_classifier< Label_type>& forest, const Matrix_view< T>& X,
+                            std::size_t k, std::size_t n_threads=0){
+ const std::size_t n = X.height();
+ const std::size_t n_trees = forest.size();
+ if( n > std::numeric_limits< std::uint32_t>::max()){ throw std::length_error( "proximity: too many rows"); }
+ //Column major, so the leaves of one tree are contiguous
+ const Matrix< std::int32_t> leaves = forest.apply( X, n_threads);
+
+ //Rows of tree t bucketed by leaf: bucket_rows[ t*n + bucket_offsets[ t][ leaf]...]
+ std::vector< std::vector< std::uint32_t> > bucket_offsets( n_trees);
+ std::vector< std::uint32_t> bucket_rows( n_trees*n);
+ parallel_for( n_trees, n_threads, 1, [&]( std::size_t first, std::size_t last){
+  for( std::size_t t = first; t < last; ++t){
+   auto& offsets = bucket_offsets[ t];
+   offsets.assign( forest[ t].size()+1, 0);
+   for( std::size_t i = 0; i < n; ++i){ offsets[ leaves( i, t)+1]++; }
+   for( std::size_t l = 0; l+1 < offsets.size(); ++l){ offsets[ l+1] += offsets[ l]; }
+   std::vector< std::uint32_t> next( offsets.begin(), offsets.end()-1);
+   std::uint32_t* rows = bucket_rows.data() + t*n;
+   for( std::size_t i = 0; i < n; ++i){ rows[ next[ leaves( i, t)]++] = i; }
+  }
+ });
+
+ std::vector< std::uint32_t> row_sizes( n);
+ std::vector< std::uint32_t> all_neighbors( n*k);
+ std::vector< float> all_values( n*k);
+ const float scale = n_trees ? 1.0f/n_trees : 0.0f;
+ //Every chunk clears an n entry scratch array, so keep chunks few but balanced
+ const std::size_t grain = std::max< std::size_t>( 1024, n/(4*(n_threads ? n_threads : hardware_threads())));
+ parallel_for( n, n_threads, grain, [&]( std::size_t first, std::size_t last){
+  std::vector< std::uint32_t> counts( n, 0);
+  std::vector< std::uint32_t> touched;
+  for( std::size_t i = first; i < last; ++i){
+   touched.clear();
+   for( std::size_t t = 0; t < n_trees; ++t){
+    const auto& offsets = bucket_offsets[ t];
+    const std::int32_t leaf = leaves( i, t);
+    const std::uint32_t* rows = bucket_rows.data() + t*n;
+    for( std::size_t b = offsets[ leaf]; b < offsets[ leaf+1]; ++b){
+     const std::uint32_t j = rows[ b];
+     if( j == i){ continue; }
+     if( counts[ j]++ == 0){ touched.push_back( j); }
+    }
+   }
+   const std::size_t kept = std::min( k, touched.size());
+   auto closer = [&]( std::uint32_t a, std::uint32_t b){ return counts[ a] > counts[ b] || (counts[ a] == counts[ b] && a < b); };
+   std::partial_sort( touched.begin(), touched.begin()+kept, touched.end(), closer);
+   for( std::size_t m = 0; m < kept; ++m){
+    all_neighbors[ i*k+m] = touched[ m];
+    all_values[ i*k+m] = counts[ touched[ m]]*scale;
+   }
+   row_sizes[ i] = kept;
+   for( auto j: touched){ counts[ j] = 0; }
+  }
+ });
+
+ sparse_proximity result;
+ result.offsets.assign( n+1, 0);
+ for( std::size_t i = 0; i < n; ++i){ result.offsets[ i+1] = result.offsets[ i] + row_sizes[ i]; }
+ result.neighbors.reserve( result.offsets[ n]);
+ result.values.reserve( result.offsets[ n]);
+ for( std::size_t i = 0; i < n; ++i){
+  result.neighbors.insert( result.neighbors.end(), all_neighbors.begin()+i*k, all_neighbors.begin()+i*k+row_sizes[ i]);
+  result.values.insert( result.values.end(), all_values.begin()+i*k, all_values.begin()+i*k+row_sizes[ i]);
+ }
+ return result;
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -0,0 +1,176 @@
+#pragma once
+/**
+ * QuickScorer style inference for forests of small trees.
+ *
+ * Every tree is given a 64 bit vector, one bit per leaf with leaves
+ * numbered left to right. A node whose test fails for a row (the row goes
+ * right) makes every leaf of its left subtree unreachable, which is the
+ * node's mask. The nodes of the whole forest are grouped by feature and
+ * sorted by threshold, so scoring a row is, for each feature, a linear scan
+ * over the thresholds the row's value is not below, ANDing masks into the
+ * tree bit vectors. The exit leaf of a tree is then its lowest set bit.
+ *
+ * No node of a tree is ever dereferenced while scoring.
+ *
+ * Lucchese et al., "QuickScorer: a Fast Algorithm to Rank Documents with
+ * Additive Ensembles of Regression Trees", SIGIR 2015.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/matrix.hpp>
+
+//STL
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace ayasdi{
+namespace ml {
+
+//Index of the lowest set bit of a nonzero x
+inline std::size_t lowest_set_bit( std::uint64_t x){
+ #ifdef _MSC_VER
+ unsigned long i;
+ _BitScanForward64( &i, x);
+ return i;
+ #else
+ return __builtin_ctzll( x);
+ #endif
+}
+
+template< typename Label_type>
+class quickscorer {
+public:
+ typedef std::uint64_t bitvector;
+ static constexpr std::size_t max_leaves = 64;
+
+ /**
+ * Builds the scorer from a trained forest.
+ * Throws std::invalid_argument if a tree has more than 64 leaves
+ * or a leaf label is not below forest.n_classes().
+ */
+ explicit quickscorer( const random_forest_classifier< Label_type>& forest):
+ n_trees( forest.size()), n_classes( forest.n_classes()), leaf_labels( forest.size()*max_leaves) {
+     std::vector< condition> conditions;
+     for( std::size_t t = 0; t < forest.size(); ++t){
+      std::size_t next_leaf = 0;
+      if( forest[ t].size()){ add_subtree( forest[ t], 0, t, next_leaf, conditions); }
+     }
+     std::size_t n_features = 0;
+     for( auto& c: conditions){ n_features = std::max( n_features, c.feature+1); }
+     std::sort( conditions.begin(), conditions.end(), []( const condition& a, const condition& b){
+      return a.feature < b.feature || (a.feature == b.feature && a.threshold < b.threshold);
+     });
+     feature_offsets.assign( n_features+1, 0);
+     for( auto& c: conditions){
+      feature_offsets[ c.feature+1]++;
+      thresholds.push_back( c.threshold);
+      trees.push_back( c.tree);
+      masks.push_back( c.mask);
+     }
+     std::partial_sum( feature_offsets.begin(), feature_offsets.end(), feature_offsets.begin());
+ }
+
+ std::size_t size() const { return n_trees; }
+ //Number of internal nodes of the forest
+ std::size_t number_of_conditions() const { return thresholds.size(); }
+
+ /**
+ * Label of p by majority vote, p[ j] is feature j.
+ * Matches random_forest_classifier::predict().
+ */
+ template< typename Datapoint>
+ Label_type predict( const Datapoint& p) const{
+    std::vector< bitvector> v( n_trees);
+    std::vector< std::uint32_t> votes( n_classes);
+    return predict( p, v.data(), votes.data());
+ }
+
+ /**
+ * Labels of every row of X into out, reusing the scratch space across rows.
+ */
+ template< typename T>
+ void predict( const Matrix_view< T>& X, Label_type* out) const{
+    std::vector< bitvector> v( n_trees);
+    std::vector< std::uint32_t> votes( n_classes);
+    for( std::size_t i = 0; i < X.height(); ++i){
+     out[ i] = predict( X.row( i), v.data(), votes.data());
+    }
+ }
+
+private:
+ struct condition {
+  std::size_t feature;
+  double threshold;
+  std::uint32_t tree;
+  bitvector mask;
+ };
+
+ /**
+ * Numbers the leaves of the subtree at node left to right and
+ * emits one condition per internal node.
+ * Returns the bits of the leaves of the subtree.
+ */
+ bitvector add_subtree( const decision_tree< Label_type>& t, std::size_t node, std::size_t tree_index,
+                        std::size_t& next_leaf, std::vector< condition>& conditions){
+    const auto& n = t[ node];
+    if( n.is_leaf()){
+     if( next_leaf == max_leaves){
+      throw std::invalid_argument( "quickscorer: trees may have at most 64 leaves");
+     }
+     const Label_type label = n.template class_label< Label_type>();
+     if( (std::size_t)label >= n_classes){
+      throw std::invalid_argument( "quickscorer: a leaf votes for a class beyond n_classes()");
+     }
+     leaf_labels[ tree_index*max_leaves + next_leaf] = label;
+     return bitvector( 1) << next_leaf++;
+    }
+    const bitvector left = add_subtree( t, n.left_child_index(), tree_index, next_leaf, conditions);
+    const bitvector right = add_subtree( t, n.right_child_index(), tree_index, next_leaf, conditions);
+    conditions.push_back( condition{ n.split_, n.split_value_, (std::uint32_t)tree_index, ~left});
+    return left | right;
+ }
+
+ template< typename Datapoint>
+ Label_type predict( const Datapoint& p, bitvector* v, std::uint32_t* votes) const{
+    std::fill( v, v+n_trees, ~bitvector( 0));
+    const std::size_t n_features = feature_offsets.size()-1;
+    for( std::size_t j = 0; j < n_features; ++j){
+     const double x = p[ j];
+     std::size_t k = feature_offsets[ j];
+     const std::size_t end = feature_offsets[ j+1];
+     //A row goes right when !(x < threshold), which holds for every node if x is NaN.
+     if( std::isnan( x)){
+      for( ; k < end; ++k){ v[ trees[ k]] &= masks[ k]; }
+      continue;
+     }
+     for( ; k < end && thresholds[ k] <= x; ++k){ v[ trees[ k]] &= masks[ k]; }
+    }
+    std::fill( votes, votes+n_classes, 0);
+    for( std::size_t t = 0; t < n_trees; ++t){
+     const std::size_t leaf = lowest_set_bit( v[ t]);
+     votes[ (std::size_t)leaf_labels[ t*max_leaves + leaf]]++;
+    }
+    return std::max_element( votes, votes+n_classes) - votes;
+ }
+
+ std::size_t n_trees;
+ std::size_t n_classes;
+ //Conditions of feature j are [feature_offsets[ j], feature_offsets[ j+1])
+ std::vector< std::size_t> feature_offsets;
+ std::vector< double> thresholds;
+ std::vector< std::uint32_t> trees;
+ std::vector< bitvector> masks;
+ std::vector< Label_type> leaf_labels;
+}; //end class quickscorer
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -3,19 +3,32 @@
 //Project
 #include <random_forest/decision_tree.hpp>
 #include <random_forest/random_sample.hpp>
+#include <random_forest/matrix.hpp>
+#include <random_forest/parallel.hpp>
 
 //STL
 #include <unordered_map>
+#include <random>
+#include <string>
+#include <vector>
 #include <cmath> //log
 #include <numeric> //iota
 #include <unordered_set> //set for oob error.
 #include <set> //set for oob error.
 #include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <stdexcept>
+#include <limits>
 
 
 
 #define MAX_TREE_HEIGHT 32
+//Rows scored together by the batch predict, sized so that a block of rows
+//and its votes stay in L1/L2 while every tree is walked over it.
+#define PREDICT_BLOCK_ROWS 256
 
+namespace ayasdi{
 namespace ml{
 
 struct rf_train_params{
@@ -25,55 +38,324 @@ struct rf_train_params{
  std::size_t min_samples_split=2;
  std::size_t min_samples_leaf=1;
  std::size_t min_weight_fraction_leaf=0.0;
- std::size_t max_features="auto";
+ std::string max_features="auto";
  std::size_t max_leaf_nodes=0;
  double min_impurity_split=1e-07;
  bool bootstrap=true;
- std::size_t row_fraction_size=.63;
+ double row_fraction_size=.63;
  bool oob_score=false;
+ //Also measure permutation importances on the out of bag rows of every tree
+ bool permutation_importance=false;
  int random_seed=0;
  int verbose=0;
 };
 
+/**
+ * Number of columns considered at each split, from params.max_features:
+ * "auto" or "sqrt", "log2", anything else means all columns.
+ */
+inline std::size_t features_per_split( const rf_train_params& p, std::size_t n_features){
+ std::size_t k = n_features;
+ if( p.max_features == "auto" || p.max_features == "sqrt"){ k = std::ceil( std::sqrt( n_features)); }
+ else if( p.max_features == "log2"){ k = std::ceil( std::log2( n_features)); }
+ return std::max< std::size_t>( 1, std::min( k, n_features));
+}
+
 template< typename Label_type>
-class random_forest_classifier : public std::vector< tree> {
+class random_forest_classifier : public std::vector< decision_tree< Label_type> > {
 public:
  typedef decision_tree< Label_type> tree;
- random_forest(const rf_train_params& p): params( p) { insert_first_tree(); }
-private:
- typedef std::vector< std::size_t> Map;
+ random_forest_classifier(const rf_train_params& p=rf_train_params()): params_( p), n_classes_( 0) {}
 
-public:
- auto params() const                   { return params; }
+ const rf_train_params& params() const { return params_; }
 
+ /**
+ * Adds the vote of every tree for p into votes[ 0..n_classes()), which
+ * the caller zeroes. Prediction keeps no state in the forest, so any
+ * number of threads may predict with one forest at the same time.
+ * Throws std::out_of_range if a tree votes for a class beyond
+ * n_classes(), as in a forest built or read with a wrong class count;
+ * so do all the predict functions.
+ */
  template< typename Datapoint>
- Label_type predict( Datapoint& p) const{
-    for(auto& tree: (*this)){ votes[ tree.predict( p)]++; }
-    typedef typename Map::value_type pair;
-    auto max_elt=std::max_element( votes.begin(), votes.end());
-    return std::distance( votes.begin(), max_elt);
+ void add_votes( const Datapoint& p, std::uint32_t* votes) const{
+    for( auto& tree: (*this)){ votes[ class_index( tree.vote( p))]++; }
  }
- 
+
+ template< typename Datapoint,
+           typename = typename std::enable_if< !is_matrix_view< Datapoint>::value>::type>
+ Label_type predict( const Datapoint& p) const{
+    //Votes live on the stack unless there are many classes
+    std::uint32_t stack_votes[ 64] = { 0 };
+    std::vector< std::uint32_t> heap_votes;
+    std::uint32_t* votes = stack_votes;
+    if( n_classes_ > 64){ heap_votes.resize( n_classes_); votes = heap_votes.data(); }
+    add_votes( p, votes);
+    return std::max_element( votes, votes+n_classes_) - votes;
+ }
+
+ /**
+ * Majority vote with early termination: trees are walked in order and the
+ * walk stops as soon as the leading class is ahead of the runner up by
+ * more than the number of trees left, since the remaining trees can then
+ * no longer change the outcome. The label always equals predict( p).
+ * n_evaluated, if given, receives the number of trees walked.
+ */
+ template< typename Datapoint,
+           typename = typename std::enable_if< !is_matrix_view< Datapoint>::value>::type>
+ Label_type predict_early_exit( const Datapoint& p, std::size_t* n_evaluated=nullptr) const{
+    std::uint32_t stack_votes[ 64] = { 0 };
+    std::vector< std::uint32_t> heap_votes;
+    std::uint32_t* votes = stack_votes;
+    if( n_classes_ > 64){ heap_votes.resize( n_classes_); votes = heap_votes.data(); }
+    std::size_t t = 0;
+    while( t < this->size()){
+     votes[ class_index( (*this)[ t++].vote( p))]++;
+     std::uint32_t first = 0, second = 0;
+     for( std::size_t c = 0; c < n_classes_; ++c){
+      if( votes[ c] > first){ second = first; first = votes[ c]; }
+      else if( votes[ c] > second){ second = votes[ c]; }
+     }
+     if( first - second > this->size() - t){ break; }
+    }
+    if( n_evaluated){ *n_evaluated = t; }
+    return std::max_element( votes, votes+n_classes_) - votes;
+ }
+
+ template< typename T>
+ void predict_early_exit( const Matrix_view< T>& X, Label_type* out) const{
+    for( std::size_t i = 0; i < X.height(); ++i){ out[ i] = predict_early_exit( X.row( i)); }
+ }
+
+ template< typename T>
+ std::vector< Label_type> predict_early_exit( const Matrix_view< T>& X) const{
+    std::vector< Label_type> labels( X.height());
+    predict_early_exit( X, labels.data());
+    return labels;
+ }
+
+ /**
+ * Out of bag accuracy of every tree, recorded by the trainer.
+ * NaN for trees without out of bag rows.
+ */
+ const std::vector< double>& oob_scores() const { return oob_scores_; }
+
+ void oob_score( std::size_t t, double score){
+    if( oob_scores_.size() <= t){ oob_scores_.resize( t+1, std::numeric_limits< double>::quiet_NaN()); }
+    oob_scores_[ t] = score;
+ }
+
+ /**
+ * Mean decrease in impurity of every feature, each tree's decreases
+ * normalized to sum to one and averaged over the trees.
+ */
+ const std::vector< double>& feature_importances() const { return feature_importances_; }
+
+ /**
+ * Mean drop in out of bag accuracy when a feature is shuffled, when
+ * trained with params().permutation_importance, empty otherwise.
+ */
+ const std::vector< double>& permutation_importances() const { return permutation_importances_; }
+
+ /**
+ * Folds the importance sums of n_new newly trained trees into the
+ * averages over the previous n_old trees.
+ */
+ void merge_importances( const std::vector< double>& importance_sum, const std::vector< double>& permutation_sum,
+                         std::size_t n_old, std::size_t n_new){
+    auto merge = [&]( std::vector< double>& mean, const std::vector< double>& sum){
+     if( mean.size() < sum.size()){ mean.resize( sum.size(), 0.0); }
+     for( std::size_t j = 0; j < sum.size(); ++j){ mean[ j] = (mean[ j]*n_old + sum[ j])/std::max< std::size_t>( 1, n_old+n_new); }
+    };
+    merge( feature_importances_, importance_sum);
+    if( params_.permutation_importance){ merge( permutation_importances_, permutation_sum); }
+ }
+
+ /**
+ * Reorders the trees by decreasing out of bag accuracy, trees without a
+ * score last, so that predict_early_exit() hears the most reliable trees
+ * first. Majority votes do not depend on the order.
+ */
+ void order_trees_by_oob(){
+    std::vector< std::size_t> order( this->size());
+    std::iota( order.begin(), order.end(), 0);
+    auto score = [&]( std::size_t t){
+     const double s = t < oob_scores_.size() ? oob_scores_[ t] : std::numeric_limits< double>::quiet_NaN();
+     return std::isnan( s) ? -1.0 : s;
+    };
+    std::stable_sort( order.begin(), order.end(), [&]( std::size_t a, std::size_t b){ return score( a) > score( b); });
+    std::vector< tree> trees;
+    std::vector< double> scores;
+    trees.reserve( this->size());
+    for( auto t: order){
+     trees.push_back( std::move( (*this)[ t]));
+     scores.push_back( t < oob_scores_.size() ? oob_scores_[ t] : std::numeric_limits< double>::quiet_NaN());
+    }
+    std::move( trees.begin(), trees.end(), this->begin());
+    oob_scores_.swap( scores);
+ }
+
+ /**
+ * Adds the class distribution of the leaf p reaches in every tree into
+ * proba[ 0..n_classes()). The distributions are contiguous floats, so the
+ * inner loop vectorizes. Trees trained without distributions add a one
+ * hot vote instead.
+ */
  template< typename Datapoint>
- std::tuple< Label_type, double> predict_proba( Datapoint& p) const{
-    for(auto& tree: (*this)){ votes += tree.predict_proba( p); }
-    typedef typename Map::value_type pair;
-    auto max_elt=std::max_element( votes.begin(), votes.end());
-    return std::make_tuple(std::distance( votes.begin(), max_elt), *max_elt);
+ void add_proba( const Datapoint& p, float* proba) const{
+    for( auto& tree: (*this)){ add_leaf_proba( tree, tree.leaf( p), proba); }
+ }
+
+ /**
+ * Class probabilities of p, the mean of the leaf distributions over the trees.
+ */
+ template< typename Datapoint,
+           typename = typename std::enable_if< !is_matrix_view< Datapoint>::value>::type>
+ std::vector< float> predict_proba( const Datapoint& p) const{
+    std::vector< float> proba( n_classes_);
+    add_proba( p, proba.data());
+    const float scale = this->size() ? 1.0f/this->size() : 0.0f;
+    for( auto& x: proba){ x *= scale; }
+    return proba;
  }
- 
- void n_classes( std::size_t& n_classes_){ votes.resize( n_classes_); }
+
+ /**
+ * Class probabilities of every row of X into out, row major with
+ * n_classes() entries per row, tree major within blocks as predict().
+ */
+ template< typename T>
+ void predict_proba( const Matrix_view< T>& X, float* out) const{
+    const float scale = this->size() ? 1.0f/this->size() : 0.0f;
+    for( std::size_t begin = 0; begin < X.height(); begin += PREDICT_BLOCK_ROWS){
+     const std::size_t end = std::min< std::size_t>( X.height(), begin+PREDICT_BLOCK_ROWS);
+     float* block = out + begin*n_classes_;
+     std::fill( block, out + end*n_classes_, 0.0f);
+     for( auto& tree: (*this)){
+      for( std::size_t i = begin; i < end; ++i){ add_leaf_proba( tree, tree.leaf( X.row( i)), out + i*n_classes_); }
+     }
+     for( float* x = block; x != out + end*n_classes_; ++x){ *x *= scale; }
+    }
+ }
+
+ template< typename T>
+ std::vector< float> predict_proba( const Matrix_view< T>& X) const{
+    std::vector< float> proba( X.height()*n_classes_);
+    predict_proba( X, proba.data());
+    return proba;
+ }
+
+ /**
+ * Predicts every row of X into out[ 0..X.height()).
+ * Rows are scored in blocks of PREDICT_BLOCK_ROWS. For each block every
+ * tree is walked over all rows of the block before moving on to the next
+ * tree, so each tree's nodes are loaded once per block rather than once
+ * per row.
+ */
+ template< typename T>
+ void predict( const Matrix_view< T>& X, Label_type* out) const{
+    const std::size_t n_classes = n_classes_;
+    std::vector< std::uint32_t> block_votes( PREDICT_BLOCK_ROWS*n_classes);
+    for( std::size_t begin = 0; begin < X.height(); begin += PREDICT_BLOCK_ROWS){
+     const std::size_t end = std::min< std::size_t>( X.height(), begin+PREDICT_BLOCK_ROWS);
+     std::fill( block_votes.begin(), block_votes.end(), 0);
+     for( auto& tree: (*this)){
+      for( std::size_t i = begin; i < end; ++i){
+       block_votes[ (i-begin)*n_classes + class_index( tree.vote( X.row( i)))]++;
+      }
+     }
+     for( std::size_t i = begin; i < end; ++i){
+      auto row_votes = block_votes.begin() + (i-begin)*n_classes;
+      out[ i] = std::max_element( row_votes, row_votes+n_classes) - row_votes;
+     }
+    }
+ }
+
+ template< typename T>
+ std::vector< Label_type> predict( const Matrix_view< T>& X) const{
+    std::vector< Label_type> labels( X.height());
+    predict( X, labels.data());
+    return labels;
+ }
+
+ /**
+ * predict( X, out) with the rows split across n_threads threads,
+ * 0 for one per hardware thread.
+ */
+ template< typename T>
+ void predict_parallel( const Matrix_view< T>& X, Label_type* out, std::size_t n_threads=0) const{
+    parallel_for( X.height(), n_threads, PREDICT_BLOCK_ROWS, [&]( std::size_t begin, std::size_t end){
+     predict( X.block( begin, 0, end-begin, X.width()), out+begin);
+    });
+ }
+
+ template< typename T>
+ std::vector< Label_type> predict_parallel( const Matrix_view< T>& X, std::size_t n_threads=0) const{
+    std::vector< Label_type> labels( X.height());
+    predict_parallel( X, labels.data(), n_threads);
+    return labels;
+ }
+
+ /**
+ * Leaf reached by every row of X in every tree: out( i, t) is the index,
+ * within tree t, of the leaf row i lands in. out must be X.height() by
+ * size(), any storage order, and is written in place. Rows are walked in
+ * blocks of PREDICT_BLOCK_ROWS, tree major within a block, with blocks
+ * spread over n_threads threads (0 for one per hardware thread).
+ */
+ template< typename T>
+ void apply( const Matrix_view< T>& X, const Matrix_view< std::int32_t>& out, std::size_t n_threads=0) const{
+    if( out.height() != X.height() || out.width() != this->size()){
+     throw std::invalid_argument( "random_forest_classifier::apply: output must be rows by trees");
+    }
+    parallel_for( X.height(), n_threads, PREDICT_BLOCK_ROWS, [&]( std::size_t begin, std::size_t end){
+     for( std::size_t t = 0; t < this->size(); ++t){
+      const tree& current_tree = (*this)[ t];
+      for( std::size_t i = begin; i < end; ++i){ out( i, t) = current_tree.index_of( current_tree.leaf( X.row( i))); }
+     }
+    });
+ }
+
+ template< typename T>
+ Matrix< std::int32_t> apply( const Matrix_view< T>& X, std::size_t n_threads=0) const{
+    Matrix< std::int32_t> leaves( X.height(), this->size());
+    apply( X, leaves, n_threads);
+    return leaves;
+ }
+
+ void n_classes( std::size_t n){ n_classes_ = n; }
+
+ std::size_t n_classes() const { return n_classes_; }
 
  tree& insert_next_tree(){
-    trees.emplace_back();
-    return trees.back();
+    this->emplace_back( 2*MAX_TREE_HEIGHT);
+    return this->back();
  }
  
- rf_train_params params;
- std::random_device rd;
+ rf_train_params params_;
  std::mt19937 gen;
- Map votes;
+private:
+ friend class detail::forest_serializer;
+
+ void add_leaf_proba( const tree& t, const dtree_node& leaf, float* proba) const{
+    if( t.has_distributions()){
+     const float* distribution = t.leaf_distribution( leaf);
+     for( std::size_t c = 0; c < n_classes_; ++c){ proba[ c] += distribution[ c]; }
+    } else { proba[ class_index( leaf.template class_label< Label_type>())] += 1; }
+ }
+
+ //label as an index into the n_classes() entries of the vote and probability arrays
+ std::size_t class_index( Label_type label) const{
+    const std::size_t c = (std::size_t)label;
+    if( c >= n_classes_){ throw std::out_of_range( "random_forest_classifier: a tree votes for a class beyond n_classes()"); }
+    return c;
+ }
+
+ std::size_t n_classes_;
+ std::vector< double> oob_scores_;
+ std::vector< double> feature_importances_;
+ std::vector< double> permutation_importances_;
 }; //end class random_forest
 
 } //end namespace ml
+} //end namespace ayasdi
 
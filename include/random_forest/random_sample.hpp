@@ -52,6 +52,9 @@
  * numbers, but a custom random generator may be used instead.
  */
 #include <cstdlib> // For rand
+#include <numeric> // For iota
+#include <algorithm> // For shuffle
+#include <functional> // For ref
 //BOOST
 #include <boost/iterator/counting_iterator.hpp>
 /**
@@ -124,18 +127,19 @@ RandomAccessIterator random_sample(InputIterator in_begin, InputIterator in_end,
 }
 
 
-template< typename Vector>
-void random_subset_size_k( std::size_t lower_bound, std::size_t upper_bound, std::size_t k, Vector& vector){
+template< typename Vector, typename RandomGenerator>
+void random_subset_size_k( std::size_t lower_bound, std::size_t upper_bound, std::size_t k, Vector& vector,
+                           RandomGenerator& gen){
   typedef boost::counting_iterator< std::size_t> counting_iterator;
   
   vector.resize( k, 0);
   random_sample( counting_iterator( lower_bound), counting_iterator( upper_bound),
-                 vector.begin(), vector.end(), gen);
+                 vector.begin(), vector.end(), std::ref( gen));
 }
 
-template< typename Vector>
-void random_shuffle_range( std::size_t lower_bound, std::size_t upper_bound, Vector& vector){
-  std::mt19937 gen(rd());
+template< typename Vector, typename RandomGenerator>
+void random_shuffle_range( std::size_t lower_bound, std::size_t upper_bound, Vector& vector,
+                           RandomGenerator& gen){
   //std::uniform_int_distribution<> dis(lower_bound, upper_bound);
   //vector.reserve( .63*(upper_bound - lower_bound)); //(1-1/e)*range
   //for( std::size_t i = 0; i < (upper_bound-lower_bound); ++i){
@@ -144,6 +148,6 @@ void random_shuffle_range( std::size_t lower_bound, std::size_t upper_bound, Vec
   //    if( it == vector.end() || ((it != vector.end()) && (*it != idx))){ vector.insert(it, idx); }
   //}
   vector.resize( upper_bound-lower_bound, 0);
-  std::iota( vector.begin(), vector.end(), 0);
-  std::random_shuffle( vector.begin(), vector.end());
+  std::iota( vector.begin(), vector.end(), lower_bound);
+  std::shuffle( vector.begin(), vector.end(), gen);
 }
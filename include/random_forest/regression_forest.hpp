@@ -0,0 +1,297 @@
+#pragma once
+/**
+ * Random forest regression with quantile predictions.
+ *
+ * Trees are grown by variance reduction on the in bag rows, as
+ * random_forest_trainer does for classes, and a leaf predicts the mean of
+ * its rows. Every leaf also keeps the sorted targets of its rows in one
+ * flat float buffer shared by the forest; the leaf's split_ (unused by
+ * leaves) holds its position in leaf_offsets.
+ *
+ * A quantile forest (Meinshausen, "Quantile Regression Forests", JMLR 2006)
+ * weighs the targets of the leaf a row reaches in each tree by
+ * 1/(trees * leaf size) and reads quantiles off the weighted empirical
+ * distribution. Since every leaf is already sorted, predict_quantiles()
+ * does a k way merge over the reached leaves, stopping at the largest
+ * quantile asked for, instead of sorting their union.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/columnar_dataset.hpp>
+#include <random_forest/random_sample.hpp>
+#include <random_forest/matrix.hpp>
+#include <random_forest/parallel.hpp>
+
+//STL
+#include <vector>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+namespace ayasdi{
+namespace ml {
+
+class random_forest_regressor : public std::vector< decision_tree< double> > {
+public:
+ typedef decision_tree< double> tree;
+ random_forest_regressor( const rf_train_params& p=rf_train_params()): params_( p), leaf_offsets( 1, 0) {}
+
+ const rf_train_params& params() const { return params_; }
+
+ template< typename Datapoint,
+           typename = typename std::enable_if< !is_matrix_view< Datapoint>::value>::type>
+ double predict( const Datapoint& p) const{
+    double total = 0;
+    for( auto& t: (*this)){ total += t.vote( p); }
+    return empty() ? 0.0 : total/size();
+ }
+
+ template< typename T>
+ void predict( const Matrix_view< T>& X, double* out) const{
+    for( std::size_t i = 0; i < X.height(); ++i){ out[ i] = predict( X.row( i)); }
+ }
+
+ template< typename T>
+ std::vector< double> predict( const Matrix_view< T>& X) const{
+    std::vector< double> y( X.height());
+    predict( X, y.data());
+    return y;
+ }
+
+ /**
+ * Quantiles qs (each in [0, 1], any order) of the conditional
+ * distribution of the target at p, into out[ 0..qs.size()). Throws
+ * std::invalid_argument if a quantile is outside [0, 1].
+ */
+ template< typename Datapoint,
+           typename = typename std::enable_if< !is_matrix_view< Datapoint>::value>::type>
+ void predict_quantiles( const Datapoint& p, const std::vector< double>& qs, double* out) const{
+    const auto order = quantile_order( qs);
+    std::vector< run> runs;
+    std::vector< std::size_t> heap;
+    quantiles( p, qs, order, out, runs, heap);
+ }
+
+ /**
+ * Quantiles qs of every row of X, a row major X.height() by qs.size()
+ * matrix, with the rows spread over n_threads threads as in parallel_for().
+ */
+ template< typename T>
+ Matrix< double> predict_quantiles( const Matrix_view< T>& X, const std::vector< double>& qs, std::size_t n_threads=0) const{
+    const auto order = quantile_order( qs);
+    Matrix< double> result( X.height(), qs.size(), storage_order::row_major);
+    parallel_for( X.height(), n_threads, PREDICT_BLOCK_ROWS, [&]( std::size_t begin, std::size_t end){
+     std::vector< run> runs;
+     std::vector< std::size_t> heap;
+     for( std::size_t i = begin; i < end; ++i){ quantiles( X.row( i), qs, order, &result( i, 0), runs, heap); }
+    });
+    return result;
+ }
+
+ /**
+ * Stores the targets of a leaf's rows, sorted, and makes n its leaf.
+ */
+ void add_leaf_samples( tree& t, dtree_node& n, std::vector< float>& targets){
+    std::sort( targets.begin(), targets.end());
+    double mean = 0;
+    for( auto y: targets){ mean += y; }
+    t.generate_leaf_node( n, targets.empty() ? 0.0 : mean/targets.size());
+    n.split_ = leaf_offsets.size()-1;
+    samples.insert( samples.end(), targets.begin(), targets.end());
+    leaf_offsets.push_back( samples.size());
+ }
+
+ //Sorted targets of leaf n are samples[ leaf_offsets[ n.split_]..leaf_offsets[ n.split_+1])
+ const float* leaf_begin( const dtree_node& n) const { return samples.data() + leaf_offsets[ n.split_]; }
+ const float* leaf_end( const dtree_node& n) const { return samples.data() + leaf_offsets[ n.split_+1]; }
+
+ tree& insert_next_tree(){
+    this->emplace_back( 2*MAX_TREE_HEIGHT);
+    return this->back();
+ }
+
+ rf_train_params params_;
+ std::vector< std::size_t> leaf_offsets;
+ std::vector< float> samples;
+
+private:
+ //Positions of qs in increasing order, throws std::invalid_argument if one is outside [0, 1]
+ static std::vector< std::size_t> quantile_order( const std::vector< double>& qs){
+    for( auto q: qs){
+     if( !(q >= 0 && q <= 1)){ throw std::invalid_argument( "predict_quantiles: quantiles must lie in [0, 1]"); }
+    }
+    std::vector< std::size_t> order( qs.size());
+    std::iota( order.begin(), order.end(), 0);
+    std::sort( order.begin(), order.end(), [&]( std::size_t a, std::size_t b){ return qs[ a] < qs[ b]; });
+    return order;
+ }
+
+ struct run { const float* next; const float* end; double weight; };
+
+ /**
+ * k way merge of the sorted leaves p reaches, weighing each leaf's samples
+ * by 1/(trees * leaf size); out[ order[ k]] is the first sample at which the
+ * mass reaches qs[ order[ k]]. runs and heap are scratch.
+ */
+ template< typename Datapoint>
+ void quantiles( const Datapoint& p, const std::vector< double>& qs, const std::vector< std::size_t>& order,
+                 double* out, std::vector< run>& runs, std::vector< std::size_t>& heap) const{
+    runs.clear();
+    heap.clear();
+    for( auto& t: (*this)){
+     const auto& leaf = t.leaf( p);
+     const float* b = leaf_begin( leaf);
+     const float* e = leaf_end( leaf);
+     if( b != e){ runs.push_back( run{ b, e, 1.0/(e-b)}); }
+    }
+    if( runs.empty()){
+     for( std::size_t k = 0; k < qs.size(); ++k){ out[ k] = std::numeric_limits< double>::quiet_NaN(); }
+     return;
+    }
+    //Trees whose leaf kept no samples drop out, the rest share the mass equally
+    for( auto& r: runs){ r.weight /= runs.size(); }
+    auto later = [&]( std::size_t a, std::size_t b){ return *runs[ a].next > *runs[ b].next; };
+    for( std::size_t r = 0; r < runs.size(); ++r){ heap.push_back( r); }
+    std::make_heap( heap.begin(), heap.end(), later);
+    //Tolerate rounding in the sum of the weights
+    const double slack = 1e-9;
+    double mass = 0;
+    float value = 0;
+    std::size_t k = 0;
+    while( k < order.size() && !heap.empty()){
+     std::pop_heap( heap.begin(), heap.end(), later);
+     const std::size_t r = heap.back();
+     value = *runs[ r].next++;
+     mass += runs[ r].weight;
+     if( runs[ r].next != runs[ r].end){ std::push_heap( heap.begin(), heap.end(), later); }
+     else { heap.pop_back(); }
+     for( ; k < order.size() && mass + slack >= qs[ order[ k]]; ++k){ out[ order[ k]] = value; }
+    }
+    for( ; k < order.size(); ++k){ out[ order[ k]] = value; }
+ }
+}; //end class random_forest_regressor
+
+/**
+ * Grows the trees of a random_forest_regressor by variance reduction.
+ */
+class random_forest_regression_trainer {
+public:
+ typedef random_forest_regressor::tree tree;
+ typedef std::pair< double, double> Split; //threshold, sum of squared errors
+
+ explicit random_forest_regression_trainer( random_forest_regressor& rf_): rf( rf_), gen( rf_.params().random_seed) {}
+
+ //Throws std::invalid_argument if the dataset has no rows
+ template< typename Output>
+ void fit( const columnar_dataset& dataset, const Output& output){
+  if( !dataset.height()){ throw std::invalid_argument( "fit: the dataset has no rows"); }
+  const auto& params = rf.params();
+  rf.reserve( rf.size()+params.n_estimators);
+  for( std::size_t i = 0; i < params.n_estimators; ++i){
+   auto& current_tree = rf.insert_next_tree();
+   current_tree.insert_root();
+   std::vector< std::size_t> row_indices;
+   random_shuffle_range( 0, dataset.height(), row_indices, gen);
+   std::size_t row_subset_size = dataset.height();
+   if( params.bootstrap){ row_subset_size = std::ceil( params.row_fraction_size*dataset.height()); }
+   build_tree( row_indices.begin(), row_indices.begin()+row_subset_size, dataset, output, current_tree, 0, 0);
+  }
+ }
+
+private:
+ std::size_t max_tree_depth() const {
+  return rf.params().max_depth ? rf.params().max_depth : MAX_TREE_HEIGHT;
+ }
+
+ /**
+ * Best threshold of one column over the rows [begin, end) by the sum of
+ * squared errors of the two sides. Sorts the rows by the column, missing
+ * values last, which always go right.
+ */
+ template< typename T, typename Row_index_iterator, typename Output>
+ Split find_best_column_split( const column_view< T>& column, Row_index_iterator begin, Row_index_iterator end,
+                               const Output& output){
+  sort_rows( column, begin, end, marks);
+  const std::size_t n = std::distance( begin, end);
+  const std::size_t min_leaf = std::max< std::size_t>( 1, rf.params().min_samples_leaf);
+  double total = 0, total_squares = 0;
+  for( auto i = begin; i != end; ++i){ total += output[ *i]; total_squares += output[ *i]*output[ *i]; }
+  double lower = 0, lower_squares = 0;
+  Split best( 0, std::numeric_limits< double>::infinity());
+  for( std::size_t k = 1; k < n; ++k){
+   const double y = output[ begin[ k-1]];
+   lower += y; lower_squares += y*y;
+   if( std::isnan( (double)column[ begin[ k]])){ break; }
+   if( column[ begin[ k]] == column[ begin[ k-1]]){ continue; }
+   if( k < min_leaf || n-k < min_leaf){ continue; }
+   const double upper = total-lower, upper_squares = total_squares-lower_squares;
+   const double sse = (lower_squares - lower*lower/k) + (upper_squares - upper*upper/(n-k));
+   if( sse < best.second){ best = Split( column[ begin[ k]], sse); }
+  }
+  return best;
+ }
+
+ template< typename Row_index_iterator, typename Output>
+ void make_leaf( Row_index_iterator begin, Row_index_iterator end, const Output& output, tree& t, std::size_t node_index){
+  targets.clear();
+  for( auto i = begin; i != end; ++i){ targets.push_back( output[ *i]); }
+  rf.add_leaf_samples( t, t[ node_index], targets);
+ }
+
+ template< typename Row_index_iterator, typename Output>
+ void build_tree( Row_index_iterator begin, Row_index_iterator end, const columnar_dataset& dataset,
+                  const Output& output, tree& t, std::size_t node_index, std::size_t height){
+  const auto& params = rf.params();
+  const std::size_t n = std::distance( begin, end);
+  t.set_cover( node_index, n);
+  if( height >= max_tree_depth() || n < std::max< std::size_t>( 2, params.min_samples_split)){
+   make_leaf( begin, end, output, t, node_index);
+   return;
+  }
+  std::vector< std::size_t> columns;
+  random_subset_size_k( 0, dataset.width(), features_per_split( params, dataset.width()), columns, gen);
+  Split best( 0, std::numeric_limits< double>::infinity());
+  std::size_t best_column = 0;
+  for( auto column: columns){
+   const Split split = visit( dataset.column( column), [&]( const auto& view){
+    return this->find_best_column_split( view, begin, end, output);
+   });
+   if( split.second < best.second){ best = split; best_column = column; }
+  }
+  if( best.second == std::numeric_limits< double>::infinity()){
+   make_leaf( begin, end, output, t, node_index);
+   return;
+  }
+  t.set_split( t[ node_index], best_column, best.first);
+  const auto& split_column = dataset.column( best_column);
+  auto middle = std::partition( begin, end, [&]( std::size_t a){ return split_column[ a] < best.first; });
+  t.insert_children( t[ node_index]);
+  const std::size_t left_child = t[ node_index].left_child_index();
+  const std::size_t right_child = t[ node_index].right_child_index();
+  build_tree( begin, middle, dataset, output, t, left_child, height+1);
+  build_tree( middle, end, dataset, output, t, right_child, height+1);
+ }
+
+ random_forest_regressor& rf;
+ std::mt19937 gen;
+ std::vector< float> targets;
+ std::vector< std::uint8_t> marks;
+}; //end class random_forest_regression_trainer
+
+/**
+ * Trains rf on a columnar dataset, output[ i] is the target of row i.
+ * Throws std::invalid_argument if the dataset has no rows.
+ */
+template< typename Output>
+void fit( random_forest_regressor& rf, const columnar_dataset& dataset, const Output& output){
+ random_forest_regression_trainer trainer( rf);
+ trainer.fit( dataset, output);
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -0,0 +1,257 @@
+#pragma once
+/**
+ * Native binary serialization of a random_forest_classifier.
+ *
+ * Unlike a model file (model_file.hpp), which holds the frozen traversal
+ * arrays, this keeps everything a trained forest carries: the training
+ * parameters, the nodes of every tree with their leaf class distributions
+ * and node covers, the out of bag scores and the feature importances. A
+ * deserialized forest compares equal tree by tree and predicts identically.
+ *
+ * Layout, all little endian, no padding:
+ *
+ *   magic "RFFOREST", format version (uint32), byte order tag 0x01020304,
+ *   number of trees and classes (uint64),
+ *   the scalar parameters then criterion and max_features as strings,
+ *   oob scores, feature importances, permutation importances,
+ *   then for every tree: its nodes as (split uint64, split value double,
+ *   left int32, right int32), the distribution class count (uint64), the
+ *   leaf distributions (float) and the node covers (double).
+ *
+ * Strings and arrays are a uint64 element count followed by the elements.
+ * Reading checks every count and child index against the input, so a
+ * truncated or corrupt image throws std::runtime_error instead of producing
+ * a forest that walks out of bounds.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/decision_tree.hpp>
+
+//STL
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <cstdint>
+#include <cstring> //memcpy, memcmp
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+namespace ayasdi{
+namespace ml {
+
+constexpr std::uint32_t forest_format_version = 1;
+
+namespace detail {
+
+constexpr char forest_magic[ 8] = { 'R', 'F', 'F', 'O', 'R', 'E', 'S', 'T' };
+constexpr std::uint32_t forest_byte_order = 0x01020304;
+
+class forest_serializer {
+public:
+ template< typename Label_type>
+ static std::string write( const random_forest_classifier< Label_type>& forest){
+     if( !little_endian()){ throw std::runtime_error( "serialize: big endian hosts are not supported"); }
+     std::string out;
+     out.append( forest_magic, sizeof( forest_magic));
+     put( out, forest_format_version);
+     put( out, forest_byte_order);
+     put( out, (std::uint64_t)forest.size());
+     put( out, (std::uint64_t)forest.n_classes_);
+     const rf_train_params& p = forest.params_;
+     for( std::uint64_t v: { p.n_estimators, p.max_depth, p.min_samples_split, p.min_samples_leaf,
+                             p.min_weight_fraction_leaf, p.max_leaf_nodes}){ put( out, v); }
+     put( out, p.min_impurity_split);
+     put( out, p.row_fraction_size);
+     for( std::uint8_t v: { p.bootstrap, p.oob_score, p.permutation_importance}){ put( out, v); }
+     put( out, (std::int32_t)p.random_seed);
+     put( out, (std::int32_t)p.verbose);
+     put_array( out, p.criterion);
+     put_array( out, p.max_features);
+     put_array( out, forest.oob_scores_);
+     put_array( out, forest.feature_importances_);
+     put_array( out, forest.permutation_importances_);
+     for( auto& t: forest){
+      put( out, (std::uint64_t)t.tree_nodes.size());
+      for( auto& n: t.tree_nodes){
+       put( out, (std::uint64_t)n.split_);
+       put( out, n.split_value_);
+       put( out, (std::int32_t)n.left_child_index_);
+       put( out, (std::int32_t)n.right_child_index_);
+      }
+      put( out, (std::uint64_t)t.n_distribution_classes);
+      put_array( out, t.distributions);
+      put_array( out, t.covers);
+     }
+     return out;
+ }
+
+ template< typename Label_type>
+ static random_forest_classifier< Label_type> read( const void* data, std::size_t size){
+     if( !little_endian()){ throw std::runtime_error( "deserialize: big endian hosts are not supported"); }
+     reader in{ static_cast< const char*>( data), static_cast< const char*>( data) + size };
+     char magic[ sizeof( forest_magic)];
+     in.bytes( magic, sizeof( magic));
+     if( std::memcmp( magic, forest_magic, sizeof( magic)) || in.get< std::uint32_t>() != forest_format_version ||
+         in.get< std::uint32_t>() != forest_byte_order){
+      throw std::runtime_error( "deserialize: not a serialized forest of this format version");
+     }
+     const std::uint64_t n_trees = in.get< std::uint64_t>();
+     const std::uint64_t n_classes = in.get< std::uint64_t>();
+     rf_train_params p;
+     p.n_estimators = in.get< std::uint64_t>();
+     p.max_depth = in.get< std::uint64_t>();
+     p.min_samples_split = in.get< std::uint64_t>();
+     p.min_samples_leaf = in.get< std::uint64_t>();
+     p.min_weight_fraction_leaf = in.get< std::uint64_t>();
+     p.max_leaf_nodes = in.get< std::uint64_t>();
+     p.min_impurity_split = in.get< double>();
+     p.row_fraction_size = in.get< double>();
+     p.bootstrap = in.get< std::uint8_t>();
+     p.oob_score = in.get< std::uint8_t>();
+     p.permutation_importance = in.get< std::uint8_t>();
+     p.random_seed = in.get< std::int32_t>();
+     p.verbose = in.get< std::int32_t>();
+     in.array( p.criterion);
+     in.array( p.max_features);
+     random_forest_classifier< Label_type> forest( p);
+     forest.n_classes_ = n_classes;
+     in.array( forest.oob_scores_);
+     in.array( forest.feature_importances_);
+     in.array( forest.permutation_importances_);
+     //Every tree takes at least its fixed size fields, bounding the reserve
+     if( n_trees > in.remaining()/32){ throw std::runtime_error( "deserialize: truncated forest"); }
+     forest.reserve( n_trees);
+     for( std::uint64_t k = 0; k < n_trees; ++k){
+      forest.emplace_back( 0);
+      auto& t = forest.back();
+      const std::uint64_t n_nodes = in.count( 24);
+      t.tree_nodes.resize( n_nodes);
+      for( auto& n: t.tree_nodes){
+       n.split_ = in.get< std::uint64_t>();
+       n.split_value_ = in.get< double>();
+       n.left_child_index_ = in.get< std::int32_t>();
+       n.right_child_index_ = in.get< std::int32_t>();
+      }
+      t.n_distribution_classes = in.get< std::uint64_t>();
+      in.array( t.distributions);
+      in.array( t.covers);
+      check( t, n_classes);
+     }
+     if( in.remaining()){ throw std::runtime_error( "deserialize: trailing bytes after the forest"); }
+     return forest;
+ }
+
+private:
+ struct reader {
+  const char* p;
+  const char* end;
+
+  std::size_t remaining() const { return end-p; }
+  void bytes( void* to, std::size_t n){
+      if( n > remaining()){ throw std::runtime_error( "deserialize: truncated forest"); }
+      std::memcpy( to, p, n);
+      p += n;
+  }
+  template< typename T>
+  T get(){ T v; bytes( &v, sizeof( v)); return v; }
+  //An element count, checked against the bytes left
+  std::uint64_t count( std::size_t element_size){
+      const std::uint64_t n = get< std::uint64_t>();
+      if( n > remaining()/element_size){ throw std::runtime_error( "deserialize: truncated forest"); }
+      return n;
+  }
+  template< typename Array>
+  void array( Array& a){
+      a.resize( count( sizeof( typename Array::value_type)));
+      if( a.size()){ bytes( &a[ 0], a.size()*sizeof( typename Array::value_type)); }
+  }
+ };
+
+ template< typename T>
+ static void put( std::string& out, T v){ out.append( reinterpret_cast< const char*>( &v), sizeof( v)); }
+
+ template< typename Array>
+ static void put_array( std::string& out, const Array& a){
+     put( out, (std::uint64_t)a.size());
+     out.append( reinterpret_cast< const char*>( a.data()), a.size()*sizeof( typename Array::value_type));
+ }
+
+ //Children in range, and leaf payloads inside the distributions
+ template< typename Label_type>
+ static void check( const decision_tree< Label_type>& t, std::uint64_t n_classes){
+     const std::size_t n = t.tree_nodes.size();
+     if( t.distributions.size() && (t.n_distribution_classes < std::max< std::uint64_t>( 1, n_classes) ||
+                                    t.distributions.size() % t.n_distribution_classes)){
+      throw std::runtime_error( "deserialize: corrupt leaf distributions");
+     }
+     if( t.covers.size() && t.covers.size() != n){ throw std::runtime_error( "deserialize: corrupt node covers"); }
+     for( std::size_t i = 0; i < n; ++i){
+      const auto& node = t.tree_nodes[ i];
+      if( node.is_leaf()){
+       if( t.distributions.size() && node.split_ >= t.distributions.size()/t.n_distribution_classes){
+        throw std::runtime_error( "deserialize: corrupt leaf distributions");
+       }
+       //Every leaf votes by its label, with or without distributions
+       if( !(node.split_value_ >= 0 && node.split_value_ < n_classes)){
+        throw std::runtime_error( "deserialize: leaf label out of range");
+       }
+       continue;
+      }
+      //Trainers and layouts always place children after their parent, which also rules out cycles
+      if( node.left_child_index_ <= (long)i || node.right_child_index_ <= (long)i ||
+          (std::size_t)node.left_child_index_ >= n || (std::size_t)node.right_child_index_ >= n){
+       throw std::runtime_error( "deserialize: child index out of range");
+      }
+     }
+ }
+
+ static bool little_endian(){
+     const std::uint32_t x = forest_byte_order;
+     unsigned char first;
+     std::memcpy( &first, &x, 1);
+     return first == 0x04;
+ }
+}; //end class forest_serializer
+
+} //end namespace detail
+
+/**
+ * The forest as a byte string, see the top of this file.
+ */
+template< typename Label_type>
+std::string serialize( const random_forest_classifier< Label_type>& forest){
+ return detail::forest_serializer::write( forest);
+}
+
+/**
+ * The forest serialized in the size bytes at data. Throws
+ * std::runtime_error if they are not a complete, valid serialized forest.
+ */
+template< typename Label_type>
+random_forest_classifier< Label_type> deserialize( const void* data, std::size_t size){
+ return detail::forest_serializer::read< Label_type>( data, size);
+}
+
+template< typename Label_type>
+void save_forest( const random_forest_classifier< Label_type>& forest, const std::string& path){
+ std::ofstream out( path, std::ios::binary | std::ios::trunc);
+ if( !out){ throw std::system_error( errno, std::generic_category(), "save_forest: " + path); }
+ const std::string bytes = serialize( forest);
+ out.write( bytes.data(), bytes.size());
+ if( !out){ throw std::runtime_error( "save_forest: write failed"); }
+}
+
+template< typename Label_type>
+random_forest_classifier< Label_type> load_forest( const std::string& path){
+ std::ifstream in( path, std::ios::binary);
+ if( !in){ throw std::system_error( errno, std::generic_category(), "load_forest: " + path); }
+ const std::string bytes( (std::istreambuf_iterator< char>( in)), std::istreambuf_iterator< char>());
+ return deserialize< Label_type>( bytes.data(), bytes.size());
+}
+
+} //end namespace ml
+} //end namespace ayasdi
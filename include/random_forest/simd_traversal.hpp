@@ -0,0 +1,276 @@
+#pragma once
+/**
+ * SIMD traversal of a compact_forest, several rows through one tree at once.
+ *
+ * Each vector lane holds the current node of one row. A step gathers the
+ * threshold and feature/offset words of every lane's node, gathers each
+ * row's value of that feature, compares, and moves every lane that has not
+ * reached a leaf to its left child (the next node) or right child (node +
+ * right_offset). Lanes at a leaf are masked out of both the value gather
+ * and the update; the loop ends when no lane is active. Far splits cost
+ * one more gather, of their extension node, only in steps where a lane
+ * reaches one.
+ *
+ *   avx2:   8 rows per pass
+ *   avx512: 16 rows per pass (AVX-512F)
+ *
+ * The kernels are compiled with target attributes, so no -mavx flags are
+ * needed, and the level is picked at run time from the CPU. Anything the
+ * kernels do not cover (element types other than float and double,
+ * offsets beyond 32 bits, other compilers or architectures) takes the
+ * scalar compact_forest_view::leaf() path, and results are identical.
+ */
+
+//Project
+#include <random_forest/compact_forest.hpp>
+#include <random_forest/matrix.hpp>
+
+//STL
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RF_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define RF_SIMD_X86 0
+#endif
+
+namespace ayasdi{
+namespace ml {
+
+enum class simd_level { scalar, avx2, avx512 };
+
+/**
+ * Widest level supported by this CPU, detected once.
+ */
+inline simd_level best_simd_level(){
+ static const simd_level level = [](){
+  #if RF_SIMD_X86
+  __builtin_cpu_init();
+  if( __builtin_cpu_supports( "avx512f")){ return simd_level::avx512; }
+  if( __builtin_cpu_supports( "avx2")){ return simd_level::avx2; }
+  #endif
+  return simd_level::scalar;
+ }();
+ return level;
+}
+
+namespace detail {
+
+template< typename T>
+struct simd_value : std::integral_constant< bool, std::is_same< T, float>::value || std::is_same< T, double>::value> {};
+
+#if RF_SIMD_X86
+
+__attribute__((target("avx2")))
+inline __m256i less_than_avx2( const double* base, __m256i idx, __m256i active, __m256i threshold_bits){
+ const __m256 threshold = _mm256_castsi256_ps( threshold_bits);
+ const __m256d t0 = _mm256_cvtps_pd( _mm256_castps256_ps128( threshold));
+ const __m256d t1 = _mm256_cvtps_pd( _mm256_extractf128_ps( threshold, 1));
+ const __m256i m0 = _mm256_cvtepi32_epi64( _mm256_castsi256_si128( active));
+ const __m256i m1 = _mm256_cvtepi32_epi64( _mm256_extracti128_si256( active, 1));
+ const __m256d x0 = _mm256_mask_i32gather_pd( _mm256_setzero_pd(), base, _mm256_castsi256_si128( idx), _mm256_castsi256_pd( m0), 8);
+ const __m256d x1 = _mm256_mask_i32gather_pd( _mm256_setzero_pd(), base, _mm256_extracti128_si256( idx, 1), _mm256_castsi256_pd( m1), 8);
+ const int lt = _mm256_movemask_pd( _mm256_cmp_pd( x0, t0, _CMP_LT_OQ)) |
+               (_mm256_movemask_pd( _mm256_cmp_pd( x1, t1, _CMP_LT_OQ)) << 4);
+ const __m256i bits = _mm256_setr_epi32( 1, 2, 4, 8, 16, 32, 64, 128);
+ return _mm256_cmpeq_epi32( _mm256_and_si256( _mm256_set1_epi32( lt), bits), bits);
+}
+
+__attribute__((target("avx2")))
+inline __m256i less_than_avx2( const float* base, __m256i idx, __m256i active, __m256i threshold_bits){
+ const __m256 x = _mm256_mask_i32gather_ps( _mm256_setzero_ps(), base, idx, _mm256_castsi256_ps( active), 4);
+ return _mm256_castps_si256( _mm256_cmp_ps( x, _mm256_castsi256_ps( threshold_bits), _CMP_LT_OQ));
+}
+
+/**
+ * Node index, within nodes, of the leaf reached by each of the n rows at
+ * base + i*row_stride, starting from node root.
+ */
+template< typename T>
+__attribute__((target("avx2")))
+void walk_avx2( const compact_node* nodes, std::uint32_t root, const T* base,
+                std::size_t row_stride, std::size_t col_stride, std::size_t n, std::uint32_t* reached){
+ const int* words = reinterpret_cast< const int*>( nodes);
+ const __m256i lane = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7);
+ const __m256i one = _mm256_set1_epi32( 1);
+ const __m256i two = _mm256_set1_epi32( 2);
+ const __m256i low16 = _mm256_set1_epi32( 0xFFFF);
+ const __m256i cs = _mm256_set1_epi32( (int)col_stride);
+ for( std::size_t g = 0; g < n; g += 8){
+  const __m256i rows = _mm256_add_epi32( _mm256_set1_epi32( (int)g), lane);
+  const __m256i valid = _mm256_cmpgt_epi32( _mm256_set1_epi32( (int)n), rows);
+  const __m256i row_base = _mm256_mullo_epi32( rows, _mm256_set1_epi32( (int)row_stride));
+  __m256i node = _mm256_set1_epi32( (int)root);
+  for( ;;){
+   const __m256i word = _mm256_slli_epi32( node, 1);
+   const __m256i threshold_bits = _mm256_i32gather_epi32( words, word, 4);
+   const __m256i meta = _mm256_i32gather_epi32( words, _mm256_add_epi32( word, one), 4);
+   const __m256i feature = _mm256_and_si256( meta, low16);
+   const __m256i active = _mm256_andnot_si256( _mm256_cmpeq_epi32( feature, low16), valid);
+   if( _mm256_testz_si256( active, active)){ break; }
+   const __m256i idx = _mm256_add_epi32( row_base, _mm256_mullo_epi32( feature, cs));
+   const __m256i lt = less_than_avx2( base, idx, active, threshold_bits);
+   __m256i right = _mm256_srli_epi32( meta, 16), left = one;
+   const __m256i far = _mm256_and_si256( _mm256_cmpeq_epi32( right, low16), active);
+   if( !_mm256_testz_si256( far, far)){
+    right = _mm256_mask_i32gather_epi32( right, words, _mm256_add_epi32( word, two), far, 4);
+    left = _mm256_blendv_epi8( one, two, far);
+   }
+   const __m256i step = _mm256_blendv_epi8( right, left, lt);
+   node = _mm256_add_epi32( node, _mm256_and_si256( step, active));
+  }
+  alignas( 32) std::uint32_t out[ 8];
+  _mm256_store_si256( reinterpret_cast< __m256i*>( out), node);
+  std::copy( out, out + std::min< std::size_t>( 8, n-g), reached+g);
+ }
+}
+
+__attribute__((target("avx512f")))
+inline __mmask16 less_than_avx512( const double* base, __m512i idx, __mmask16 active, __m512i threshold_bits){
+ //Masked forms throughout: the unmasked ones start from an undefined register, which GCC warns about
+ const __mmask8 lo = (__mmask8)active, hi = (__mmask8)(active >> 8);
+ const __m512d t0 = _mm512_maskz_cvtps_pd( lo, _mm256_castsi256_ps( _mm512_maskz_extracti64x4_epi64( 0xF, threshold_bits, 0)));
+ const __m512d t1 = _mm512_maskz_cvtps_pd( hi, _mm256_castsi256_ps( _mm512_maskz_extracti64x4_epi64( 0xF, threshold_bits, 1)));
+ const __m512d x0 = _mm512_mask_i32gather_pd( _mm512_setzero_pd(), lo, _mm512_maskz_extracti64x4_epi64( 0xF, idx, 0), base, 8);
+ const __m512d x1 = _mm512_mask_i32gather_pd( _mm512_setzero_pd(), hi, _mm512_maskz_extracti64x4_epi64( 0xF, idx, 1), base, 8);
+ return (__mmask16)( _mm512_cmp_pd_mask( x0, t0, _CMP_LT_OQ) | (_mm512_cmp_pd_mask( x1, t1, _CMP_LT_OQ) << 8));
+}
+
+__attribute__((target("avx512f")))
+inline __mmask16 less_than_avx512( const float* base, __m512i idx, __mmask16 active, __m512i threshold_bits){
+ const __m512 x = _mm512_mask_i32gather_ps( _mm512_setzero_ps(), active, idx, base, 4);
+ return _mm512_cmp_ps_mask( x, _mm512_castsi512_ps( threshold_bits), _CMP_LT_OQ);
+}
+
+template< typename T>
+__attribute__((target("avx512f")))
+void walk_avx512( const compact_node* nodes, std::uint32_t root, const T* base,
+                  std::size_t row_stride, std::size_t col_stride, std::size_t n, std::uint32_t* reached){
+ const int* words = reinterpret_cast< const int*>( nodes);
+ const __m512i lane = _mm512_set_epi32( 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+ const __m512i one = _mm512_set1_epi32( 1);
+ const __m512i two = _mm512_set1_epi32( 2);
+ const __m512i low16 = _mm512_set1_epi32( 0xFFFF);
+ const __m512i cs = _mm512_set1_epi32( (int)col_stride);
+ for( std::size_t g = 0; g < n; g += 16){
+  const __m512i rows = _mm512_add_epi32( _mm512_set1_epi32( (int)g), lane);
+  const __mmask16 valid = _mm512_cmpgt_epi32_mask( _mm512_set1_epi32( (int)n), rows);
+  const __m512i row_base = _mm512_mullo_epi32( rows, _mm512_set1_epi32( (int)row_stride));
+  __m512i node = _mm512_set1_epi32( (int)root);
+  for( ;;){
+   //Masked gathers and shifts with zero sources, see less_than_avx512()
+   const __m512i word = _mm512_maskz_slli_epi32( valid, node, 1);
+   const __m512i threshold_bits = _mm512_mask_i32gather_epi32( _mm512_setzero_si512(), valid, word, words, 4);
+   const __m512i meta = _mm512_mask_i32gather_epi32( _mm512_setzero_si512(), valid, _mm512_add_epi32( word, one), words, 4);
+   const __m512i feature = _mm512_and_si512( meta, low16);
+   const __mmask16 active = _mm512_mask_cmpneq_epi32_mask( valid, feature, low16);
+   if( !active){ break; }
+   const __m512i idx = _mm512_add_epi32( row_base, _mm512_mullo_epi32( feature, cs));
+   const __mmask16 lt = less_than_avx512( base, idx, active, threshold_bits);
+   __m512i right = _mm512_maskz_srli_epi32( active, meta, 16), left = one;
+   const __mmask16 far = _mm512_mask_cmpeq_epi32_mask( active, right, low16);
+   if( far){
+    right = _mm512_mask_i32gather_epi32( right, far, _mm512_add_epi32( word, two), words, 4);
+    left = _mm512_mask_blend_epi32( far, one, two);
+   }
+   const __m512i step = _mm512_mask_blend_epi32( lt, right, left);
+   node = _mm512_mask_add_epi32( node, active, node, step);
+  }
+  alignas( 64) std::uint32_t out[ 16];
+  _mm512_store_si512( out, node);
+  std::copy( out, out + std::min< std::size_t>( 16, n-g), reached+g);
+ }
+}
+
+#endif //RF_SIMD_X86
+
+/**
+ * True if every node index and element offset of the block fits the
+ * 32 bit gather indices.
+ */
+template< typename Label_type, typename T>
+bool fits_gather( const compact_forest_view< Label_type>& f, const Matrix_view< T>& X, std::size_t rows){
+ const std::uint64_t limit = std::numeric_limits< std::int32_t>::max();
+ if( 2*f.tree_offsets[ f.n_trees] + 1 > limit){ return false; }
+ if( X.col_stride() > limit || X.row_stride() > limit){ return false; }
+ const std::uint64_t last = (std::uint64_t)(rows ? rows-1 : 0)*X.row_stride() +
+                            (std::uint64_t)(X.width() ? X.width()-1 : 0)*X.col_stride();
+ return last <= limit;
+}
+
+template< typename Label_type, typename T>
+bool tree_leaves_simd( const compact_forest_view< Label_type>& f, std::size_t t, const Matrix_view< T>& X,
+                       std::size_t begin, std::size_t end, std::uint32_t* leaves, simd_level level, std::true_type){
+ #if RF_SIMD_X86
+ if( level == simd_level::scalar || !fits_gather( f, X, end-begin)){ return false; }
+ const std::uint32_t root = f.tree_offsets[ t];
+ const T* base = &X( begin, 0);
+ if( level == simd_level::avx512){ walk_avx512( f.nodes, root, base, X.row_stride(), X.col_stride(), end-begin, leaves); }
+ else { walk_avx2( f.nodes, root, base, X.row_stride(), X.col_stride(), end-begin, leaves); }
+ for( std::size_t i = 0; i < end-begin; ++i){ leaves[ i] = f.nodes[ leaves[ i]].leaf_index(); }
+ return true;
+ #else
+ return false;
+ #endif
+}
+
+template< typename Label_type, typename T>
+bool tree_leaves_simd( const compact_forest_view< Label_type>&, std::size_t, const Matrix_view< T>&,
+                       std::size_t, std::size_t, std::uint32_t*, simd_level, std::false_type){ return false; }
+
+} //end namespace detail
+
+/**
+ * Leaf indices (into f.leaf_labels) reached in tree t by rows [begin, end) of X,
+ * written to leaves[ 0..end-begin). level is capped at best_simd_level().
+ */
+template< typename Label_type, typename T>
+void tree_leaves( const compact_forest_view< Label_type>& f, std::size_t t, const Matrix_view< T>& X,
+                  std::size_t begin, std::size_t end, std::uint32_t* leaves, simd_level level=best_simd_level()){
+ level = std::min( level, best_simd_level());
+ if( begin == end || detail::tree_leaves_simd( f, t, X, begin, end, leaves, level,
+                                                detail::simd_value< typename std::remove_const< T>::type>())){ return; }
+ for( std::size_t i = begin; i < end; ++i){ leaves[ i-begin] = f.leaf( t, X.row( i)); }
+}
+
+/**
+ * Labels of every row of X into out, as compact_forest_view::predict(),
+ * traversing PREDICT_BLOCK_ROWS rows per tree with the SIMD kernels.
+ */
+template< typename Label_type, typename T>
+void simd_predict( const compact_forest_view< Label_type>& f, const Matrix_view< T>& X, Label_type* out,
+                   simd_level level=best_simd_level()){
+ const std::size_t n_classes = f.n_classes;
+ std::vector< std::uint32_t> block_votes( PREDICT_BLOCK_ROWS*n_classes);
+ std::vector< std::uint32_t> leaves( PREDICT_BLOCK_ROWS);
+ for( std::size_t begin = 0; begin < X.height(); begin += PREDICT_BLOCK_ROWS){
+  const std::size_t end = std::min< std::size_t>( X.height(), begin+PREDICT_BLOCK_ROWS);
+  std::fill( block_votes.begin(), block_votes.end(), 0);
+  for( std::size_t t = 0; t < f.n_trees; ++t){
+   tree_leaves( f, t, X, begin, end, leaves.data(), level);
+   for( std::size_t i = begin; i < end; ++i){
+    block_votes[ (i-begin)*n_classes + (std::size_t)f.leaf_labels[ leaves[ i-begin]]]++;
+   }
+  }
+  for( std::size_t i = begin; i < end; ++i){
+   auto row_votes = block_votes.begin() + (i-begin)*n_classes;
+   out[ i] = std::max_element( row_votes, row_votes+n_classes) - row_votes;
+  }
+ }
+}
+
+template< typename Label_type, typename T>
+std::vector< Label_type> simd_predict( const compact_forest< Label_type>& f, const Matrix_view< T>& X,
+                                       simd_level level=best_simd_level()){
+ std::vector< Label_type> labels( X.height());
+ simd_predict( f.view(), X, labels.data(), level);
+ return labels;
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -5,17 +5,83 @@
 #ifndef RANDOM_FOREST_TRAIN_RF_HPP
 #define RANDOM_FOREST_TRAIN_RF_HPP
 
-#include <random_forest.hpp>
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/columnar_dataset.hpp>
+#include <random_forest/matrix.hpp>
+#include <random_forest/parallel.hpp>
 
+//STL
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <numeric> //accumulate
+#include <random>
+#include <cmath>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <stdexcept>
 
-template< typename Row_index_iterator>
-bool is_pure_column( Row_index_iterator begin, Row_index_iterator end, Output& output){
+namespace ayasdi{
+namespace ml{
+
+/**
+ * Progress of a fit(), written by the training thread and readable from
+ * any other. cancel() asks the trainer to stop: it checks between node
+ * expansions, drops the tree it was growing and returns with the trees
+ * completed so far, a usable partial forest.
+ */
+class training_progress {
+public:
+ training_progress(): cancelled_( false), trees_completed_( 0) {}
+
+ void cancel(){ cancelled_ = true; }
+ bool cancelled() const { return cancelled_; }
+
+ std::size_t trees_completed() const { return trees_completed_; }
+
+ //Out of bag error of the completed trees, pooled: the off diagonal fraction of the
+ //confusion matrix of every tree's out of bag votes; NaN before the first
+ double oob_error() const {
+     std::lock_guard< std::mutex> lock( mutex_);
+     return oob_error_;
+ }
+
+ //Wall clock seconds spent on each completed tree
+ std::vector< double> tree_seconds() const {
+     std::lock_guard< std::mutex> lock( mutex_);
+     return tree_seconds_;
+ }
+
+ //Called by the trainer after every tree
+ void tree_completed( double seconds, double oob_error){
+     {
+      std::lock_guard< std::mutex> lock( mutex_);
+      tree_seconds_.push_back( seconds);
+      oob_error_ = oob_error;
+     }
+     ++trees_completed_;
+ }
+
+private:
+ std::atomic< bool> cancelled_;
+ std::atomic< std::size_t> trees_completed_;
+ mutable std::mutex mutex_;
+ double oob_error_ = std::numeric_limits< double>::quiet_NaN();
+ std::vector< double> tree_seconds_;
+}; //end class training_progress
+
+namespace detail { struct fit_cancelled {}; }
+
+template< typename Row_index_iterator, typename Output>
+bool is_pure_column( Row_index_iterator begin, Row_index_iterator end, const Output& output){
  const auto& first_v = output[ *begin];
- return std::all_of(begin, end, [&]( const auto& i ){ return r==output[i]; } );
+ return std::all_of(begin, end, [&]( const std::size_t& i ){ return first_v==output[i]; } );
 }
 
 template< typename Counts>
-inline double entropy( const Counts& counts, std::size_t& n){
+inline double entropy( const Counts& counts, std::size_t n){
  double denominator = 1.0/n;
  double entropy=0.0;
  for( const auto& q: counts){
@@ -26,234 +92,432 @@ inline double entropy( const Counts& counts, std::size_t& n){
 }
 
 template< typename Counts>
-inline double balanced_entropy( Counts& lower_counts, Counts& upper_counts,
-                                std::size_t lower_index, std::size_t upper_index,
-                                std::size_t number_of_rows){
- double lower_entropy = entropy( lower_counts, lower_index);
- double upper_entropy = entropy( upper_counts, upper_index);
- return ((1.0/lower_index)*lower_entropy + (1.0/(upper_index))*upper_entropy)/number_of_rows;
+inline double gini( const Counts& counts, std::size_t n){
+ double denominator = 1.0/n;
+ double gini=1.0;
+ for( const auto& q: counts){
+  const double p = (double)q*denominator;
+  gini -= p*p;
+ }
+ return gini;
 }
 
-
-template< typename Row_index_iterator>
-Label_type get_majority_vote( Row_index_iterator begin, Row_index_iterator end, Output& output){
- std::fill( votes_.begin(), votes_.end(), 0);
- for( ; begin != end; ++begin){ votes_[ output[ *begin]]++; }
- 
- typedef typename Map::value_type pair;
- auto max_elt= std::max_element( votes_.begin(), votes_.end());
- return std::distance( votes_.begin(), max_elt);
+/**
+ * Impurity of a split weighted by the size of each side
+ */
+template< typename Counts>
+inline double split_impurity( const Counts& lower_counts, const Counts& upper_counts,
+                              std::size_t lower_index, std::size_t upper_index,
+                              bool use_gini){
+ const double lower = use_gini ? gini( lower_counts, lower_index) : entropy( lower_counts, lower_index);
+ const double upper = use_gini ? gini( upper_counts, upper_index) : entropy( upper_counts, upper_index);
+ return (lower_index*lower + upper_index*upper)/(lower_index+upper_index);
 }
 
-template< typename Row_index_iterator>
-Label_type get_majority_vote( Row_index_iterator begin, Row_index_iterator end,
-                              Row_index_iterator oob_begin, Row_index_iterator oob_end,
-                              Output& output){
- std::fill( votes_.begin(), votes_.end(), 0);
- for( ; begin != end; ++begin){ votes_[ output[ *begin]]++; }
- for( ; oob_begin != oob_end; ++oob_begin){ votes_[ output[ *oob_begin]]++; }
- 
- typedef typename Map::value_type pair;
- auto max_elt= std::max_element( votes_.begin(), votes_.end());
- return std::distance( votes_.begin(), max_elt);
-}
+template< typename Label_type>
+class random_forest_trainer {
+public:
+ typedef random_forest_classifier< Label_type> forest;
+ typedef typename forest::tree tree;
+ typedef std::vector< std::size_t> Map;
+ typedef std::pair< double, double> Split; //threshold, impurity
 
+ random_forest_trainer( forest& rf_, std::size_t n_classes):
+ rf( rf_), votes_( n_classes), lower_counts( n_classes), upper_counts( n_classes),
+ use_gini( rf_.params().criterion != "entropy"), gen( rf_.params().random_seed) { rf.n_classes( n_classes); }
 
+ /**
+ * Reports to, and takes cancellation from, progress during fit().
+ */
+ void progress( training_progress* p){ progress_ = p; }
 
-template< typename Column_iterator, typename Row_index_iterator, typename Output_column_iterator>
-std::pair< std::size_t, double>
-find_best_column_split( Column_iterator col_begin, Column_iterator col_end,
- //Observation: we may sort the row iterators safely
-                        Row_index_iterator row_idx_begin, Row_index_iterator row_idx_end,
-                        Output_column_iterator output_begin, Output_column_iterator output_end){
- //We just sort the row indices into order
- //We can GPU accelerate this for fun with thrust::sort()
- //Also we can try tbb::sort()
- auto cmp = [&](const std::size_t& a, const std::size_t& b)->bool{ return (*(col_begin+a) < *(col_begin+b));};
- std::sort( row_idx_begin, row_idx_end, cmp);
- 
- std::fill( lower_counts.begin(), lower_counts.end(), 0);
- std::fill( upper_counts.begin(), upper_counts.end(), 0);
- for( auto i = row_idx_begin; i != row_idx_end; ++i) {
-  upper_counts[ output_begin[ *i]]++;
- }
- 
- std::size_t number_of_rows=std::distance(row_idx_begin,row_idx_end);
- std::pair< std::size_t, double> best_split(0, std::numeric_limits< double>::infinity());
- //By assumption at this point number_of_rows > 1
- best_split.second = balanced_entropy( lower_counts, upper_counts,
-                                       1, number_of_rows-1, number_of_rows);
- for( auto split_index = row_idx_begin+1; split_index != row_idx_end;  ++split_index){
-  auto class_label = output_begin[ *split_index];
-  lower_counts[class_label]++;
-  upper_counts[class_label]--;
-  //This logic handles repeated values in the input column
-  if( col_begin+*split_index == col_begin+*(split_index-1)){ continue; }
-  auto lower_index = std::distance(row_idx_begin,split_index)+1;
-  auto upper_index = number_of_rows-lower_index;
-  auto current_entropy = balanced_entropy( lower_counts, upper_counts,
-                                           lower_index, upper_index,
-                                           number_of_rows);
-  if( current_entropy < best_split.second){
-   best_split.first  = std::distance( row_idx_begin, split_index);
-   best_split.second = current_entropy;
-   if( current_entropy == 0.0 ){ return best_split; }
+ /**
+ * Trains params().n_estimators trees into the forest, fewer when
+ * cancelled through progress().
+ * output[ i] is the class index of row i.
+ * Returns the out of bag confusion matrix, predicted class by true class.
+ * Throws std::invalid_argument if the dataset has no rows.
+ */
+ template< typename Output>
+ Matrix< int> fit( const columnar_dataset& dataset, const Output& output){
+  if( !dataset.height()){ throw std::invalid_argument( "fit: the dataset has no rows"); }
+  const auto& params = rf.params();
+  const std::size_t n_classes = votes_.size();
+  Matrix< int> confusion_matrix( n_classes, n_classes);
+  const std::size_t previous_trees = rf.size();
+  rf.reserve( rf.size()+params.n_estimators);
+  importance_sum_.assign( dataset.width(), 0.0);
+  permutation_sum_.assign( dataset.width(), 0.0);
+  std::size_t completed = 0;
+  for( ; completed < params.n_estimators && !(progress_ && progress_->cancelled()); ++completed){
+   const auto start = std::chrono::steady_clock::now();
+   tree_importance_.assign( dataset.width(), 0.0);
+   auto& current_tree = rf.insert_next_tree();
+   current_tree.insert_root();
+   std::vector< std::size_t> row_indices;
+   random_shuffle_range(0, dataset.height(), row_indices, gen);
+   std::size_t row_subset_size = dataset.height();
+   if( params.bootstrap){ row_subset_size = std::ceil( params.row_fraction_size*dataset.height()); }
+   //In Bag Points
+   auto row_begin = row_indices.begin();
+   auto row_end = row_indices.begin() + row_subset_size;
+   //A cancelled tree is dropped with its out of bag counts
+   const Matrix< int> confusion_before = confusion_matrix;
+   try {
+    build_random_tree(  row_begin, row_end,
+                        //Out of Bag Points
+                        row_end, row_indices.end(),
+                        confusion_matrix, //We will update this as we go.
+                        dataset, output, current_tree, 0);
+   } catch( const detail::fit_cancelled&){
+    rf.pop_back();
+    confusion_matrix = confusion_before;
+    oob_correct_ = oob_total_ = 0;
+    break;
+   }
+   rf.oob_score( rf.size()-1, oob_total_ ? double( oob_correct_)/oob_total_ : std::numeric_limits< double>::quiet_NaN());
+   //Each tree's impurity decreases are normalized to sum to one
+   const double total_decrease = std::accumulate( tree_importance_.begin(), tree_importance_.end(), 0.0);
+   for( std::size_t j = 0; total_decrease > 0 && j < dataset.width(); ++j){ importance_sum_[ j] += tree_importance_[ j]/total_decrease; }
+   if( params.permutation_importance && oob_total_){
+    add_permutation_importance( current_tree, row_end, row_indices.end(), dataset, output);
+   }
+   oob_correct_ = oob_total_ = 0;
+   if( progress_){
+    const std::chrono::duration< double> seconds = std::chrono::steady_clock::now() - start;
+    progress_->tree_completed( seconds.count(), oob_error( confusion_matrix));
+   }
   }
+  rf.merge_importances( importance_sum_, permutation_sum_, previous_trees, completed);
+  return confusion_matrix;
  }
- return best_split;
-}
 
-template< typename Row_index_iterator, typename Confusion_matrix>
-void build_random_tree( Row_index_iterator row_begin, Row_index_iterator row_end,
-                        Row_index_iterator oob_begin, Row_index_iterator oob_end,
-                        Confusion_matrix& confusion_matrix,
-                        Dataset& dataset, Output& output, tree& t, typename tree::node& n,
-                        std::size_t height=0){
- typedef std::vector< std::size_t> Vector;
- 
- //Not possible to split, decision is already made.
- //Create a leaf node with this decision
- if( is_pure_column( row_begin, row_end, output)){
-  generate_leaf_node(n, output[ *row_begin]);
-  //Update OOB Confusion Matrix
-  for( auto i = oob_begin; i != oob_end; ++i){
-   confusion_matrix( output[ *row_begin] , output[ *i])++;
+private:
+ std::size_t max_tree_depth() const {
+  return rf.params().max_depth ? rf.params().max_depth : MAX_TREE_HEIGHT;
+ }
+
+ //Off diagonal fraction of the out of bag confusion matrix
+ static double oob_error( const Matrix< int>& confusion_matrix){
+  double total = 0, correct = 0;
+  for( std::size_t i = 0; i < confusion_matrix.height(); ++i){
+   for( std::size_t j = 0; j < confusion_matrix.width(); ++j){ total += confusion_matrix( i, j); }
+   correct += confusion_matrix( i, i);
   }
-  return;
+  return total ? 1 - correct/total : std::numeric_limits< double>::quiet_NaN();
  }
- 
- //TODO: Check if assuming log( number of data elements) is appropriate
- //Data is too small to waste time splitting. We punt.
- //Create a leaf node and give it a majority decision
- if( height >= max_tree_depth() || std::distance(row_begin, row_end) < std::log( dataset.m())){
-  auto class_label = get_majority_vote( row_begin, row_end, output);
-  //Update OOB Confusion Matrix
-  for( auto i = oob_begin; i != oob_end; ++i){
-   confusion_matrix( class_label, output[ *i])++;
+
+ /**
+ * A row of the dataset with the value of one feature replaced.
+ */
+ struct permuted_row {
+  const columnar_dataset& dataset;
+  std::size_t row, feature;
+  double value;
+  double operator[]( std::size_t j) const { return j == feature ? value : dataset( row, j); }
+ };
+
+ /**
+ * Drop in out of bag accuracy of the tree when the values of a feature
+ * are shuffled among the out of bag rows [oob_begin, oob_end), for every
+ * feature in parallel. oob_correct_ holds the unshuffled count.
+ */
+ template< typename Row_index_iterator, typename Output>
+ void add_permutation_importance( const tree& t, Row_index_iterator oob_begin, Row_index_iterator oob_end,
+                                  const columnar_dataset& dataset, const Output& output){
+  const std::size_t n_oob = std::distance( oob_begin, oob_end);
+  const std::size_t seed = gen();
+  std::vector< double> drop( dataset.width());
+  parallel_for( dataset.width(), 0, 1, [&]( std::size_t first, std::size_t last){
+   std::vector< double> values( n_oob);
+   for( std::size_t j = first; j < last; ++j){
+    std::mt19937 feature_gen( seed + j);
+    for( std::size_t k = 0; k < n_oob; ++k){ values[ k] = dataset( oob_begin[ k], j); }
+    std::shuffle( values.begin(), values.end(), feature_gen);
+    std::size_t correct = 0;
+    for( std::size_t k = 0; k < n_oob; ++k){
+     const permuted_row row{ dataset, (std::size_t)oob_begin[ k], j, values[ k]};
+     correct += ((std::size_t)t.vote( row) == (std::size_t)output[ oob_begin[ k]]);
+    }
+    drop[ j] = (double( oob_correct_) - double( correct))/n_oob;
+   }
+  });
+  for( std::size_t j = 0; j < drop.size(); ++j){ permutation_sum_[ j] += drop[ j]; }
+ }
+
+ template< typename Row_index_iterator, typename Output>
+ Label_type get_majority_vote( Row_index_iterator begin, Row_index_iterator end, const Output& output){
+  std::fill( votes_.begin(), votes_.end(), 0);
+  for( ; begin != end; ++begin){ votes_[ output[ *begin]]++; }
+  auto max_elt= std::max_element( votes_.begin(), votes_.end());
+  return std::distance( votes_.begin(), max_elt);
+ }
+
+ /**
+ * Best threshold of one column over the rows [row_idx_begin, row_idx_end),
+ * rows with column[ row] < threshold go left.
+ * Sorts the row indices by the column, missing values last; those can
+ * only go right, so thresholds stop at the first of them.
+ * Columns with a presorted order skip the compares, see sort_rows().
+ * Returns an infinite impurity if the column admits no split.
+ */
+ template< typename T, typename Row_index_iterator, typename Output>
+ Split find_best_column_split( const column_view< T>& column,
+  //Observation: we may sort the row iterators safely
+                               Row_index_iterator row_idx_begin, Row_index_iterator row_idx_end,
+                               const Output& output){
+  //We just sort the row indices into order
+  //We can GPU accelerate this for fun with thrust::sort()
+  //Also we can try tbb::sort()
+  sort_rows( column, row_idx_begin, row_idx_end, marks_);
+
+  std::fill( lower_counts.begin(), lower_counts.end(), 0);
+  std::fill( upper_counts.begin(), upper_counts.end(), 0);
+  for( auto i = row_idx_begin; i != row_idx_end; ++i) {
+   upper_counts[ output[ *i]]++;
   }
-  generate_leaf_node(n, class_label);
-  return;
+
+  const std::size_t min_leaf = std::max< std::size_t>( 1, rf.params().min_samples_leaf);
+  std::size_t number_of_rows=std::distance(row_idx_begin,row_idx_end);
+  Split best_split(0, std::numeric_limits< double>::infinity());
+  for( auto split_index = row_idx_begin+1; split_index != row_idx_end;  ++split_index){
+   auto class_label = output[ *(split_index-1)];
+   lower_counts[class_label]++;
+   upper_counts[class_label]--;
+   if( std::isnan( (double)column[ *split_index])){ break; }
+   //This logic handles repeated values in the input column
+   if( column[ *split_index] == column[ *(split_index-1)]){ continue; }
+   std::size_t lower_index = std::distance(row_idx_begin,split_index);
+   std::size_t upper_index = number_of_rows-lower_index;
+   if( lower_index < min_leaf || upper_index < min_leaf){ continue; }
+   auto current_impurity = split_impurity( lower_counts, upper_counts,
+                                           lower_index, upper_index, use_gini);
+   if( current_impurity < best_split.second){
+    best_split.first  = column[ *split_index];
+    best_split.second = current_impurity;
+    if( current_impurity == 0.0 ){ return best_split; }
+   }
+  }
+  return best_split;
  }
- 
- //Choose a random subset of subset_size columns
- std::size_t subset_size = std::ceil(column_subset_size_*dataset.n());
- //create a vector of length n
- Vector columns;
- random_subset_from_range(0, dataset.n(), columns);
- columns.erase( columns.begin()+column_subset_size_*(dataset.n()), columns.end());
- 
- //Output Variables
- double best_entropy=std::numeric_limits< double>::infinity();
- std::size_t column_index_for_split=std::numeric_limits< std::size_t>::infinity();
- double split_threshold_value=best_entropy;
- std::tuple< Vector, Vector> row_indices_for_split;
- //Find the best split within each column, find minimal overall split.
- for(auto& column: columns){
-  std::pair< std::size_t, double>
-   split_and_entropy = find_best_column_split( dataset.begin( column), dataset.end( column),
-                                               row_begin, row_end,
-                                               output.begin(), output.end());
-  if( split_and_entropy.second < best_entropy){
-   //Record the entropy so far and which column we are in
-   best_entropy = split_and_entropy.second;
-   column_index_for_split = column;
-   
-   //Index into sorted range of split.
-   std::size_t split_index = split_and_entropy.first;
-   
-   //Get the entry containing the split_threshold_value
-   split_threshold_value = *(dataset.begin( column)+row_begin[ split_index]);
-   
-   //Since we resort at every step we make physical copies of the row indices
-   //If the column was gaurunteed sorted then we could skip this!
-   //This seems like it should save a lot of memory..!
-   row_indices_for_split = std::move( std::make_tuple( Vector( row_begin, row_begin+split_index),
-                                                       Vector( row_begin+split_index, row_end)));
+
+ /**
+ * uint8 columns have at most 256 distinct values, so we count
+ * (value, class) pairs instead of sorting the rows.
+ */
+ template< typename Row_index_iterator, typename Output>
+ Split find_best_column_split( const column_view< std::uint8_t>& column,
+                               Row_index_iterator row_idx_begin, Row_index_iterator row_idx_end,
+                               const Output& output){
+  const std::size_t n_classes = votes_.size();
+  value_counts.assign( 256*n_classes, 0);
+  std::fill( lower_counts.begin(), lower_counts.end(), 0);
+  std::fill( upper_counts.begin(), upper_counts.end(), 0);
+  for( auto i = row_idx_begin; i != row_idx_end; ++i){
+   const auto label = output[ *i];
+   value_counts[ column[ *i]*n_classes+label]++;
+   upper_counts[ label]++;
   }
+  const std::size_t min_leaf = std::max< std::size_t>( 1, rf.params().min_samples_leaf);
+  std::size_t number_of_rows=std::distance(row_idx_begin,row_idx_end);
+  std::size_t lower_index = 0;
+  Split best_split(0, std::numeric_limits< double>::infinity());
+  for( std::size_t value = 0; value < 256; ++value){
+   const std::size_t* counts = &value_counts[ value*n_classes];
+   const std::size_t n = std::accumulate( counts, counts+n_classes, std::size_t( 0));
+   if( n == 0){ continue; }
+   //Candidate split: values < value go left
+   std::size_t upper_index = number_of_rows-lower_index;
+   if( lower_index >= min_leaf && upper_index >= min_leaf){
+    auto current_impurity = split_impurity( lower_counts, upper_counts,
+                                            lower_index, upper_index, use_gini);
+    if( current_impurity < best_split.second){
+     best_split.first = value;
+     best_split.second = current_impurity;
+    }
+   }
+   for( std::size_t c = 0; c < n_classes; ++c){
+    lower_counts[ c] += counts[ c];
+    upper_counts[ c] -= counts[ c];
+   }
+   lower_index += n;
+  }
+  return best_split;
  }
- //Build the split into the tree
- set_split( n, column_index_for_split, split_threshold_value);
- auto oob_middle = std::partition( oob_begin, oob_end,
-                                   [&](const std::size_t& a){ return output[ a] < split_threshold_value; });
- //add children nodes into Decision Tree
- auto kids = t.insert_children( n);
- //Recursively call.
- auto& left_indices = std::get< 0>(row_indices_for_split);
- auto& right_indices = std::get< 1>(row_indices_for_split);
- ++height; //make sure to increment height!
- if(left_indices.size()) {
-  build_random_tree(left_indices.begin(), left_indices.end(),
+
+ template< typename Row_index_iterator, typename Confusion_matrix, typename Output>
+ void build_random_tree( Row_index_iterator row_begin, Row_index_iterator row_end,
+                         Row_index_iterator oob_begin, Row_index_iterator oob_end,
+                         Confusion_matrix& confusion_matrix,
+                         const columnar_dataset& dataset, const Output& output,
+                         tree& t, std::size_t node_index,
+                         std::size_t height=0){
+  typedef std::vector< std::size_t> Vector;
+  const auto& params = rf.params();
+  if( progress_ && progress_->cancelled()){ throw detail::fit_cancelled(); }
+  t.set_cover( node_index, std::distance( row_begin, row_end));
+
+  //Not possible to split, decision is already made.
+  //Create a leaf node with this decision
+  if( is_pure_column( row_begin, row_end, output)){
+   t.generate_leaf_node( t[ node_index], output[ *row_begin]);
+   std::fill( votes_.begin(), votes_.end(), 0);
+   votes_[ output[ *row_begin]] = 1;
+   t.set_leaf_distribution( t[ node_index], votes_.data(), votes_.size());
+   //Update OOB Confusion Matrix
+   for( auto i = oob_begin; i != oob_end; ++i){
+    confusion_matrix( output[ *row_begin] , output[ *i])++;
+   }
+   record_oob( output[ *row_begin], oob_begin, oob_end, output);
+   return;
+  }
+
+  //Data is too small to waste time splitting. We punt.
+  //Create a leaf node and give it a majority decision
+  const std::size_t n = std::distance( row_begin, row_end);
+  if( height >= max_tree_depth() || n < std::max< std::size_t>( 2, params.min_samples_split)){
+   make_leaf( row_begin, row_end, oob_begin, oob_end, confusion_matrix, output, t, node_index);
+   return;
+  }
+
+  //Choose a random subset of subset_size columns
+  std::size_t subset_size = features_per_split( params, dataset.width());
+  Vector columns;
+  random_subset_size_k(0, dataset.width(), subset_size, columns, gen);
+
+  //Output Variables
+  double best_impurity=std::numeric_limits< double>::infinity();
+  std::size_t column_index_for_split=0;
+  double split_threshold_value=0;
+  //Find the best split within each column, find minimal overall split.
+  for(auto& column: columns){
+   Split split_and_impurity = visit( dataset.column( column), [&]( const auto& view){
+     return this->find_best_column_split( view, row_begin, row_end, output);
+   });
+   if( split_and_impurity.second < best_impurity){
+    //Record the impurity so far and which column we are in
+    best_impurity = split_and_impurity.second;
+    column_index_for_split = column;
+    split_threshold_value = split_and_impurity.first;
+   }
+  }
+  if( best_impurity == std::numeric_limits< double>::infinity()){
+   make_leaf( row_begin, row_end, oob_begin, oob_end, confusion_matrix, output, t, node_index);
+   return;
+  }
+  //Mean decrease in impurity, weighted by the rows reaching the node
+  std::fill( votes_.begin(), votes_.end(), 0);
+  for( auto i = row_begin; i != row_end; ++i){ votes_[ output[ *i]]++; }
+  const double node_impurity = use_gini ? gini( votes_, n) : entropy( votes_, n);
+  tree_importance_[ column_index_for_split] += n*std::max( 0.0, node_impurity - best_impurity);
+  //Build the split into the tree
+  t.set_split( t[ node_index], column_index_for_split, split_threshold_value);
+  //The rows are partitioned in place, no copies of the row indices are made.
+  const auto& split_column = dataset.column( column_index_for_split);
+  auto goes_left = [&](const std::size_t& a){ return split_column[ a] < split_threshold_value; };
+  auto row_middle = std::partition( row_begin, row_end, goes_left);
+  auto oob_middle = std::partition( oob_begin, oob_end, goes_left);
+  //add children nodes into Decision Tree
+  t.insert_children( t[ node_index]);
+  const std::size_t left_child = t[ node_index].left_child_index();
+  const std::size_t right_child = t[ node_index].right_child_index();
+  //Recursively call.
+  ++height; //make sure to increment height!
+  build_random_tree(row_begin, row_middle,
                     oob_begin, oob_middle,
                     confusion_matrix,
                     dataset, output, t,
-                    std::get<0>(kids), height);
- }
- if( right_indices.size()) {
-  auto& right_child = t.insert_right_child( n);
-  build_random_tree(right_indices.begin(), right_indices.end(),
+                    left_child, height);
+  build_random_tree(row_middle, row_end,
                     oob_middle, oob_end,
                     confusion_matrix,
                     dataset, output, t,
-                    std::get<1>(kids), height);
+                    right_child, height);
  }
-}
 
+ template< typename Row_index_iterator, typename Confusion_matrix, typename Output>
+ void make_leaf( Row_index_iterator row_begin, Row_index_iterator row_end,
+                 Row_index_iterator oob_begin, Row_index_iterator oob_end,
+                 Confusion_matrix& confusion_matrix, const Output& output,
+                 tree& t, std::size_t node_index){
+  auto class_label = get_majority_vote( row_begin, row_end, output);
+  //Update OOB Confusion Matrix
+  for( auto i = oob_begin; i != oob_end; ++i){
+   confusion_matrix( class_label, output[ *i])++;
+  }
+  record_oob( class_label, oob_begin, oob_end, output);
+  t.generate_leaf_node( t[ node_index], class_label);
+  //get_majority_vote() left the class counts of the leaf in votes_
+  t.set_leaf_distribution( t[ node_index], votes_.data(), votes_.size());
+ }
 
-template< typename T>
-class Matrix_view {
-public:
- Matrix_view(T* raw_ptr, size_t rows, size_t cols):
- ptr(raw_ptr), n_rows( rows), n_cols( cols), data(rows*cols) {}
- T& operator()(size_t i, size_t j){ return ptr[j * n_cols + i];  }
- T operator()(size_t i, size_t j) const{ return (*this)(i,j); }
- std::size_t height()const { return n_rows; };
- std::size_t width()const { return n_cols; };
- auto begin(){ return ptr; }
- auto end(){ return ptr+n_rows*n_cols;}
- auto begin( std::size_t i){ return &((*this)(0,i)); }
- auto end( std::size_t i){ return begin(i)+n_rows; }
- auto data() { return data; }
-private:
- size_t n_rows;
- size_t n_cols;
- T* ptr;
-};
+ //Out of bag rows of the current tree, and how many of them it labels correctly
+ template< typename Row_index_iterator, typename Output>
+ void record_oob( std::size_t label, Row_index_iterator oob_begin, Row_index_iterator oob_end, const Output& output){
+  for( auto i = oob_begin; i != oob_end; ++i){ oob_correct_ += ((std::size_t)output[ *i] == label); }
+  oob_total_ += std::distance( oob_begin, oob_end);
+ }
 
-template< typename T>
-class Matrix : public Matrix_view<T>{
-public:
- Matrix(size_t rows, size_t cols): data(rows*cols) {
-   Matrix_view::Matrix_view(data.data(), rows, cols);
+ forest& rf;
+ training_progress* progress_=nullptr;
+ std::size_t oob_correct_=0;
+ std::size_t oob_total_=0;
+ //Impurity decrease of the current tree, and the sums over the trees of this fit()
+ std::vector< double> tree_importance_;
+ std::vector< double> importance_sum_;
+ std::vector< double> permutation_sum_;
+ Map votes_;
+ Map lower_counts;
+ Map upper_counts;
+ Map value_counts;
+ //Scratch of sort_rows()
+ std::vector< std::uint8_t> marks_;
+ bool use_gini;
+ std::mt19937 gen;
+}; //end class random_forest_trainer
+
+/**
+ * Trains rf on a columnar dataset, output[ i] is the class index of row i.
+ * Returns the out of bag confusion matrix. Throws std::invalid_argument
+ * if the dataset has no rows.
+ */
+template< typename Label_type, typename Output>
+Matrix<int> fit( random_forest_classifier< Label_type>& rf, const columnar_dataset& dataset, const Output& output){
+ std::size_t n_classes = 0;
+ for( std::size_t i = 0; i < dataset.height(); ++i){
+  n_classes = std::max< std::size_t>( n_classes, output[ i]+1);
  }
-private:
- std::vector<T> data;
-};
-
-
-template< typename T, typename O>
-Matrix<int> fit( Matrix_view<T>& dataset, Matrix_view<O>& output, rf_train_params params=rf_train_params()){
- typedef std::vector< decltype(dataset(0,0))> vector;
- trees.reserve( number_of_trees_);
- Matrix< int> confusion_matrix( 2, 2);
- vector row( dataset.height(), 0.0);
- random
- for( int i = 0; i < number_of_trees_; ++i){
-  auto& current_tree = rf.insert_next_tree();
-  current_tree.reserve( dataset.width());
-  auto& root = current_tree.insert_root();
-  std::vector< std::size_t> row_indices;
-  random_shuffle_range(0, dataset.m(), row_indices);
-  int row_subset_size = std::ceil( params.row_fraction_size*dataset.height());
-  //In Bag Points
-  auto row_begin = row_indices.begin();
-  auto row_end = row_indices.begin() + row_subset_size;
-  build_random_tree(  row_begin, row_end,
-                      //Out of Bag Points
-                     row_end, row_indices.end(),
-                     confusion_matrix, //We will update this as we go.
-                     dataset, output, current_tree, root);
+ random_forest_trainer< Label_type> trainer( rf, n_classes);
+ return trainer.fit( dataset, output);
+}
+
+/**
+ * fit() reporting to progress, which can also cancel it; see
+ * training_progress.
+ */
+template< typename Label_type, typename Output>
+Matrix<int> fit( random_forest_classifier< Label_type>& rf, const columnar_dataset& dataset, const Output& output,
+                 training_progress& progress){
+ std::size_t n_classes = 0;
+ for( std::size_t i = 0; i < dataset.height(); ++i){
+  n_classes = std::max< std::size_t>( n_classes, output[ i]+1);
  }
- return confusion_matrix;
+ random_forest_trainer< Label_type> trainer( rf, n_classes);
+ trainer.progress( &progress);
+ return trainer.fit( dataset, output);
+}
+
+/**
+ * Trains rf on a dense matrix, which is first narrowed column by column.
+ */
+template< typename Label_type, typename T, typename O>
+Matrix<int> fit( random_forest_classifier< Label_type>& rf, const Matrix_view<T>& dataset, const Matrix_view<O>& output){
+ std::vector< std::size_t> labels( output.height());
+ for( std::size_t i = 0; i < labels.size(); ++i){ labels[ i] = output( i, 0); }
+ return fit( rf, make_columnar( dataset), labels);
 }
 
+} //end namespace ml
+} //end namespace ayasdi
+
 #endif //RANDOM_FOREST_TRAIN_RF_HPP
@@ -0,0 +1,189 @@
+#pragma once
+/**
+ * Cache conscious node layouts for trained trees.
+ *
+ * Training inserts nodes in whatever order the recursion produces, so a
+ * root to leaf walk touches a new cache line almost at every step. The
+ * layout pass rearranges each tree's nodes (decision_tree::permute) into
+ *
+ *  1. the top bfs_levels levels in breadth first order, one contiguous
+ *     block at the start of the (cache line aligned) node array, which
+ *     every row walks through;
+ *  2. below that, every subtree either
+ *       depth first with the more frequently visited child first, so the
+ *       hot path of a subtree is consecutive in memory, or
+ *       in van Emde Boas order, which is cache oblivious: a subtree of
+ *       height h is split at h/2 into a top tree and bottom trees, each
+ *       laid out recursively and contiguously.
+ *
+ * Visit frequencies come from count_visits() over a sample of rows,
+ * usually the training set. Without them children are taken left first.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/matrix.hpp>
+
+//STL
+#include <vector>
+#include <algorithm>
+
+namespace ayasdi{
+namespace ml {
+
+enum class subtree_layout { hot_path, van_emde_boas };
+
+struct layout_options {
+ //Levels laid out breadth first at the front, 0 for none.
+ std::size_t bfs_levels=4;
+ subtree_layout subtrees=subtree_layout::hot_path;
+};
+
+/**
+ * Number of rows of X passing through every node of t.
+ */
+template< typename Label_type, typename T>
+std::vector< std::size_t> count_visits( const decision_tree< Label_type>& t, const Matrix_view< T>& X){
+ std::vector< std::size_t> visits( t.size(), 0);
+ if( t.size() == 0){ return visits; }
+ for( std::size_t i = 0; i < X.height(); ++i){
+  auto row = X.row( i);
+  std::size_t n = 0;
+  visits[ n]++;
+  while( t[ n].is_not_leaf()){
+   n = (row[ t[ n].split_] < t[ n].split_value_) ? t[ n].left_child_index() : t[ n].right_child_index();
+   visits[ n]++;
+  }
+ }
+ return visits;
+}
+
+namespace detail {
+
+template< typename Label_type>
+class layout_builder {
+public:
+ typedef decision_tree< Label_type> tree;
+
+ layout_builder( const tree& t, const std::vector< std::size_t>* visits):
+ t_( t), visits_( visits), height_( t.size(), 0) {
+     order_.reserve( t.size());
+     if( t.size()){ compute_height( 0); }
+ }
+
+ std::vector< std::size_t> build( const layout_options& options){
+     if( t_.size() == 0){ return order_; }
+     //Breadth first top levels
+     std::vector< std::size_t> frontier( 1, 0), next;
+     for( std::size_t depth = 0; depth < options.bfs_levels && !frontier.empty(); ++depth){
+      next.clear();
+      for( auto n: frontier){
+       order_.push_back( n);
+       if( t_[ n].is_not_leaf()){
+        next.push_back( t_[ n].left_child_index());
+        next.push_back( t_[ n].right_child_index());
+       }
+      }
+      frontier.swap( next);
+     }
+     //Subtrees below the breadth first block
+     for( auto n: frontier){
+      if( options.subtrees == subtree_layout::van_emde_boas){ van_emde_boas( n, height_[ n]+1); }
+      else { hot_path( n); }
+     }
+     return order_;
+ }
+
+private:
+ std::size_t compute_height( std::size_t n){
+     if( t_[ n].is_not_leaf()){
+      height_[ n] = 1 + std::max( compute_height( t_[ n].left_child_index()),
+                                  compute_height( t_[ n].right_child_index()));
+     }
+     return height_[ n];
+ }
+
+ std::pair< std::size_t, std::size_t> children_hot_first( std::size_t n) const {
+     std::size_t first = t_[ n].left_child_index(), second = t_[ n].right_child_index();
+     if( visits_ && (*visits_)[ second] > (*visits_)[ first]){ std::swap( first, second); }
+     return std::make_pair( first, second);
+ }
+
+ void hot_path( std::size_t root){
+     std::vector< std::size_t> stack( 1, root);
+     while( !stack.empty()){
+      const std::size_t n = stack.back();
+      stack.pop_back();
+      order_.push_back( n);
+      if( t_[ n].is_not_leaf()){
+       auto kids = children_hot_first( n);
+       stack.push_back( kids.second);
+       stack.push_back( kids.first);
+      }
+     }
+ }
+
+ /**
+ * Lays out the top `levels` levels of the subtree at root in van Emde Boas order.
+ */
+ void van_emde_boas( std::size_t root, std::size_t levels){
+     if( levels == 1 || t_[ root].is_leaf()){
+      order_.push_back( root);
+      return;
+     }
+     const std::size_t top = levels/2;
+     van_emde_boas( root, top);
+     //Roots of the bottom trees: the nodes `top` levels below root
+     std::vector< std::size_t> bottom( 1, root), next;
+     for( std::size_t d = 0; d < top; ++d){
+      next.clear();
+      for( auto n: bottom){
+       if( t_[ n].is_not_leaf()){
+        auto kids = children_hot_first( n);
+        next.push_back( kids.first);
+        next.push_back( kids.second);
+       }
+      }
+      bottom.swap( next);
+     }
+     for( auto n: bottom){ van_emde_boas( n, levels-top); }
+ }
+
+ const tree& t_;
+ const std::vector< std::size_t>* visits_;
+ std::vector< std::size_t> height_;
+ std::vector< std::size_t> order_;
+}; //end class layout_builder
+
+} //end namespace detail
+
+/**
+ * The node order of t under options, as expected by decision_tree::permute().
+ * visits, if given, holds the visit count of every node (count_visits()).
+ */
+template< typename Label_type>
+std::vector< std::size_t> layout_order( const decision_tree< Label_type>& t, const layout_options& options,
+                                        const std::vector< std::size_t>* visits=nullptr){
+ return detail::layout_builder< Label_type>( t, visits).build( options);
+}
+
+/**
+ * Rearranges the nodes of every tree of forest. Visit frequencies
+ * are measured on the rows of X.
+ */
+template< typename Label_type, typename T>
+void optimize_layout( random_forest_classifier< Label_type>& forest, const Matrix_view< T>& X,
+                      const layout_options& options=layout_options()){
+ for( auto& t: forest){
+  auto visits = count_visits( t, X);
+  t.permute( layout_order( t, options, &visits));
+ }
+}
+
+template< typename Label_type>
+void optimize_layout( random_forest_classifier< Label_type>& forest, const layout_options& options=layout_options()){
+ for( auto& t: forest){ t.permute( layout_order( t, options)); }
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -0,0 +1,195 @@
+#pragma once
+/**
+ * Exact TreeSHAP feature attributions.
+ *
+ * The SHAP value of feature j for a row is its Shapley value in the game
+ * whose payoff for a feature subset S is the expected model output given
+ * the row's values of S, where the expectation over the other features
+ * follows the training rows through the tree (the node covers recorded at
+ * fit time). Lundberg et al.'s algorithm computes all of them in
+ * O( leaves * depth^2) per tree by tracking, along each root to leaf path,
+ * the proportion of subsets of every size that flow down the path.
+ *
+ * The model output explained is the probability of one class: the leaf
+ * class distribution when the tree has one, one hot on the leaf label
+ * otherwise, averaged over the trees.
+ *
+ * Lundberg, Erion, Lee, "Consistent Individualized Feature Attribution for
+ * Tree Ensembles", arXiv:1802.03888, Algorithm 2.
+ */
+
+//Project
+#include <random_forest/random_forest.hpp>
+#include <random_forest/matrix.hpp>
+#include <random_forest/parallel.hpp>
+
+//STL
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace ayasdi{
+namespace ml {
+
+namespace detail {
+
+template< typename Label_type>
+class tree_shap {
+public:
+ tree_shap( const decision_tree< Label_type>& t, std::size_t class_index):
+ t_( t), class_index_( class_index) {
+     if( !t.has_covers()){ throw std::invalid_argument( "tree_shap: the tree has no node covers, train it again"); }
+     const std::size_t d = depth( 0);
+     path_.resize( (d+2)*(d+3)/2);
+ }
+
+ //Output of the tree at a leaf
+ double value( const dtree_node& leaf) const {
+     if( t_.has_distributions()){ return t_.leaf_distribution( leaf)[ class_index_]; }
+     return (std::size_t)leaf.template class_label< Label_type>() == class_index_;
+ }
+
+ //Mean output over the training rows
+ double expected_value( std::size_t i=0) const {
+     const auto& n = t_[ i];
+     if( n.is_leaf()){ return value( n); }
+     const std::size_t l = n.left_child_index(), r = n.right_child_index();
+     return (t_.cover( l)*expected_value( l) + t_.cover( r)*expected_value( r))/t_.cover( i);
+ }
+
+ /**
+ * Adds scale times the SHAP values of row x to phi[ 0..features).
+ */
+ template< typename Datapoint>
+ void add( const Datapoint& x, double scale, double* phi){
+     recurse( x, scale, phi, 0, 0, path_.data(), 1, 1, -1);
+ }
+
+private:
+ struct path_element {
+  long feature;
+  double zero_fraction;
+  double one_fraction;
+  double pweight;
+ };
+
+ std::size_t depth( std::size_t i) const {
+     const auto& n = t_[ i];
+     if( n.is_leaf()){ return 0; }
+     return 1 + std::max( depth( n.left_child_index()), depth( n.right_child_index()));
+ }
+
+ static void extend( path_element* path, std::size_t d, double zero_fraction, double one_fraction, long feature){
+     path[ d] = path_element{ feature, zero_fraction, one_fraction, d == 0 ? 1.0 : 0.0};
+     for( long i = (long)d-1; i >= 0; --i){
+      path[ i+1].pweight += one_fraction*path[ i].pweight*(i+1)/(d+1);
+      path[ i].pweight = zero_fraction*path[ i].pweight*(d-i)/(d+1);
+     }
+ }
+
+ static void unwind( path_element* path, std::size_t d, std::size_t k){
+     const double one = path[ k].one_fraction, zero = path[ k].zero_fraction;
+     double next_one_portion = path[ d].pweight;
+     for( long i = (long)d-1; i >= 0; --i){
+      if( one != 0){
+       const double tmp = path[ i].pweight;
+       path[ i].pweight = next_one_portion*(d+1)/((i+1)*one);
+       next_one_portion = tmp - path[ i].pweight*zero*(d-i)/(d+1);
+      } else {
+       path[ i].pweight = path[ i].pweight*(d+1)/(zero*(d-i));
+      }
+     }
+     for( std::size_t i = k; i < d; ++i){
+      path[ i].feature = path[ i+1].feature;
+      path[ i].zero_fraction = path[ i+1].zero_fraction;
+      path[ i].one_fraction = path[ i+1].one_fraction;
+     }
+ }
+
+ static double unwound_sum( const path_element* path, std::size_t d, std::size_t k){
+     const double one = path[ k].one_fraction, zero = path[ k].zero_fraction;
+     double next_one_portion = path[ d].pweight, total = 0;
+     for( long i = (long)d-1; i >= 0; --i){
+      if( one != 0){
+       const double tmp = next_one_portion*(d+1)/((i+1)*one);
+       total += tmp;
+       next_one_portion = path[ i].pweight - tmp*zero*(double)(d-i)/(d+1);
+      } else {
+       total += (path[ i].pweight/zero)/((double)(d-i)/(d+1));
+      }
+     }
+     return total;
+ }
+
+ template< typename Datapoint>
+ void recurse( const Datapoint& x, double scale, double* phi, std::size_t i, std::size_t d,
+               path_element* parent_path, double zero_fraction, double one_fraction, long feature){
+     //Every level works on its own copy of the path
+     path_element* path = parent_path + d + 1;
+     std::copy( parent_path, parent_path + d + 1, path);
+     extend( path, d, zero_fraction, one_fraction, feature);
+     const auto& n = t_[ i];
+     if( n.is_leaf()){
+      const double v = scale*value( n);
+      for( std::size_t k = 1; k <= d; ++k){
+       phi[ path[ k].feature] += unwound_sum( path, d, k)*(path[ k].one_fraction - path[ k].zero_fraction)*v;
+      }
+      return;
+     }
+     const bool left = x[ n.split_] < n.split_value_;
+     const std::size_t hot = left ? n.left_child_index() : n.right_child_index();
+     const std::size_t cold = left ? n.right_child_index() : n.left_child_index();
+     double incoming_zero = 1, incoming_one = 1;
+     //A feature already on the path is taken out and put back in at this node
+     std::size_t k = 1;
+     for( ; k <= d && path[ k].feature != (long)n.split_; ++k){}
+     if( k <= d){
+      incoming_zero = path[ k].zero_fraction;
+      incoming_one = path[ k].one_fraction;
+      unwind( path, d, k);
+      --d;
+     }
+     const double cover = t_.cover( i);
+     recurse( x, scale, phi, hot, d+1, path, t_.cover( hot)/cover*incoming_zero, incoming_one, n.split_);
+     recurse( x, scale, phi, cold, d+1, path, t_.cover( cold)/cover*incoming_zero, 0, n.split_);
+ }
+
+ const decision_tree< Label_type>& t_;
+ std::size_t class_index_;
+ std::vector< path_element> path_;
+}; //end class tree_shap
+
+} //end namespace detail
+
+/**
+ * SHAP values of the probability of class_index for every row of X.
+ * Row i of the result holds the attributions of the X.width() features
+ * followed by the expected value, so each row sums to
+ * predict_proba( X.row( i))[ class_index]. Rows are spread over n_threads
+ * threads as in parallel_for(). Throws std::invalid_argument if a tree was
+ * trained without node covers.
+ */
+template< typename Label_type, typename T>
+Matrix< double> shap_values( const random_forest_classifier< Label_type>& forest, const Matrix_view< T>& X,
+                             std::size_t class_index, std::size_t n_threads=0){
+ const std::size_t n_features = X.width();
+ Matrix< double> phi( X.height(), n_features+1, storage_order::row_major);
+ for( std::size_t i = 0; i < phi.height(); ++i){ std::fill( &phi( i, 0), &phi( i, 0)+n_features+1, 0.0); }
+ if( forest.empty()){ return phi; }
+ const double scale = 1.0/forest.size();
+ double expected = 0;
+ for( auto& t: forest){ expected += scale*detail::tree_shap< Label_type>( t, class_index).expected_value(); }
+ parallel_for( X.height(), n_threads, 64, [&]( std::size_t begin, std::size_t end){
+  std::vector< detail::tree_shap< Label_type> > explainers;
+  for( auto& t: forest){ explainers.emplace_back( t, class_index); }
+  for( std::size_t i = begin; i < end; ++i){
+   double* row = &phi( i, 0);
+   for( auto& e: explainers){ e.add( X.row( i), scale, row); }
+   row[ n_features] = expected;
+  }
+ });
+ return phi;
+}
+
+} //end namespace ml
+} //end namespace ayasdi
@@ -1,43 +1,545 @@
+/**
+ * Python bindings.
+ *
+ * Arrays are wrapped, not copied: a native byte order float32 or float64
+ * numpy array of non-negative strides, in whole elements, becomes a
+ * Matrix_view over the numpy buffer, and fit() trains on per column views of
+ * it. Other dtypes, byte orders and strides are converted to a float64 copy,
+ * the one case where a copy is unavoidable.
+ *
+ * fit() and the predict functions release the GIL while they run, so many
+ * Python threads can score with the same forest at once. Predictions go into
+ * a caller supplied array when out is given, which must have exactly the
+ * result dtype and shape and be C contiguous: it is never converted, since
+ * results written into a converted copy would be lost.
+ *
+ * fit() trains a new forest with the GIL released and swaps it in under a
+ * writer lock, so predictions running concurrently see either the old forest
+ * or the new one.
+ *
+ * Trained forests leave the process as their native serialization
+ * (serialization.hpp): pickling stores it as one bytes object, to_buffer()
+ * returns it as a ModelBuffer, which supports the buffer protocol, and
+ * from_buffer() reads a forest from any contiguous buffer (bytes, mmap,
+ * shared memory) in place.
+ *
+ * fit_async() trains on a background thread and returns a FitHandle which
+ * reports progress (trees completed, out of bag error, seconds per tree),
+ * can cancel between node expansions and yields the partial forest.
+ *
+ * X may also be any object exporting the Arrow PyCapsule interface
+ * (__arrow_c_array__ or __arrow_c_stream__: pyarrow record batches and
+ * tables, polars and recent pandas frames) or DLPack (__dlpack__: torch,
+ * jax, cupy host arrays). Its columns are trained on in place (arrow.hpp),
+ * with Arrow nulls as missing values, instead of a dense float64 copy.
+ */
+
+//Project
 #include <random_forest/random_forest.hpp>
+#include <random_forest/train_rf.hpp>
+#include <random_forest/columnar_dataset.hpp>
+#include <random_forest/matrix.hpp>
+#include <random_forest/parallel.hpp>
+#include <random_forest/serialization.hpp>
+#include <random_forest/arrow.hpp>
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+//STL
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <condition_variable>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
 
 namespace py = pybind11;
+namespace ml = ayasdi::ml;
+
+namespace {
+
+typedef std::int32_t label_type;
+typedef ml::random_forest_classifier< label_type> forest_type;
+
+/**
+ * True if the elements of a are exactly T in native byte order.
+ */
+template< typename T>
+bool holds( const py::array& a){ return py::array_t< T>::check_( a); }
+
+/**
+ * a itself when a Matrix_view can wrap it, native float32 or float64 with
+ * non-negative strides that are whole elements, a float64 copy otherwise.
+ * Needs the GIL.
+ */
+py::array viewable( const py::array& a){
+ if( a.ndim() != 2){ throw std::invalid_argument( "expected a 2d array"); }
+ const std::ptrdiff_t row_stride = a.strides( 0), col_stride = a.strides( 1);
+ const std::ptrdiff_t size = a.itemsize();
+ if( (holds< double>( a) || holds< float>( a)) &&
+     row_stride >= 0 && col_stride >= 0 && row_stride % size == 0 && col_stride % size == 0){
+  return a;
+ }
+ auto copy = py::array_t< double, py::array::f_style | py::array::forcecast>::ensure( a);
+ if( !copy){ throw std::invalid_argument( "array is not convertible to float64"); }
+ return std::move( copy);
+}
+
+/**
+ * Calls f( Matrix_view< T>) over the buffer of a viewable() array.
+ */
+template< typename Functor>
+void with_view( const py::array& a, Functor&& f){
+ const std::ptrdiff_t row_stride = a.strides( 0), col_stride = a.strides( 1);
+ if( a.itemsize() == sizeof( double)){
+  f( ml::Matrix_view< double>::from_buffer( (double*)a.data(), a.shape( 0), a.shape( 1), row_stride, col_stride));
+ } else {
+  f( ml::Matrix_view< float>::from_buffer( (float*)a.data(), a.shape( 0), a.shape( 1), row_stride, col_stride));
+ }
+}
+
+/**
+ * Calls f( Matrix_view< T>) on the 2d array a, in place when possible,
+ * see viewable(). Needs the GIL.
+ */
+template< typename Functor>
+void with_matrix( const py::array& a, Functor&& f){ with_view( viewable( a), f); }
+
+/**
+ * X as a numpy array, converting sequences. Needs the GIL.
+ */
+py::array array_of( const py::object& X){
+ if( py::isinstance< py::array>( X)){ return py::reinterpret_borrow< py::array>( X); }
+ py::array a = py::array::ensure( X);
+ if( !a){ throw std::invalid_argument( "X must be an array, or export __arrow_c_array__ or __dlpack__"); }
+ return a;
+}
+
+template< typename T>
+T* capsule_pointer( const py::object& capsule, const char* name){
+ void* p = PyCapsule_GetPointer( capsule.ptr(), name);
+ if( !p){ throw py::error_already_set(); }
+ return static_cast< T*>( p);
+}
+
+/**
+ * Imports X into dataset when X is not a numpy array but exports the
+ * Arrow PyCapsule interface or DLPack, taking ownership of the exported
+ * data. False, leaving dataset alone, otherwise. Needs the GIL.
+ */
+bool foreign_dataset( const py::object& X, ml::columnar_dataset& dataset){
+ if( py::isinstance< py::array>( X)){ return false; }
+ if( py::hasattr( X, "__arrow_c_array__")){
+  const py::tuple capsules = X.attr( "__arrow_c_array__")();
+  //The schema capsule keeps ownership of the schema, the array is moved out of its capsule
+  const auto& schema = *capsule_pointer< ArrowSchema>( capsules[ 0], "arrow_schema");
+  dataset = ml::import_arrow( capsule_pointer< ArrowArray>( capsules[ 1], "arrow_array"), schema);
+  return true;
+ }
+ if( py::hasattr( X, "__arrow_c_stream__")){
+  const py::object capsule = X.attr( "__arrow_c_stream__")();
+  dataset = ml::import_arrow_stream( capsule_pointer< ArrowArrayStream>( capsule, "arrow_array_stream"));
+  return true;
+ }
+ if( py::hasattr( X, "__dlpack__")){
+  const py::object capsule = X.attr( "__dlpack__")();
+  auto tensor = capsule_pointer< DLManagedTensor>( capsule, "dltensor");
+  //Marks the tensor consumed, so the capsule no longer deletes it
+  PyCapsule_SetName( capsule.ptr(), "used_dltensor");
+  dataset = ml::import_dlpack( tensor);
+  return true;
+ }
+ return false;
+}
+
+/**
+ * Class indices from a 1d integer array, checked to be non-negative.
+ */
+std::vector< std::size_t> labels_of( const py::array& y){
+ if( y.ndim() != 1 || y.dtype().kind() == 'f' || y.dtype().kind() == 'c'){
+  throw std::invalid_argument( "y must be a 1d array of class indices");
+ }
+ auto labels = py::array_t< std::int64_t, py::array::forcecast>::ensure( y);
+ if( !labels){ throw std::invalid_argument( "y must be a 1d array of class indices"); }
+ std::vector< std::size_t> result( labels.size());
+ const std::int64_t* data = labels.data();
+ for( std::size_t i = 0; i < result.size(); ++i){
+  if( data[ i] < 0){ throw std::invalid_argument( "class indices must be non-negative"); }
+  result[ i] = data[ i];
+ }
+ return result;
+}
+
+/**
+ * out when it is a writable, C contiguous array of exactly native T and the
+ * given shape, a new array otherwise when out is None. Needs the GIL.
+ */
+template< typename T>
+py::array_t< T> output_array( const py::object& out, const std::vector< std::size_t>& shape){
+ if( out.is_none()){ return py::array_t< T>( shape); }
+ if( !py::isinstance< py::array>( out)){ throw std::invalid_argument( "out must be a numpy array"); }
+ const py::array a = py::reinterpret_borrow< py::array>( out);
+ if( !holds< T>( a)){ throw std::invalid_argument( "out has the wrong dtype"); }
+ if( a.ndim() != shape.size()){ throw std::invalid_argument( "out has the wrong shape"); }
+ std::size_t stride = sizeof( T);
+ for( std::size_t d = shape.size(); d-- > 0;){
+  if( a.shape( d) != shape[ d]){ throw std::invalid_argument( "out has the wrong shape"); }
+  if( shape[ d] > 1 && a.strides( d) != stride){ throw std::invalid_argument( "out must be C contiguous"); }
+  stride *= shape[ d];
+ }
+ if( !a.writeable()){ throw std::invalid_argument( "out is read only"); }
+ return py::reinterpret_borrow< py::array_t< T> >( out);
+}
+
+/**
+ * Contiguous bytes of a buffer protocol object, which must stay alive
+ * while the result is used. Needs the GIL.
+ */
+std::pair< const char*, std::size_t> bytes_of( const py::buffer_info& info){
+ std::size_t stride = info.itemsize;
+ for( std::size_t d = info.ndim; d-- > 0;){
+  if( info.shape[ d] > 1 && info.strides[ d] != stride){ throw std::invalid_argument( "buffer must be C contiguous"); }
+  stride *= info.shape[ d];
+ }
+ return std::make_pair( static_cast< const char*>( info.ptr), info.size*info.itemsize);
+}
+
+/**
+ * An immutable serialized forest, exported through the buffer protocol.
+ */
+class model_buffer {
+public:
+ explicit model_buffer( std::string bytes): bytes_( std::move( bytes)) {}
+ const std::string& bytes() const { return bytes_; }
+private:
+ std::string bytes_;
+}; //end class model_buffer
+
+/**
+ * The forest behind the Python RandomForest class.
+ */
+class py_forest {
+public:
+ py_forest( std::size_t n_estimators, std::size_t max_depth, std::size_t min_samples_split,
+            std::size_t min_samples_leaf, const std::string& max_features, const std::string& criterion,
+            bool bootstrap, int random_seed){
+     params_.n_estimators = n_estimators;
+     params_.max_depth = max_depth;
+     params_.min_samples_split = min_samples_split;
+     params_.min_samples_leaf = min_samples_leaf;
+     params_.max_features = max_features;
+     params_.criterion = criterion;
+     params_.bootstrap = bootstrap;
+     params_.random_seed = random_seed;
+     forest_ = forest_type( params_);
+ }
+
+ explicit py_forest( forest_type forest): params_( forest.params()), forest_( std::move( forest)) {}
+
+ //Reads a forest from the contiguous buffer of any object, with the GIL released
+ static forest_type deserialize( py::buffer b){
+     const py::buffer_info info = b.request();
+     const auto bytes = bytes_of( info);
+     py::gil_scoped_release release;
+     return ml::deserialize< label_type>( bytes.first, bytes.second);
+ }
+
+ std::string serialize() const{
+     py::gil_scoped_release release;
+     std::shared_lock< std::shared_timed_mutex> lock( mutex_);
+     return ml::serialize( forest_);
+ }
+
+ void fit( const py::object& X, const py::array& y){
+     const std::vector< std::size_t> labels = labels_of( y);
+     ml::columnar_dataset dataset;
+     if( foreign_dataset( X, dataset)){
+      if( dataset.height() != labels.size()){ throw std::invalid_argument( "X and y have different numbers of rows"); }
+      forest_type trained( params_);
+      py::gil_scoped_release release;
+      ml::fit( trained, dataset, labels);
+      install( std::move( trained));
+      return;
+     }
+     with_matrix( array_of( X), [&]( const auto& view){
+      if( view.height() != labels.size()){ throw std::invalid_argument( "X and y have different numbers of rows"); }
+      forest_type trained( params_);
+      py::gil_scoped_release release;
+      ml::fit( trained, ml::columnar_view( view), labels);
+      install( std::move( trained));
+     });
+ }
+
+ //Replaces the forest, waiting for running predictions
+ void install( forest_type trained){
+     std::unique_lock< std::shared_timed_mutex> lock( mutex_);
+     forest_ = std::move( trained);
+ }
+
+ const ml::rf_train_params& params() const { return params_; }
+
+ py::array predict( const py::object& X, const py::object& out, std::size_t n_threads) const{
+     py::array_t< label_type> result;
+     ml::columnar_dataset dataset;
+     if( foreign_dataset( X, dataset)){
+      result = output_array< label_type>( out, { dataset.height() });
+      label_type* data = result.mutable_data();
+      py::gil_scoped_release release;
+      std::shared_lock< std::shared_timed_mutex> lock( mutex_);
+      ml::parallel_for( dataset.height(), n_threads, PREDICT_BLOCK_ROWS, [&]( std::size_t begin, std::size_t end){
+       for( std::size_t i = begin; i < end; ++i){ data[ i] = forest_.predict( dataset.row( i)); }
+      });
+      return std::move( result);
+     }
+     with_matrix( array_of( X), [&]( const auto& view){
+      result = output_array< label_type>( out, { view.height() });
+      label_type* data = result.mutable_data();
+      py::gil_scoped_release release;
+      std::shared_lock< std::shared_timed_mutex> lock( mutex_);
+      forest_.predict_parallel( view, data, n_threads);
+     });
+     return std::move( result);
+ }
+
+ py::array predict_proba( const py::object& X, const py::object& out, std::size_t n_threads) const{
+     py::array_t< float> result;
+     ml::columnar_dataset dataset;
+     if( foreign_dataset( X, dataset)){
+      const std::size_t n_classes = this->n_classes();
+      result = output_array< float>( out, { dataset.height(), n_classes });
+      float* data = result.mutable_data();
+      py::gil_scoped_release release;
+      std::shared_lock< std::shared_timed_mutex> lock( mutex_);
+      if( forest_.n_classes() != n_classes){ throw std::runtime_error( "predict_proba: the forest was refit"); }
+      ml::parallel_for( dataset.height(), n_threads, PREDICT_BLOCK_ROWS, [&]( std::size_t begin, std::size_t end){
+       for( std::size_t i = begin; i < end; ++i){
+        const std::vector< float> proba = forest_.predict_proba( dataset.row( i));
+        std::copy( proba.begin(), proba.end(), data + i*n_classes);
+       }
+      });
+      return std::move( result);
+     }
+     with_matrix( array_of( X), [&]( const auto& view){
+      const std::size_t n_classes = this->n_classes();
+      result = output_array< float>( out, { view.height(), n_classes });
+      float* data = result.mutable_data();
+      py::gil_scoped_release release;
+      std::shared_lock< std::shared_timed_mutex> lock( mutex_);
+      //A fit() in between may have changed the number of classes
+      if( forest_.n_classes() != n_classes){ throw std::runtime_error( "predict_proba: the forest was refit"); }
+      ml::parallel_for( view.height(), n_threads, PREDICT_BLOCK_ROWS, [&]( std::size_t begin, std::size_t end){
+       forest_.predict_proba( view.block( begin, 0, end-begin, view.width()), data + begin*n_classes);
+      });
+     });
+     return std::move( result);
+ }
+
+ std::size_t size() const {
+     std::shared_lock< std::shared_timed_mutex> lock( mutex_);
+     return forest_.size();
+ }
+
+ std::size_t n_classes() const {
+     std::shared_lock< std::shared_timed_mutex> lock( mutex_);
+     return forest_.n_classes();
+ }
+
+private:
+ ml::rf_train_params params_;
+ forest_type forest_;
+ mutable std::shared_timed_mutex mutex_;
+}; //end class py_forest
+
+/**
+ * A fit() running on its own thread, behind the Python FitHandle class.
+ *
+ * The handle keeps the RandomForest and the training data alive until
+ * the thread is done, and installs the forest into the RandomForest when
+ * training ends, the partial forest when cancelled. Done callbacks run on
+ * the training thread with the GIL held, or at once if already done.
+ * Pending callbacks keep the handle alive until they have run; otherwise
+ * dropping the handle cancels the training and waits for it.
+ */
+class fit_handle {
+public:
+ fit_handle( py::object self, const py::object& X, const py::array& y):
+ self_( self), labels_( labels_of( y)) {
+     py_forest& target = self_.cast< py_forest&>();
+     if( !foreign_dataset( X, dataset_)){
+      const py::array viewed = viewable( array_of( X));
+      X_ = viewed;
+      with_view( viewed, [&]( const auto& view){ dataset_ = ml::columnar_view( view); });
+     }
+     if( dataset_.height() != labels_.size()){ throw std::invalid_argument( "X and y have different numbers of rows"); }
+     n_estimators_ = target.params().n_estimators;
+     thread_ = std::thread( [this, &target](){
+      try {
+       forest_type trained( target.params());
+       ml::fit( trained, dataset_, labels_, progress_);
+       target.install( std::move( trained));
+      } catch( ...){ error_ = std::current_exception(); }
+      finish();
+     });
+ }
+
+ fit_handle( const fit_handle&) = delete;
+ fit_handle& operator=( const fit_handle&) = delete;
+
+ ~fit_handle(){
+     progress_.cancel();
+     //The last reference can go with a callback, on the training thread itself
+     if( thread_.get_id() == std::this_thread::get_id()){ thread_.detach(); return; }
+     py::gil_scoped_release release;
+     if( thread_.joinable()){ thread_.join(); }
+ }
+
+ void cancel(){ progress_.cancel(); }
+ bool cancelled() const { return progress_.cancelled(); }
+ std::size_t trees_completed() const { return progress_.trees_completed(); }
+ std::size_t n_estimators() const { return n_estimators_; }
+ double oob_error() const { return progress_.oob_error(); }
+ std::vector< double> tree_seconds() const { return progress_.tree_seconds(); }
+
+ bool done() const {
+     std::lock_guard< std::mutex> lock( mutex_);
+     return finished_;
+ }
+
+ //True when training ended within timeout seconds, None waits without limit
+ bool wait( const py::object& timeout) const{
+     const bool forever = timeout.is_none();
+     const double seconds = forever ? 0.0 : timeout.cast< double>();
+     py::gil_scoped_release release;
+     std::unique_lock< std::mutex> lock( mutex_);
+     if( forever){ finished_cv_.wait( lock, [&]{ return finished_; }); }
+     else { finished_cv_.wait_for( lock, std::chrono::duration< double>( seconds), [&]{ return finished_; }); }
+     return finished_;
+ }
+
+ //The RandomForest once training ended, rethrowing a training error
+ py::object result( const py::object& timeout) const{
+     if( !wait( timeout)){
+      PyErr_SetString( PyExc_TimeoutError, "fit_async: training is still running");
+      throw py::error_already_set();
+     }
+     if( error_){ std::rethrow_exception( error_); }
+     return self_;
+ }
+
+ void add_done_callback( const py::object& f){
+     {
+      std::lock_guard< std::mutex> lock( mutex_);
+      if( !finished_){
+       //Until finish() runs the callbacks, they hold the handle
+       if( !pending_){ pending_ = py::cast( this, py::return_value_policy::reference); }
+       callbacks_.push_back( f);
+       return;
+      }
+     }
+     f( py::cast( this, py::return_value_policy::reference));
+ }
+
+private:
+ void finish(){
+     std::vector< py::object> callbacks;
+     py::object handle;
+     {
+      std::lock_guard< std::mutex> lock( mutex_);
+      finished_ = true;
+      callbacks.swap( callbacks_);
+      handle = std::move( pending_);
+     }
+     finished_cv_.notify_all();
+     if( callbacks.empty()){ return; }
+     py::gil_scoped_acquire acquire;
+     //Releasing handle may destroy this handle, nothing touches it afterwards
+     for( auto& f: callbacks){
+      try { f( handle); }
+      catch( py::error_already_set& e){ e.restore(); PyErr_WriteUnraisable( f.ptr()); }
+     }
+     callbacks.clear();
+     handle = py::object();
+ }
+
+ py::object self_;
+ py::object X_;
+ std::vector< std::size_t> labels_;
+ ml::columnar_dataset dataset_;
+ std::size_t n_estimators_ = 0;
+ ml::training_progress progress_;
+ std::exception_ptr error_;
+ mutable std::mutex mutex_;
+ mutable std::condition_variable finished_cv_;
+ bool finished_ = false;
+ std::vector< py::object> callbacks_;
+ py::object pending_;
+ std::thread thread_;
+}; //end class fit_handle
+
+} //end namespace
+
+PYBIND11_PLUGIN( rf){
+ py::module m( "rf", "Random forests");
+
+ py::class_< py_forest>( m, "RandomForest")
+  .def( py::init< std::size_t, std::size_t, std::size_t, std::size_t, std::string, std::string, bool, int>(),
+        py::arg( "n_estimators")=10, py::arg( "max_depth")=0, py::arg( "min_samples_split")=2,
+        py::arg( "min_samples_leaf")=1, py::arg( "max_features")="auto", py::arg( "criterion")="gini",
+        py::arg( "bootstrap")=true, py::arg( "random_seed")=0)
+  .def( "fit", []( py_forest& f, const py::object& X, const py::array& y) -> py_forest& {
+         f.fit( X, y);
+         return f;
+        }, py::arg( "X"), py::arg( "y"), py::return_value_policy::reference,
+        "Trains a new forest on X (rows are samples) and class indices y, returns self.")
+  .def( "fit_async", []( py::object self, const py::object& X, const py::array& y){
+         return new fit_handle( self, X, y);
+        }, py::arg( "X"), py::arg( "y"),
+        "Starts fit( X, y) on a background thread and returns a FitHandle to follow or cancel it.")
+  .def( "predict", &py_forest::predict, py::arg( "X"), py::arg( "out")=py::none(), py::arg( "n_threads")=1,
+        "Class index of every row of X as int32, into out when given.")
+  .def( "predict_proba", &py_forest::predict_proba, py::arg( "X"), py::arg( "out")=py::none(), py::arg( "n_threads")=1,
+        "Class probabilities of every row of X as float32 (rows, n_classes), into out when given.")
+  .def_property_readonly( "n_classes", &py_forest::n_classes)
+  .def( "__len__", &py_forest::size)
+  .def( "to_buffer", []( const py_forest& f){ return model_buffer( f.serialize()); },
+        "The serialized forest as a ModelBuffer, readable through the buffer protocol.")
+  .def_static( "from_buffer", []( py::buffer b){ return new py_forest( py_forest::deserialize( b)); }, py::arg( "buffer"),
+        "A forest read from any contiguous buffer holding a serialized forest.")
+  .def( "__getstate__", []( const py_forest& f){ return py::bytes( f.serialize()); })
+  .def( "__setstate__", []( py_forest& f, py::buffer state){
+         new (&f) py_forest( py_forest::deserialize( state));
+        });
+
+ py::class_< model_buffer>( m, "ModelBuffer", py::buffer_protocol())
+  .def_buffer( []( model_buffer& b){
+         return py::buffer_info( (void*)b.bytes().data(), 1, py::format_descriptor< std::uint8_t>::format(),
+                                 1, { b.bytes().size() }, { 1 });
+        })
+  .def( "__len__", []( const model_buffer& b){ return b.bytes().size(); });
 
+ py::class_< fit_handle>( m, "FitHandle")
+  .def( "done", &fit_handle::done)
+  .def( "cancel", &fit_handle::cancel,
+        "Stops training at the next node expansion; the trees completed so far become the forest.")
+  .def( "wait", &fit_handle::wait, py::arg( "timeout")=py::none(),
+        "Waits for training to end, True if it did within timeout seconds.")
+  .def( "result", &fit_handle::result, py::arg( "timeout")=py::none(),
+        "The trained RandomForest, raising TimeoutError if training is still running after timeout seconds.")
+  .def( "add_done_callback", &fit_handle::add_done_callback, py::arg( "fn"),
+        "Calls fn( handle) once training ends, from the training thread.")
+  .def_property_readonly( "cancelled", &fit_handle::cancelled)
+  .def_property_readonly( "trees_completed", &fit_handle::trees_completed)
+  .def_property_readonly( "n_estimators", &fit_handle::n_estimators)
+  .def_property_readonly( "oob_error", &fit_handle::oob_error)
+  .def_property_readonly( "tree_seconds", &fit_handle::tree_seconds);
 
-PYBIND11_PLUGIN(ml) {
-    py::module m("ml", "Machine Learning Code");
-
-    using Rf = ml::Random_forest;
-
-    py::class_<Rf> rf(m, "RandomForest");
-    .def("__init__",
-      [](Rf &instance, std::list<c> arg) {
-          new (&instance) s(std::begin(arg), std::end(arg));
-     })
-    template< typename T>
-    using Matrix = py::array<T, py::array::f_style | py::array::forcecast>;
-    
-    typedef Matrix<double> DoubleMatrix;
-    typedef Matrix<float> FloatMatrix;
-    
-    rf.def("fit", [](Rf& rfi, DoubleMatrix& X, DoubleMatrix& y){
-    	rfi.fit(X,y);
-	return rfi; 
-    });
-    rf.def("fit", [](Rf& rfi, FloatMatrix& X, DoubleMatrix& y){
-    	rfi.fit(X,y);
-    	return rfi; 
-    });
-    rf.def("fit", [](Rf& rfi, DoubleMatrix& X, FloatMatrix& y){
-    	rfi.fit(X,y);
-	return rfi; 
-    });
-    rf.def("fit", [](Rf& rfi, FloatMatrix& X, FloatMatrix& y){
-    	rfi.fit(X,y);
-	return rfi; 
-    });
-    rf.def("predict", [](Rf& rfi, DoubleMatrix& x){ return rfi.predict(x); });
-    rf.def("predict", [](Rf& rfi, FloatMatrix& x){ return rfi.predict(x); });
-    return m.ptr();
+ return m.ptr();
 }
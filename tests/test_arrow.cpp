@@ -0,0 +1,288 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+//Project
+#include <random_forest/arrow.hpp>
+#include <random_forest/train_rf.hpp>
+
+namespace ml = ayasdi::ml;
+
+namespace {
+
+//An Arrow array over buffers owned by the test, counting releases
+struct test_array {
+ std::vector< const void*> buffers;
+ ArrowArray array;
+ int* released;
+
+ test_array( std::int64_t length, const void* validity, const void* values, int* released_,
+             std::int64_t null_count=0, std::int64_t offset=0):
+ buffers{ validity, values}, released( released_) {
+     array = ArrowArray{ length, null_count, offset, 2, 0, buffers.data(), nullptr, nullptr, &release, this };
+ }
+ static void release( ArrowArray* a){
+     ++*static_cast< test_array*>( a->private_data)->released;
+     a->release = nullptr;
+ }
+};
+
+ArrowSchema schema_of( const char* format, const char* name=""){
+ return ArrowSchema{ format, name, nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr };
+}
+
+//A stream of arrays, float64 unless schema is changed
+struct test_stream {
+ std::vector< test_array*> batches;
+ std::size_t next = 0;
+ ArrowArrayStream stream;
+ ArrowSchema schema = schema_of( "g");
+ int* released;
+
+ test_stream( std::vector< test_array*> batches_, int* released_): batches( batches_), released( released_) {
+     stream.get_schema = []( ArrowArrayStream* s, ArrowSchema* out){
+         *out = static_cast< test_stream*>( s->private_data)->schema;
+         return 0;
+     };
+     stream.get_next = []( ArrowArrayStream* s, ArrowArray* out){
+         auto self = static_cast< test_stream*>( s->private_data);
+         if( self->next == self->batches.size()){ out->release = nullptr; }
+         else { *out = self->batches[ self->next++]->array; }
+         return 0;
+     };
+     stream.get_last_error = []( ArrowArrayStream*) -> const char*{ return nullptr; };
+     stream.release = []( ArrowArrayStream* s){
+         ++*static_cast< test_stream*>( s->private_data)->released;
+         s->release = nullptr;
+     };
+     stream.private_data = this;
+ }
+};
+
+} //end namespace
+
+TEST_CASE("Arrow Import", "[arrow]"){
+ int released = 0;
+ const std::vector< double> doubles = { 1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5, 8.5, 9.5 };
+ const std::vector< std::uint8_t> bytes = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+ const std::vector< std::int32_t> ints = { 0, 1, 2, 1, 0, 2, 1, 1, 0 };
+ //Rows 2 and 8 are null
+ const std::uint8_t validity[ 2] = { 0xfb, 0x00 };
+
+ SECTION("Primitive columns without nulls are viewed in place"){
+  test_array a( 9, nullptr, doubles.data(), &released);
+  {
+   auto dataset = ml::import_arrow( &a.array, schema_of( "g"));
+   REQUIRE( a.array.release == nullptr);
+   REQUIRE( dataset.height() == 9);
+   REQUIRE( dataset.width() == 1);
+   REQUIRE( dataset.column( 0).type() == ml::dtype::float64);
+   REQUIRE( dataset.column( 0).data() == doubles.data());
+   REQUIRE( dataset( 4, 0) == 5.5);
+   REQUIRE( released == 0);
+  }
+  REQUIRE( released == 1);
+ }
+
+ SECTION("Nulls become NaN"){
+  test_array a( 9, validity, doubles.data(), &released, 2);
+  auto dataset = ml::import_arrow( &a.array, schema_of( "g"));
+  REQUIRE( dataset.column( 0).data() != doubles.data());
+  REQUIRE( std::isnan( dataset( 2, 0)));
+  REQUIRE( std::isnan( dataset( 8, 0)));
+  REQUIRE( dataset( 3, 0) == 4.5);
+  //Unknown null count, the bitmap decides
+  test_array b( 9, validity, bytes.data(), &released, -1);
+  auto narrow = ml::import_arrow( &b.array, schema_of( "C"));
+  REQUIRE( narrow.column( 0).type() == ml::dtype::float32);
+  REQUIRE( std::isnan( narrow( 2, 0)));
+  REQUIRE( narrow( 1, 0) == 2);
+ }
+
+ SECTION("Record batches, offsets and conversions"){
+  test_array x( 9, nullptr, doubles.data(), &released);
+  test_array y( 9, nullptr, bytes.data(), &released);
+  test_array z( 9, validity, ints.data(), &released, 2);
+  ArrowArray* arrays[ 3] = { &x.array, &y.array, &z.array };
+  ArrowSchema fields[ 3] = { schema_of( "g", "x"), schema_of( "C", "y"), schema_of( "i", "z") };
+  ArrowSchema* field_ptrs[ 3] = { &fields[ 0], &fields[ 1], &fields[ 2] };
+  test_array batch( 6, nullptr, nullptr, &released, 0, 3);
+  batch.array.n_buffers = 1;
+  batch.array.n_children = 3;
+  batch.array.children = arrays;
+  ArrowSchema schema = schema_of( "+s");
+  schema.n_children = 3;
+  schema.children = field_ptrs;
+  {
+   auto dataset = ml::import_arrow( &batch.array, schema);
+   REQUIRE( dataset.height() == 6);
+   REQUIRE( dataset.width() == 3);
+   REQUIRE( dataset.column( 0).data() == doubles.data() + 3);
+   REQUIRE( dataset.column( 1).data() == bytes.data() + 3);
+   REQUIRE( dataset.column( 2).type() == ml::dtype::float32);
+   REQUIRE( dataset( 0, 0) == 4.5);
+   REQUIRE( dataset( 0, 1) == 4);
+   REQUIRE( dataset( 0, 2) == 1);
+   REQUIRE( std::isnan( dataset( 5, 2)));
+  }
+  //Only the parent is released, it owns its children
+  REQUIRE( released == 1);
+ }
+
+ SECTION("Streams"){
+  test_array first( 9, nullptr, doubles.data(), &released);
+  test_array second( 9, validity, doubles.data(), &released, 2, 0);
+  test_stream one( { &first}, &released);
+  {
+   auto dataset = ml::import_arrow_stream( &one.stream);
+   REQUIRE( dataset.column( 0).data() == doubles.data());
+  }
+  REQUIRE( released == 2);
+  test_array third( 9, nullptr, doubles.data(), &released);
+  test_stream two( { &third, &second}, &released);
+  auto dataset = ml::import_arrow_stream( &two.stream);
+  REQUIRE( dataset.height() == 18);
+  REQUIRE( dataset( 9, 0) == 1.5);
+  REQUIRE( std::isnan( dataset( 11, 0)));
+  REQUIRE( released == 5);
+ }
+
+ SECTION("Dictionaries are merged across batches"){
+  //Codes into { "a", "b" } and into { "b", "c" }
+  const std::vector< std::int8_t> codes1 = { 0, 1, 1 }, codes2 = { 0, 1, 0 };
+  const std::vector< std::int32_t> offsets = { 0, 1, 2 };
+  const char letters1[] = "ab", letters2[] = "bc";
+  int dictionaries_released = 0;
+  test_array dictionary1( 2, nullptr, offsets.data(), &dictionaries_released);
+  test_array dictionary2( 2, nullptr, offsets.data(), &dictionaries_released);
+  dictionary1.buffers.push_back( letters1);
+  dictionary2.buffers.push_back( letters2);
+  for( test_array* d: { &dictionary1, &dictionary2 }){
+   d->array.buffers = d->buffers.data();
+   d->array.n_buffers = 3;
+  }
+  test_array first( 3, nullptr, codes1.data(), &released);
+  test_array second( 3, nullptr, codes2.data(), &released);
+  first.array.dictionary = &dictionary1.array;
+  second.array.dictionary = &dictionary2.array;
+  ArrowSchema strings = schema_of( "u");
+  test_stream stream( { &first, &second}, &released);
+  stream.schema = schema_of( "c");
+  stream.schema.dictionary = &strings;
+  auto dataset = ml::import_arrow_stream( &stream.stream);
+  REQUIRE( dataset.height() == 6);
+  const double expected[ 6] = { 0, 1, 1, 1, 2, 1 };
+  for( std::size_t i = 0; i < 6; ++i){ REQUIRE( dataset( i, 0) == expected[ i]); }
+  //Other dictionaries cannot be merged
+  test_array third( 3, nullptr, codes1.data(), &released), fourth( 3, nullptr, codes2.data(), &released);
+  third.array.dictionary = &dictionary1.array;
+  fourth.array.dictionary = &dictionary2.array;
+  ArrowSchema ints = schema_of( "i");
+  test_stream other( { &third, &fourth}, &released);
+  other.schema = schema_of( "c");
+  other.schema.dictionary = &ints;
+  REQUIRE_THROWS_AS( ml::import_arrow_stream( &other.stream), std::invalid_argument&);
+  REQUIRE( released == 6);
+ }
+
+ SECTION("Unsupported columns throw and release"){
+  test_array a( 9, nullptr, doubles.data(), &released);
+  REQUIRE_THROWS_AS( ml::import_arrow( &a.array, schema_of( "u")), std::invalid_argument&);
+  REQUIRE( released == 1);
+ }
+}
+
+namespace {
+
+struct test_tensor {
+ DLManagedTensor managed;
+ std::vector< std::int64_t> shape, strides;
+ int* deleted;
+
+ test_tensor( const void* data, DLDataType type, std::vector< std::int64_t> shape_,
+              std::vector< std::int64_t> strides_, int* deleted_):
+ shape( shape_), strides( strides_), deleted( deleted_) {
+     managed.dl_tensor = DLTensor{ const_cast< void*>( data), DLDevice{ kDLCPU, 0}, (std::int32_t)shape.size(), type,
+                                   shape.data(), strides.empty() ? nullptr : strides.data(), 0 };
+     managed.manager_ctx = this;
+     managed.deleter = []( DLManagedTensor* t){ ++*static_cast< test_tensor*>( t->manager_ctx)->deleted; };
+ }
+};
+
+} //end namespace
+
+TEST_CASE("DLPack Import", "[arrow]"){
+ int deleted = 0;
+ //3 rows, 4 columns, row major
+ const std::vector< float> values = { 0, 1, 2, 3, 10, 11, 12, 13, 20, 21, 22, 23 };
+
+ SECTION("Row major floats are viewed in place"){
+  test_tensor t( values.data(), DLDataType{ kDLFloat, 32, 1}, { 3, 4}, {}, &deleted);
+  {
+   auto dataset = ml::import_dlpack( &t.managed);
+   REQUIRE( dataset.height() == 3);
+   REQUIRE( dataset.width() == 4);
+   REQUIRE( dataset.column( 2).data() == values.data() + 2);
+   REQUIRE( dataset.column( 2).stride() == 4);
+   REQUIRE( dataset( 1, 2) == 12);
+   REQUIRE( deleted == 0);
+  }
+  REQUIRE( deleted == 1);
+ }
+
+ SECTION("Strided and converted"){
+  //The transpose: 4 rows, 3 columns
+  test_tensor t( values.data(), DLDataType{ kDLFloat, 32, 1}, { 4, 3}, { 1, 4}, &deleted);
+  auto dataset = ml::import_dlpack( &t.managed);
+  REQUIRE( dataset( 3, 1) == 13);
+  REQUIRE( dataset.column( 1).stride() == 1);
+  const std::vector< std::int64_t> longs = { 5, 300, 7 };
+  test_tensor l( longs.data(), DLDataType{ kDLInt, 64, 1}, { 3}, {}, &deleted);
+  auto converted = ml::import_dlpack( &l.managed);
+  REQUIRE( converted.column( 0).type() == ml::dtype::uint16);
+  REQUIRE( converted( 1, 0) == 300);
+  REQUIRE( deleted == 1);
+ }
+
+ SECTION("Device tensors are rejected"){
+  test_tensor t( values.data(), DLDataType{ kDLFloat, 32, 1}, { 3, 4}, {}, &deleted);
+  t.managed.dl_tensor.device.device_type = kDLCUDA;
+  REQUIRE_THROWS_AS( ml::import_dlpack( &t.managed), std::invalid_argument&);
+  REQUIRE( deleted == 1);
+  test_tensor empty_type( values.data(), DLDataType{ kDLFloat, 0, 1}, { 3, 4}, {}, &deleted);
+  REQUIRE_THROWS_AS( ml::import_dlpack( &empty_type.managed), std::invalid_argument&);
+  REQUIRE( deleted == 2);
+ }
+}
+
+TEST_CASE("Missing Values", "[arrow]"){
+ std::mt19937 gen( 11);
+ std::uniform_real_distribution<> uniform;
+ const std::size_t n = 1000;
+ std::vector< double> x0( n), x1( n);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  x0[ i] = uniform( gen);
+  x1[ i] = uniform( gen);
+  y[ i] = x0[ i] > 0.5;
+  //A third of x0 is missing, all of those of class 1
+  if( i % 3 == 0){
+   x0[ i] = std::numeric_limits< double>::quiet_NaN();
+   y[ i] = 1;
+  }
+ }
+ ml::columnar_dataset dataset;
+ dataset.add_column( ml::column( x0.data(), n));
+ dataset.add_column( ml::column( x1.data(), n));
+ ml::rf_train_params params;
+ params.n_estimators = 10;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, dataset, y);
+ for( auto& t: forest){
+  for( std::size_t k = 0; k < t.size(); ++k){ REQUIRE( !std::isnan( t[ k].split_value_)); }
+ }
+ std::size_t correct = 0;
+ for( std::size_t i = 0; i < n; ++i){ correct += forest.predict( dataset.row( i)) == (int)y[ i]; }
+ REQUIRE( correct > 0.95*n);
+}
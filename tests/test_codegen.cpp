@@ -0,0 +1,132 @@
+#include "catch.hpp"
+
+#include <sstream>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+//Project
+#include <random_forest/codegen.hpp>
+#include <random_forest/train_rf.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Code Generation", "[codegen]"){
+ //x[ 2] < 0.1 ? 1 : 0
+ ml::random_forest_classifier< int> forest;
+ std::size_t n_classes = 2;
+ forest.n_classes( n_classes);
+ auto& t = forest.insert_next_tree();
+ t.set_split( t.insert_root(), 2, 0.1);
+ auto children = t.insert_children( t.root());
+ t.generate_leaf_node( std::get< 0>( children), 1);
+ t.generate_leaf_node( std::get< 1>( children), 0);
+
+ SECTION("Nested If"){
+  std::ostringstream out;
+  ml::write_cpp( forest, out);
+  const auto source = out.str();
+  REQUIRE( source.find( "int rf_predict( const double* x)") != std::string::npos);
+  //Thresholds round trip exactly
+  REQUIRE( source.find( "if( x[ 2] < 0.10000000000000001)") != std::string::npos);
+  REQUIRE( source.find( "votes[ tree_0( x)]++;") != std::string::npos);
+ }
+ SECTION("Branchless"){
+  std::ostringstream out;
+  ml::codegen_options options;
+  options.style = ml::codegen_style::branchless;
+  options.function_name = "score";
+  ml::write_cpp( forest, out, options);
+  const auto source = out.str();
+  REQUIRE( source.find( "int score( const double* x)") != std::string::npos);
+  REQUIRE( source.find( "child[ 6] = { 1, 2, 1, 1, 2, 2 }") != std::string::npos);
+  REQUIRE( source.find( "d < 1;") != std::string::npos);
+  REQUIRE( source.find( "if( x[") == std::string::npos);
+ }
+ SECTION("Stream Precision Is Restored"){
+  std::ostringstream out;
+  out.precision( 3);
+  ml::write_cpp( forest, out);
+  REQUIRE( out.precision() == 3);
+ }
+}
+
+namespace {
+
+/**
+ * Predictions of the code generated for forest on the rows of X, from
+ * compiling it with $CXX (c++ by default) and a main reading rows from
+ * stdin. Empty if there is no compiler.
+ */
+std::vector< int> compiled_predictions( const ml::random_forest_classifier< int>& forest, const ml::Matrix< double>& X,
+                                        const ml::codegen_options& options){
+ const std::string base = "/tmp/test_codegen." + std::to_string( ::getpid()), source = base + ".cpp", rows = base + ".txt";
+ const char* cxx = std::getenv( "CXX");
+ const std::string compiler = cxx ? cxx : "c++";
+ if( std::system( (compiler + " --version > /dev/null 2>&1").c_str()) != 0){ return std::vector< int>(); }
+ {
+  std::ofstream out( source);
+  ml::write_cpp( forest, out, options);
+  out << "#include <cstdio>\n"
+      << "int main(){\n"
+      << " double x[ " << X.width() << "];\n"
+      << " for( ;;){\n"
+      << "  for( int j = 0; j < " << X.width() << "; ++j){ if( std::scanf( \"%lf\", &x[ j]) != 1){ return 0; } }\n"
+      << "  std::printf( \"%d\\n\", " << options.function_name << "( x));\n"
+      << " }\n"
+      << "}\n";
+  std::ofstream data( rows);
+  data.precision( std::numeric_limits< double>::max_digits10);
+  for( std::size_t i = 0; i < X.height(); ++i){
+   for( std::size_t j = 0; j < X.width(); ++j){ data << X( i, j) << " "; }
+   data << "\n";
+  }
+ }
+ REQUIRE( std::system( (compiler + " -O1 -o " + base + " " + source).c_str()) == 0);
+ std::vector< int> labels;
+ FILE* run = ::popen( (base + " < " + rows).c_str(), "r");
+ REQUIRE( run != nullptr);
+ int label;
+ while( std::fscanf( run, "%d", &label) == 1){ labels.push_back( label); }
+ REQUIRE( ::pclose( run) == 0);
+ std::remove( source.c_str());
+ std::remove( rows.c_str());
+ std::remove( base.c_str());
+ return labels;
+}
+
+} //end namespace
+
+TEST_CASE("Generated Code Predicts Like The Forest", "[codegen]"){
+ std::mt19937 gen( 31);
+ std::uniform_real_distribution<> uniform;
+ const std::size_t n = 400;
+ ml::Matrix< double> X( n, 3);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  for( std::size_t j = 0; j < 3; ++j){ X( i, j) = uniform( gen); }
+  y[ i] = (X( i, 0) > 0.5) + (X( i, 1) > 0.3 && X( i, 2) < 0.6);
+  //Missing values go right, in the generated code as in the forest
+  if( i % 17 == 0){ X( i, 1) = std::numeric_limits< double>::quiet_NaN(); }
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 6;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ std::vector< int> expected( n);
+ for( std::size_t i = 0; i < n; ++i){ expected[ i] = forest.predict( X.row( i)); }
+ for( auto style: { ml::codegen_style::nested_if, ml::codegen_style::branchless }){
+  ml::codegen_options options;
+  options.style = style;
+  const auto labels = compiled_predictions( forest, X, options);
+  if( labels.empty()){
+   WARN( "no C++ compiler, the generated code was not compiled");
+   return;
+  }
+  REQUIRE( labels == expected);
+ }
+}
@@ -0,0 +1,77 @@
+#include "catch.hpp"
+
+#include <random>
+//Project
+#include <random_forest/train_rf.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Column Types", "[columnar_dataset]"){
+ std::vector< double> months = { 1, 12, 7, 3};
+ std::vector< double> times = { 1835, 2341, 615, 12};
+ std::vector< double> halves = { 0.5, -1.25, 3, 7};
+ std::vector< double> thirds = { 1.0/3, 2, 3, 4};
+ REQUIRE( ml::narrowest_dtype( months.data(), months.size()) == ml::dtype::uint8);
+ REQUIRE( ml::narrowest_dtype( times.data(), times.size()) == ml::dtype::uint16);
+ REQUIRE( ml::narrowest_dtype( halves.data(), halves.size()) == ml::dtype::float32);
+ REQUIRE( ml::narrowest_dtype( thirds.data(), thirds.size()) == ml::dtype::float64);
+ SECTION("Narrowed columns keep their values"){
+  auto c = ml::narrow_column( halves.data(), halves.size());
+  REQUIRE( c.type() == ml::dtype::float32);
+  for( std::size_t i = 0; i < halves.size(); ++i){ REQUIRE( c[ i] == halves[ i]); }
+ }
+ SECTION("Strided views"){
+  ml::column c( months.data()+1, 2, 2);
+  REQUIRE( c.size() == 2);
+  REQUIRE( c[ 0] == 12);
+  REQUIRE( c[ 1] == 3);
+ }
+}
+
+TEST_CASE("Training On Narrow Columns", "[columnar_dataset]"){
+ std::mt19937 gen( 3);
+ std::uniform_int_distribution<> day( 1, 7), minute( 0, 2359);
+ std::normal_distribution<> noise;
+ const std::size_t n = 500;
+ std::vector< double> a( n), b( n), c( n);
+ std::vector< std::size_t> labels( n);
+ for( std::size_t i = 0; i < n; ++i){
+  a[ i] = day( gen); b[ i] = minute( gen); c[ i] = noise( gen);
+  labels[ i] = (a[ i] > 5) || (b[ i] > 1800 && c[ i] > 0);
+ }
+ ml::columnar_dataset narrow, wide;
+ narrow.add_column( ml::narrow_column( a.data(), n));
+ narrow.add_column( ml::narrow_column( b.data(), n));
+ narrow.add_column( ml::narrow_column( c.data(), n));
+ wide.add_column( ml::column( a.data(), n));
+ wide.add_column( ml::column( b.data(), n));
+ wide.add_column( ml::column( c.data(), n));
+ REQUIRE( narrow.column( 0).type() == ml::dtype::uint8);
+ REQUIRE( narrow.column( 1).type() == ml::dtype::uint16);
+ REQUIRE( narrow.bytes() < wide.bytes()/2);
+
+ ml::rf_train_params params;
+ params.n_estimators = 8;
+ ml::random_forest_classifier< int> narrow_forest( params), wide_forest( params);
+ ml::fit( narrow_forest, narrow, labels);
+ ml::fit( wide_forest, wide, labels);
+ SECTION("Split search does not depend on the column type"){
+  REQUIRE( narrow_forest.size() == 8);
+  for( std::size_t t = 0; t < narrow_forest.size(); ++t){ REQUIRE( narrow_forest[ t] == wide_forest[ t]); }
+ }
+ SECTION("Forest fits the training data"){
+  std::size_t correct = 0;
+  for( std::size_t i = 0; i < n; ++i){
+   auto row = narrow.row( i);
+   correct += ((std::size_t)narrow_forest.predict( row) == labels[ i]);
+  }
+  REQUIRE( correct > 0.9*n);
+ }
+ SECTION("Empty datasets are rejected"){
+  const ml::Matrix< double> empty( 0, 3);
+  const std::vector< std::size_t> no_labels;
+  ml::random_forest_classifier< int> forest( params);
+  REQUIRE_THROWS_AS( ml::fit( forest, ml::make_columnar( empty), no_labels), std::invalid_argument&);
+  REQUIRE( forest.size() == 0);
+ }
+}
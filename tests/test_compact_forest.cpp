@@ -0,0 +1,115 @@
+#include "catch.hpp"
+
+#include <random>
+#include <sstream>
+#include <cstring>
+#include <tuple>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/compact_forest.hpp>
+#include <random_forest/simd_traversal.hpp>
+#include <random_forest/model_file.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Compact Forest", "[compact_forest]"){
+ std::mt19937 gen( 9);
+ std::uniform_int_distribution<> month( 1, 12), minute( 0, 2359);
+ const std::size_t n = 1500;
+ ml::Matrix< double> X( n, 3);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  X( i, 0) = month( gen); X( i, 1) = minute( gen); X( i, 2) = 0.25*minute( gen);
+  y[ i] = (X( i, 1) > 1700) || (X( i, 0) == 12 && X( i, 2) > 100);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 15;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ auto frozen = ml::freeze( forest);
+
+ REQUIRE( sizeof( ml::compact_node) == 8);
+ REQUIRE( frozen.size() == forest.size());
+ std::size_t n_nodes = 0;
+ for( auto& t: forest){ n_nodes += t.size(); }
+ REQUIRE( frozen.nodes.size() == n_nodes);
+ SECTION("Integer And Quarter Thresholds Are Exact"){
+  REQUIRE( frozen.exact());
+  REQUIRE( frozen.predict( X) == forest.predict( X));
+ }
+ SECTION("Thresholds Round Down"){
+  REQUIRE( ml::float_threshold( 0.1) <= 0.1);
+  REQUIRE( (double)ml::float_threshold( 0.5) == 0.5);
+ }
+ SECTION("Views Share The Arrays"){
+  auto v = frozen.view();
+  const double row[ 3] = { 12, 5, 200};
+  REQUIRE( v.predict( row) == forest.predict( row));
+  REQUIRE( v.nodes == frozen.nodes.data());
+ }
+ SECTION("Votes Beyond The Class Count Throw"){
+  ml::random_forest_classifier< int> built;
+  std::size_t n_classes = 2;
+  built.n_classes( n_classes);
+  auto& t = built.insert_next_tree();
+  t.set_split( t.insert_root(), 0, 0.5);
+  auto children = t.insert_children( t.root());
+  t.generate_leaf_node( std::get< 0>( children), 1);
+  t.generate_leaf_node( std::get< 1>( children), 70);
+  REQUIRE_THROWS_AS( ml::freeze( built), std::out_of_range&);
+ }
+}
+
+namespace {
+
+//A complete tree of the given depth, with thresholds exact in float
+template< typename Tree, typename Node>
+void grow( Tree& t, Node& n, std::size_t depth, std::mt19937& gen){
+ if( depth == 0){
+  t.generate_leaf_node( n, gen() % 3);
+  return;
+ }
+ t.set_split( n, gen() % 3, (gen() % 1024)/1024.0);
+ auto children = t.insert_children( n);
+ grow( t, std::get< 0>( children), depth-1, gen);
+ grow( t, std::get< 1>( children), depth-1, gen);
+}
+
+} //end namespace
+
+TEST_CASE("Far Splits", "[compact_forest]"){
+ std::mt19937 gen( 32);
+ ml::random_forest_classifier< int> forest;
+ std::size_t n_classes = 3;
+ forest.n_classes( n_classes);
+ std::size_t n_nodes = 0;
+ for( int k = 0; k < 2; ++k){
+  auto& t = forest.insert_next_tree();
+  //Node references must survive the inserts
+  t.reserve( 1 << 18);
+  grow( t, t.insert_root(), 17, gen);
+  n_nodes += t.size();
+ }
+ const auto frozen = ml::freeze( forest);
+ //The root and both its children have left subtrees of 65535 nodes or more
+ REQUIRE( frozen.nodes.size() == n_nodes + 2*3);
+ REQUIRE( frozen.nodes[ 0].is_far());
+ ml::Matrix< double> X( 3000, 3);
+ std::uniform_real_distribution<> uniform;
+ for( std::size_t i = 0; i < X.height(); ++i){
+  for( std::size_t j = 0; j < X.width(); ++j){ X( i, j) = uniform( gen); }
+ }
+ const auto expected = forest.predict( X);
+ REQUIRE( frozen.predict( X) == expected);
+ for( auto level: { ml::simd_level::scalar, ml::simd_level::avx2, ml::simd_level::avx512 }){
+  REQUIRE( ml::simd_predict( frozen, X, level) == expected);
+ }
+ std::ostringstream out;
+ ml::write_model( frozen, out);
+ const std::string image = out.str();
+ ml::aligned_vector< std::uint64_t> buffer( (image.size()+7)/8);
+ std::memcpy( buffer.data(), image.data(), image.size());
+ std::vector< int> labels( X.height());
+ ml::model_view< int>( buffer.data(), image.size()).predict( X, labels.data());
+ REQUIRE( labels == expected);
+}
@@ -0,0 +1,110 @@
+#include "catch.hpp"
+
+#include <random>
+#include <cstdio>
+#include <cstring>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/compressed_forest.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Compressed Forest", "[compressed_forest]"){
+ std::mt19937 gen( 38);
+ std::uniform_int_distribution<> level( 0, 9);
+ std::normal_distribution<> normal;
+ const std::size_t n = 2000;
+ ml::Matrix< double> X( n, 4);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  X( i, 0) = level( gen); X( i, 1) = level( gen); X( i, 2) = level( gen); X( i, 3) = level( gen);
+  y[ i] = (X( i, 0) + X( i, 1) > 9) + (X( i, 2) > 6 && normal( gen) > 0);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 20;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ const auto compressed = ml::compress( forest);
+
+ std::size_t n_internal = 0, source_bytes = 0;
+ for( auto& t: forest){
+  source_bytes += t.size()*sizeof( ml::dtree_node);
+  for( std::size_t i = 0; i < t.size(); ++i){ n_internal += t[ i].is_not_leaf(); }
+ }
+ REQUIRE( compressed.size() == forest.size());
+ SECTION("Predictions Are Unchanged"){
+  REQUIRE( compressed.predict( X) == forest.predict( X));
+  const double row[ 4] = { 3, 7, 9, 1};
+  REQUIRE( compressed.predict( row) == forest.predict( row));
+ }
+ SECTION("Ten Levels Need One Byte Bins"){
+  REQUIRE( compressed.bin_width() == 1);
+  REQUIRE( compressed.thresholds.size() <= 4*10);
+ }
+ SECTION("Shared Subtrees And Smaller Footprint"){
+  REQUIRE( compressed.n_nodes() < n_internal);
+  REQUIRE( compressed.leaf_labels.size() <= 3);
+  REQUIRE( (3*compressed.bytes()) < source_bytes);
+ }
+ SECTION("Many Distinct Thresholds Use Two Byte Bins"){
+  ml::Matrix< double> Z( n, 2);
+  //Random labels grow deep trees with many distinct thresholds
+  for( std::size_t i = 0; i < n; ++i){ Z( i, 0) = normal( gen); Z( i, 1) = normal( gen); y[ i] = normal( gen) > 0; }
+  ml::random_forest_classifier< int> dense( params);
+  ml::fit( dense, ml::make_columnar( Z), y);
+  const auto c = ml::compress( dense);
+  REQUIRE( c.bin_width() == 2);
+  REQUIRE( c.predict( Z) == dense.predict( Z));
+  const std::string bytes = ml::serialize_compressed( c);
+  REQUIRE( ml::deserialize_compressed< int>( bytes.data(), bytes.size()).predict( Z) == dense.predict( Z));
+ }
+ SECTION("Serialized Size And Round Trip"){
+  const std::string bytes = ml::serialize_compressed( compressed);
+  REQUIRE( bytes.size() == compressed.bytes() + 92);
+  const auto copy = ml::deserialize_compressed< int>( bytes.data(), bytes.size());
+  REQUIRE( copy.n_classes() == compressed.n_classes());
+  REQUIRE( copy.n_nodes() == compressed.n_nodes());
+  REQUIRE( copy.predict( X) == forest.predict( X));
+  REQUIRE( ml::serialize_compressed( copy) == bytes);
+  const std::string path = "test_compressed_forest.rfc";
+  ml::save_compressed( compressed, path);
+  REQUIRE( ml::load_compressed< int>( path).predict( X) == forest.predict( X));
+  std::remove( path.c_str());
+  REQUIRE_THROWS_AS( ml::load_compressed< int>( path), std::system_error&);
+ }
+ SECTION("Corrupt Input Is Rejected"){
+  const std::string bytes = ml::serialize_compressed( compressed);
+  REQUIRE_THROWS_AS( ml::deserialize_compressed< unsigned>( bytes.data(), bytes.size()), std::runtime_error&);
+  for( std::size_t size: { std::size_t( 0), std::size_t( 30), bytes.size()/2, bytes.size()-1}){
+   REQUIRE_THROWS_AS( ml::deserialize_compressed< int>( bytes.data(), size), std::runtime_error&);
+  }
+  //The leaf labels, then the roots and their counts, end the image
+  const std::size_t roots = bytes.size() - 4*compressed.roots.size();
+  const std::size_t labels = roots - 8 - sizeof( int)*compressed.leaf_labels.size();
+  const std::size_t children = labels - 8 - 4*compressed.children.size();
+  std::string bad_label = bytes;
+  const int label = compressed.n_classes();
+  std::memcpy( &bad_label[ labels], &label, sizeof( label));
+  REQUIRE_THROWS_AS( ml::deserialize_compressed< int>( bad_label.data(), bad_label.size()), std::runtime_error&);
+  //Node 0 as its own left child
+  std::string cycle = bytes;
+  const std::uint32_t zero = 0;
+  std::memcpy( &cycle[ children], &zero, sizeof( zero));
+  REQUIRE_THROWS_AS( ml::deserialize_compressed< int>( cycle.data(), cycle.size()), std::runtime_error&);
+  std::string bad_root = bytes;
+  const std::uint32_t past = compressed.n_nodes();
+  std::memcpy( &bad_root[ roots], &past, sizeof( past));
+  REQUIRE_THROWS_AS( ml::deserialize_compressed< int>( bad_root.data(), bad_root.size()), std::runtime_error&);
+ }
+ SECTION("Votes Beyond The Class Count Throw"){
+  ml::random_forest_classifier< int> built;
+  std::size_t n_classes = 2;
+  built.n_classes( n_classes);
+  auto& t = built.insert_next_tree();
+  t.set_split( t.insert_root(), 0, 0.5);
+  auto children = t.insert_children( t.root());
+  t.generate_leaf_node( std::get< 0>( children), 1);
+  t.generate_leaf_node( std::get< 1>( children), 70);
+  REQUIRE_THROWS_AS( ml::compress( built), std::out_of_range&);
+ }
+}
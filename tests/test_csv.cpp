@@ -0,0 +1,158 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <clocale>
+#include <random>
+#include <string>
+#include <fstream>
+//Project
+#include <random_forest/csv.hpp>
+#include <random_forest/train_rf.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("CSV Parsing", "[csv]"){
+ const std::string text =
+  "\"Month\",\"Carrier\",Distance,\"Note\",mixed\r\n"
+  "\"7\",\"AS\",679,\"a \"\"quoted\"\", word\",1\r\n"
+  "\"12\",\"DL\",1964.5,,x\n"
+  "\n"
+  "\"3\",\"AS\",-2.5e2,NA,2\n"
+  "\"1\",\"UA\",,\"plain\",x";
+
+ SECTION("Types, quotes, missing values and dictionaries"){
+  const auto table = ml::read_csv( text.data(), text.size());
+  REQUIRE( table.names == std::vector< std::string>( { "Month", "Carrier", "Distance", "Note", "mixed" }));
+  REQUIRE( table.dataset.height() == 4);
+  REQUIRE( table.dataset.column( 0).type() == ml::dtype::uint8);
+  REQUIRE( table.dataset( 1, 0) == 12);
+  REQUIRE( table.dataset.column( 1).type() == ml::dtype::uint8);
+  REQUIRE( table.dictionaries[ 1] == std::vector< std::string>( { "AS", "DL", "UA" }));
+  REQUIRE( table.dataset( 2, 1) == 0);
+  REQUIRE( table.dataset( 3, 1) == 2);
+  REQUIRE( table.dictionaries[ 2].empty());
+  REQUIRE( table.dataset.column( 2).type() == ml::dtype::float32);
+  REQUIRE( table.dataset( 1, 2) == 1964.5);
+  REQUIRE( table.dataset( 2, 2) == -250);
+  REQUIRE( std::isnan( table.dataset( 3, 2)));
+  REQUIRE( table.dictionaries[ 3] == std::vector< std::string>( { "a \"quoted\", word", "plain" }));
+  REQUIRE( std::isnan( table.dataset( 1, 3)));
+  REQUIRE( std::isnan( table.dataset( 2, 3)));
+  //Numbers in a column with strings are categories too
+  REQUIRE( table.dictionaries[ 4] == std::vector< std::string>( { "1", "x", "2" }));
+  REQUIRE( table.labels( "mixed") == std::vector< std::size_t>( { 0, 1, 2, 1 }));
+  REQUIRE( table.features( "mixed").width() == 4);
+  REQUIRE_THROWS_AS( table.labels( "Distance"), std::invalid_argument&);
+ }
+
+ SECTION("Chunks give the same table"){
+  const auto whole = ml::read_csv( text.data(), text.size());
+  ml::csv_options options;
+  options.chunk_bytes = 1;
+  options.n_threads = 4;
+  const auto chunked = ml::read_csv( text.data(), text.size(), options);
+  REQUIRE( chunked.dictionaries == whole.dictionaries);
+  for( std::size_t j = 0; j < whole.dataset.width(); ++j){
+   REQUIRE( chunked.dataset.column( j).type() == whole.dataset.column( j).type());
+   for( std::size_t i = 0; i < whole.dataset.height(); ++i){
+    const double a = chunked.dataset( i, j), b = whole.dataset( i, j);
+    REQUIRE( (a == b || (std::isnan( a) && std::isnan( b))));
+   }
+  }
+ }
+
+ SECTION("No header"){
+  ml::csv_options options;
+  options.header = false;
+  const std::string numbers = "1,2\n3,4\n";
+  const auto table = ml::read_csv( numbers.data(), numbers.size(), options);
+  REQUIRE( table.names == std::vector< std::string>( { "0", "1" }));
+  REQUIRE( table.dataset.height() == 2);
+  REQUIRE( table.dataset( 1, 1) == 4);
+ }
+
+ SECTION("Malformed rows are rejected"){
+  for( std::string bad: { "a,b\n1,2\n3\n", "a,b\n1,2,3\n", "a,b\n\"1,2\n", "a,b\n\"1\"x,2\n" }){
+   REQUIRE_THROWS_AS( ml::read_csv( bad.data(), bad.size()), std::runtime_error&);
+  }
+ }
+}
+
+TEST_CASE("CSV Numbers", "[csv]"){
+ std::mt19937 gen( 5);
+ std::uniform_int_distribution< int> exponent( -30, 30);
+ std::uniform_int_distribution< int> digits( 1, 20);
+ std::uniform_int_distribution< int> digit( 0, 9);
+ for( int k = 0; k < 20000; ++k){
+  std::string s = (k % 2) ? "-" : "";
+  const int n = digits( gen);
+  for( int d = 0; d < n; ++d){
+   s += char( '0' + digit( gen));
+   if( d == n/2 && k % 3){ s += '.'; }
+  }
+  if( k % 5 == 0){ s += "e" + std::to_string( exponent( gen)); }
+  double parsed = 0;
+  REQUIRE( ml::detail::parse_double( s.data(), s.data() + s.size(), parsed));
+  REQUIRE( parsed == std::strtod( s.c_str(), nullptr));
+ }
+ double v;
+ for( std::string s: { "", "-", ".", "1e", "1.2.3", "12a", "0x10", "inf" }){
+  REQUIRE( !ml::detail::parse_double( s.data(), s.data() + s.size(), v));
+ }
+}
+
+TEST_CASE("CSV Numbers Ignore The Locale", "[csv]"){
+ const std::string previous = std::setlocale( LC_NUMERIC, nullptr);
+ const char* found = nullptr;
+ for( const char* name: { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "ru_RU.UTF-8" }){
+  if( std::setlocale( LC_NUMERIC, name)){ found = name; break; }
+ }
+ if( !found){
+  WARN( "no decimal comma locale is installed, parsing under one was not tested");
+  return;
+ }
+ //One number for the strtod path, one for the fast path
+ double slow = 0, fast = 0;
+ const std::string long_number = "1.5e300", short_number = "2.25";
+ const bool parsed_slow = ml::detail::parse_double( long_number.data(), long_number.data() + long_number.size(), slow);
+ const bool parsed_fast = ml::detail::parse_double( short_number.data(), short_number.data() + short_number.size(), fast);
+ std::setlocale( LC_NUMERIC, previous.c_str());
+ REQUIRE( parsed_slow);
+ REQUIRE( slow == 1.5e300);
+ REQUIRE( parsed_fast);
+ REQUIRE( fast == 2.25);
+}
+
+TEST_CASE("CSV Files", "[csv]"){
+ const std::string path = "test_csv.csv";
+ {
+  std::mt19937 gen( 9);
+  std::uniform_real_distribution<> uniform;
+  std::ofstream out( path);
+  out << "\"x\",\"y\",\"color\",\"label\"\n";
+  const char* colors[ 3] = { "red", "green", "blue" };
+  for( int i = 0; i < 3000; ++i){
+   const double x = uniform( gen), y = uniform( gen);
+   const int color = i % 3;
+   out << x << "," << y << ",\"" << colors[ color] << "\",\"" << ((x > 0.5) != (color == 2) ? "Y" : "N") << "\"\n";
+  }
+ }
+ ml::csv_options options;
+ options.chunk_bytes = 4096;
+ const auto table = ml::read_csv( path, options);
+ std::remove( path.c_str());
+ REQUIRE( table.dataset.height() == 3000);
+ REQUIRE( table.dictionaries[ 2] == std::vector< std::string>( { "red", "green", "blue" }));
+ const auto labels = table.labels( "label");
+ ml::rf_train_params params;
+ params.n_estimators = 10;
+ ml::random_forest_classifier< int> forest( params);
+ const auto X = table.features( "label");
+ ml::fit( forest, X, labels);
+ std::size_t correct = 0;
+ for( std::size_t i = 0; i < X.height(); ++i){ correct += forest.predict( X.row( i)) == (int)labels[ i]; }
+ REQUIRE( correct > 0.97*X.height());
+ REQUIRE_THROWS_AS( ml::read_csv( path), std::system_error&);
+}
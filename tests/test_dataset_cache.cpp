@@ -0,0 +1,159 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <string>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+//Project
+#include <random_forest/dataset_cache.hpp>
+#include <random_forest/train_rf.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Dataset Cache", "[dataset_cache]"){
+ const std::string csv_path = "test_dataset_cache.csv", path = "test_dataset_cache.rfdata";
+ {
+  std::mt19937 gen( 13);
+  std::uniform_real_distribution<> uniform;
+  std::ofstream out( csv_path);
+  out << "x,month,\"carrier\",label\n";
+  const char* carriers[ 3] = { "AS", "DL", "UA" };
+  for( int i = 0; i < 2000; ++i){
+   const double x = uniform( gen);
+   const int carrier = i % 3;
+   if( i % 50 == 0){ out << ","; }
+   else { out << x << ","; }
+   out << (i % 12 + 1) << ",\"" << carriers[ carrier] << "\"," << ((x > 0.5) != (carrier == 1)) << "\n";
+  }
+ }
+ const auto table = ml::read_csv( csv_path);
+ ml::cache_options options;
+ options.n_bins = 4;
+ options.presort = true;
+ ml::save_dataset_cache( table, path, options);
+
+ SECTION("Round trip"){
+  const auto cache = ml::load_dataset_cache( path);
+  REQUIRE( cache.names == table.names);
+  REQUIRE( cache.dictionaries == table.dictionaries);
+  REQUIRE( cache.dataset.height() == table.dataset.height());
+  REQUIRE( cache.dataset.width() == table.dataset.width());
+  for( std::size_t j = 0; j < table.dataset.width(); ++j){
+   const ml::column& c = cache.dataset.column( j);
+   REQUIRE( c.type() == table.dataset.column( j).type());
+   REQUIRE( c.owns_data());
+   REQUIRE( c.order() != nullptr);
+   for( std::size_t i = 0; i < c.size(); ++i){
+    const double a = c[ i], b = table.dataset( i, j);
+    REQUIRE( (a == b || (std::isnan( a) && std::isnan( b))));
+   }
+   //The order sorts the column, missing values last
+   for( std::size_t k = 1; k < c.size(); ++k){
+    REQUIRE( !ml::missing_last( c[ c.order()[ k]], c[ c.order()[ k-1]]));
+   }
+  }
+  const auto& x = cache.summaries[ 0];
+  REQUIRE( x.n_missing == 40);
+  REQUIRE( x.min >= 0);
+  REQUIRE( x.max < 1);
+  REQUIRE( x.bin_edges.size() == 5);
+  REQUIRE( x.bin_edges.front() == x.min);
+  REQUIRE( x.bin_edges.back() == x.max);
+  REQUIRE( std::abs( x.bin_edges[ 2] - 0.5) < 0.05);
+  const auto& month = cache.summaries[ 1];
+  REQUIRE( month.min == 1);
+  REQUIRE( month.max == 12);
+  REQUIRE( month.n_missing == 0);
+ }
+
+ SECTION("Presorted training matches sorting"){
+  const auto cache = ml::load_dataset_cache( path);
+  ml::rf_train_params params;
+  params.n_estimators = 5;
+  params.random_seed = 3;
+  ml::random_forest_classifier< int> presorted( params), sorted( params);
+  ml::fit( presorted, cache.features( "label"), cache.labels( "label"));
+  ml::fit( sorted, table.features( "label"), table.labels( "label"));
+  REQUIRE( presorted.size() == sorted.size());
+  for( std::size_t t = 0; t < sorted.size(); ++t){ REQUIRE( presorted[ t] == sorted[ t]); }
+ }
+
+ SECTION("Converts once"){
+  //An hour old csv, so the cache is newer even where timestamps are coarse
+  struct timespec times[ 2];
+  times[ 0].tv_sec = times[ 1].tv_sec = ::time( nullptr) - 3600;
+  times[ 0].tv_nsec = times[ 1].tv_nsec = 0;
+  REQUIRE( ::utimensat( AT_FDCWD, csv_path.c_str(), times, 0) == 0);
+  const auto first = ml::cached_csv( csv_path, path + ".auto");
+  std::ofstream( path + ".auto", std::ios::app) << "stale";
+  //A cache newer than the csv is loaded, not rewritten, so the appended bytes are found
+  REQUIRE_THROWS_AS( ml::cached_csv( csv_path, path + ".auto"), std::runtime_error&);
+  std::remove( (path + ".auto").c_str());
+  REQUIRE( ml::cached_csv( csv_path, path + ".auto").dataset.height() == first.dataset.height());
+  std::remove( (path + ".auto").c_str());
+ }
+
+ SECTION("Rebuilds for other options"){
+  const std::string automatic = path + ".options";
+  REQUIRE( ml::cached_csv( csv_path, automatic, ml::csv_options(), options).dataset.column( 0).order() != nullptr);
+  const auto plain = ml::cached_csv( csv_path, automatic);
+  REQUIRE( plain.dataset.column( 0).order() == nullptr);
+  REQUIRE( plain.options.n_bins == ml::cache_options().n_bins);
+  REQUIRE( plain.summaries[ 0].bin_edges.size() > 5);
+  REQUIRE( plain.options.parse_hash == ml::csv_options_hash( ml::csv_options()));
+  //Parse options count too: without a header the names become data
+  ml::csv_options no_header;
+  no_header.header = false;
+  REQUIRE( ml::csv_options_hash( no_header) != plain.options.parse_hash);
+  const auto headless = ml::cached_csv( csv_path, automatic, no_header);
+  REQUIRE( headless.dataset.height() == plain.dataset.height()+1);
+  REQUIRE( headless.names[ 0] == "0");
+  ml::csv_options other_missing;
+  other_missing.missing_values = { "?"};
+  REQUIRE( ml::cached_csv( csv_path, automatic, other_missing).options.parse_hash == ml::csv_options_hash( other_missing));
+  REQUIRE( ml::cached_csv( csv_path, automatic).names[ 0] == "x");
+  //The rewrite went through a temporary file, which is gone
+  REQUIRE( !std::ifstream( automatic + ".tmp." + std::to_string( ::getpid())));
+  std::remove( automatic.c_str());
+ }
+
+ SECTION("Bin counts are bounded"){
+  ml::cache_options bins;
+  bins.n_bins = 0;
+  REQUIRE_THROWS_AS( ml::save_dataset_cache( table, path + ".bins", bins), std::invalid_argument&);
+  bins.n_bins = std::size_t( -1);
+  REQUIRE_THROWS_AS( ml::save_dataset_cache( table, path + ".bins", bins), std::invalid_argument&);
+  REQUIRE( !std::ifstream( path + ".bins"));
+ }
+
+ SECTION("Corrupt caches are rejected"){
+  std::ifstream in( path, std::ios::binary);
+  const std::string bytes( (std::istreambuf_iterator< char>( in)), std::istreambuf_iterator< char>());
+  const std::string bad = path + ".bad";
+  auto rejects = [&]( const std::string& image){
+   std::ofstream( bad, std::ios::binary | std::ios::trunc).write( image.data(), image.size());
+   REQUIRE_THROWS_AS( ml::load_dataset_cache( bad), std::runtime_error&);
+  };
+  rejects( bytes.substr( 0, bytes.size()-1));
+  rejects( bytes.substr( 0, 40));
+  std::string magic = bytes;
+  magic[ 0] = 'X';
+  rejects( magic);
+  //Point the first column's order at its values, which are not a permutation
+  ml::cache_column d;
+  std::memcpy( &d, &bytes[ sizeof( ml::dataset_cache_header)], sizeof( d));
+  d.order = d.values;
+  std::string order = bytes;
+  std::memcpy( &order[ sizeof( ml::dataset_cache_header)], &d, sizeof( d));
+  rejects( order);
+  std::remove( bad.c_str());
+ }
+ std::remove( path.c_str());
+ std::remove( csv_path.c_str());
+}
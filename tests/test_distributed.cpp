@@ -0,0 +1,91 @@
+#include "catch.hpp"
+
+#include <thread>
+#include <vector>
+//Project
+#include <random_forest/distributed.hpp>
+
+namespace ml = ayasdi::ml;
+namespace dist = ayasdi::ml::distributed;
+
+//Row major rows [ begin, end) of a shared table
+struct shard_view {
+ const std::vector< std::vector< double> >* rows;
+ std::size_t begin, end;
+ double operator()( std::size_t i, std::size_t j) const { return (*rows)[ begin+i][ j]; }
+ std::size_t height() const { return end-begin; }
+ std::size_t width() const { return (*rows)[ 0].size(); }
+};
+
+struct shard_labels {
+ const std::vector< int>* labels;
+ std::size_t begin;
+ int operator[]( std::size_t i) const { return (*labels)[ begin+i]; }
+};
+
+static ml::random_forest_classifier< int>
+train( const std::vector< std::vector< double> >& rows, const std::vector< int>& labels,
+       std::size_t n_workers, const dist::distributed_params& p){
+ std::vector< dist::socket_channel> coordinator_side;
+ std::vector< std::thread> threads;
+ const std::size_t shard_size = (rows.size()+n_workers-1)/n_workers;
+ for( std::size_t w = 0; w < n_workers; ++w){
+  auto channels = dist::channel_pair();
+  coordinator_side.push_back( std::move( channels.first));
+  const std::size_t begin = w*shard_size, end = std::min( rows.size(), begin+shard_size);
+  threads.emplace_back( [&rows, &labels, begin, end]( dist::socket_channel c){
+    shard_view shard{ &rows, begin, end};
+    shard_labels shard_y{ &labels, begin};
+    dist::run_worker( c, shard, shard_y, begin);
+  }, std::move( channels.second));
+ }
+ ml::random_forest_classifier< int> forest( p.forest);
+ dist::run_coordinator( coordinator_side, p, forest);
+ for( auto& t: threads){ t.join(); }
+ return forest;
+}
+
+TEST_CASE("Distributed Training", "[distributed]"){
+ std::mt19937 gen( 7);
+ std::uniform_real_distribution<> uniform( 0, 100);
+ std::vector< std::vector< double> > rows( 600, std::vector< double>( 3));
+ std::vector< int> labels( rows.size());
+ for( std::size_t i = 0; i < rows.size(); ++i){
+  for( auto& x: rows[ i]){ x = uniform( gen); }
+  labels[ i] = (rows[ i][ 0] > 50) + (rows[ i][ 1] > 70);
+ }
+ dist::distributed_params p;
+ p.forest.n_estimators = 5;
+ p.forest.max_features = "all";
+ p.n_bins = 32;
+
+ auto single = train( rows, labels, 1, p);
+ auto sharded = train( rows, labels, 3, p);
+ SECTION("Sharding does not change the forest"){
+  REQUIRE( single.size() == 5);
+  REQUIRE( sharded.size() == single.size());
+  for( std::size_t t = 0; t < single.size(); ++t){ REQUIRE( single[ t] == sharded[ t]); }
+ }
+ SECTION("Forest fits the training data"){
+  std::size_t correct = 0;
+  for( std::size_t i = 0; i < rows.size(); ++i){ correct += (sharded.predict( rows[ i]) == labels[ i]); }
+  REQUIRE( correct > 0.95*rows.size());
+ }
+ SECTION("Unix domain socket transport"){
+  const std::string path = "/tmp/rf_distributed_test.sock";
+  auto listener = dist::listen_unix( path);
+  std::thread worker( [&](){
+    auto c = dist::connect_unix( path);
+    shard_view shard{ &rows, 0, rows.size()};
+    shard_labels shard_y{ &labels, 0};
+    dist::run_worker( c, shard, shard_y);
+  });
+  std::vector< dist::socket_channel> workers;
+  workers.push_back( dist::accept_unix( listener));
+  ml::random_forest_classifier< int> forest( p.forest);
+  dist::run_coordinator( workers, p, forest);
+  worker.join();
+  ::unlink( path.c_str());
+  for( std::size_t t = 0; t < single.size(); ++t){ REQUIRE( forest[ t] == single[ t]); }
+ }
+}
@@ -0,0 +1,66 @@
+#include "catch.hpp"
+
+#include <cstdint>
+//Project
+#include <random_forest/matrix.hpp>
+#include <random_forest/columnar_dataset.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Matrix Storage", "[matrix]"){
+ ml::Matrix< double> m( 13, 3);
+ for( std::size_t i = 0; i < m.height(); ++i){
+  for( std::size_t j = 0; j < m.width(); ++j){ m( i, j) = 10*i + j; }
+ }
+ SECTION("Columns Are Aligned And Padded"){
+  REQUIRE( m.is_column_major());
+  REQUIRE( m.col_stride() == 16);
+  for( std::size_t j = 0; j < m.width(); ++j){
+   REQUIRE( (reinterpret_cast< std::uintptr_t>( m.begin( j)) % ml::matrix_alignment) == 0);
+  }
+ }
+ SECTION("Row Major Rows Are Aligned"){
+  ml::Matrix< float> r( 5, 3, ml::storage_order::row_major);
+  REQUIRE( r.is_row_major());
+  REQUIRE( r.row_stride() == 16);
+  REQUIRE( (reinterpret_cast< std::uintptr_t>( &r( 1, 0)) % ml::matrix_alignment) == 0);
+ }
+ SECTION("Copies Own Their Storage"){
+  ml::Matrix< double> c( m);
+  c( 0, 0) = -1;
+  REQUIRE( m( 0, 0) == 0);
+  REQUIRE( c( 12, 2) == 122);
+ }
+ SECTION("Blocks And Transposes Share Storage"){
+  auto b = m.block( 2, 1, 4, 2);
+  REQUIRE( b.height() == 4);
+  REQUIRE( b( 0, 0) == 21);
+  REQUIRE( b( 3, 1) == 52);
+  auto t = m.transpose();
+  REQUIRE( t( 2, 7) == 72);
+  REQUIRE( t.is_row_major());
+  b( 0, 0) = 0.5;
+  REQUIRE( m( 2, 1) == 0.5);
+ }
+}
+
+TEST_CASE("Views Of External Buffers", "[matrix]"){
+ //A C ordered 4x3 buffer, as numpy would hand it over.
+ double buffer[ 12];
+ for( int k = 0; k < 12; ++k){ buffer[ k] = k; }
+ auto v = ml::Matrix_view< double>::from_buffer( buffer, 4, 3, 3*sizeof( double), sizeof( double));
+ REQUIRE( v( 2, 1) == 7);
+ REQUIRE( v.is_packed());
+ //Every other row, like a[ ::2]
+ auto s = ml::Matrix_view< double>::from_buffer( buffer, 2, 3, 6*sizeof( double), sizeof( double));
+ REQUIRE( s( 1, 2) == 8);
+ REQUIRE_FALSE( s.is_packed());
+ REQUIRE( s.row( 1)[ 0] == 6);
+ REQUIRE_THROWS( ml::Matrix_view< double>::from_buffer( buffer, 4, 3, 3*sizeof( double), 3));
+ SECTION("Columnar View Without Copy"){
+  auto d = ml::columnar_view( s);
+  REQUIRE( d.width() == 3);
+  REQUIRE_FALSE( d.column( 0).owns_data());
+  REQUIRE( d( 1, 1) == 7);
+ }
+}
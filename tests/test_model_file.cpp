@@ -0,0 +1,103 @@
+#include "catch.hpp"
+
+#include <random>
+#include <sstream>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <unistd.h>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/model_file.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Model File", "[model_file]"){
+ std::mt19937 gen( 39);
+ std::uniform_int_distribution<> value( 0, 99);
+ const std::size_t n = 800;
+ ml::Matrix< double> X( n, 3);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  X( i, 0) = value( gen); X( i, 1) = value( gen); X( i, 2) = value( gen);
+  y[ i] = (X( i, 0) > 60) + (X( i, 1) > 30 && X( i, 2) < 50);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 8;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ const auto frozen = ml::freeze( forest);
+ const auto expected = frozen.predict( X);
+ const std::string path = "/tmp/test_model_file." + std::to_string( ::getpid()) + ".rfm";
+ ml::save_model( frozen, path);
+
+ SECTION("Mapped Model Predicts Like The Source"){
+  ml::mapped_model< int> model( path, true);
+  const auto v = model.view();
+  REQUIRE( v.n_trees == frozen.size());
+  REQUIRE( v.n_classes == frozen.n_classes());
+  std::vector< int> labels( n);
+  v.predict( X, labels.data());
+  REQUIRE( labels == expected);
+  ml::mapped_model< int> moved( std::move( model));
+  REQUIRE( moved.view().nodes == v.nodes);
+ }
+ SECTION("Header Checks"){
+  std::ostringstream out;
+  ml::write_model( frozen, out);
+  const std::string image = out.str();
+  ml::aligned_vector< std::uint64_t> buffer( (image.size()+7)/8);
+  std::memcpy( buffer.data(), image.data(), image.size());
+  REQUIRE( ml::model_view< int>( buffer.data(), image.size()).predict( X.row( 5)) == expected[ 5]);
+  REQUIRE_THROWS_AS( ml::model_view< unsigned>( buffer.data(), image.size()), std::runtime_error&);
+  REQUIRE_THROWS_AS( ml::model_view< int>( buffer.data(), image.size()-1), std::runtime_error&);
+  //Class counts no leaf array could justify
+  const std::uint64_t n_classes = std::uint64_t( 1) << 40, no_classes = 0;
+  std::memcpy( reinterpret_cast< char*>( buffer.data()) + offsetof( ml::model_header, n_classes), &n_classes, 8);
+  REQUIRE_THROWS_AS( ml::model_view< int>( buffer.data(), image.size()), std::runtime_error&);
+  std::memcpy( reinterpret_cast< char*>( buffer.data()) + offsetof( ml::model_header, n_classes), &no_classes, 8);
+  REQUIRE_THROWS_AS( ml::model_view< int>( buffer.data(), image.size()), std::runtime_error&);
+  std::memcpy( buffer.data(), image.data(), image.size());
+  reinterpret_cast< char*>( buffer.data())[ 8] = 7;
+  REQUIRE_THROWS_AS( ml::model_view< int>( buffer.data(), image.size()), std::runtime_error&);
+  REQUIRE_THROWS_AS( ml::mapped_model< int>( path + ".missing"), std::system_error&);
+ }
+ SECTION("Array Checks"){
+  std::ostringstream out;
+  ml::write_model( frozen, out);
+  const std::string image = out.str();
+  ml::model_header h;
+  std::memcpy( &h, image.data(), sizeof( h));
+  const auto s = ml::detail::sections< int>( h);
+  ml::aligned_vector< std::uint64_t> buffer( (image.size()+7)/8);
+  char* bytes = reinterpret_cast< char*>( buffer.data());
+  auto corrupt_and_check = [&]( std::uint64_t offset, const void* value, std::size_t size){
+   std::memcpy( bytes, image.data(), image.size());
+   std::memcpy( bytes + offset, value, size);
+   REQUIRE_THROWS_AS( ml::model_view< int>( buffer.data(), image.size(), true), std::runtime_error&);
+  };
+  const std::uint64_t far = std::uint64_t( 1) << 40, huge_count = std::uint64_t( 1) << 61;
+  corrupt_and_check( s.tree_offsets + 8, &far, sizeof( far));
+  const std::uint64_t backwards = frozen.tree_offsets[ 2]+1;
+  corrupt_and_check( s.tree_offsets + 8, &backwards, sizeof( backwards));
+  //The root of the first tree is a split, its right child moves past the tree
+  const std::uint16_t past = frozen.tree_offsets[ 1];
+  corrupt_and_check( s.nodes + 6, &past, sizeof( past));
+  const std::uint16_t zero = 0;
+  corrupt_and_check( s.nodes + 6, &zero, sizeof( zero));
+  const int label = frozen.n_classes();
+  corrupt_and_check( s.leaf_labels, &label, sizeof( label));
+  //Only a verified load reads the arrays
+  REQUIRE( ml::model_view< int>( buffer.data(), image.size()).n_trees == frozen.size());
+  std::size_t leaf = 0;
+  while( !frozen.nodes[ leaf].is_leaf()){ ++leaf; }
+  const std::uint32_t leaf_index = frozen.leaf_labels.size();
+  corrupt_and_check( s.nodes + 8*leaf, &leaf_index, sizeof( leaf_index));
+  //Counts whose sections overflow 64 bits
+  corrupt_and_check( offsetof( ml::model_header, n_nodes), &huge_count, sizeof( huge_count));
+  corrupt_and_check( offsetof( ml::model_header, n_leaves), &huge_count, sizeof( huge_count));
+  const std::uint64_t all_ones = ~std::uint64_t( 0);
+  corrupt_and_check( offsetof( ml::model_header, n_trees), &all_ones, sizeof( all_ones));
+ }
+ std::remove( path.c_str());
+}
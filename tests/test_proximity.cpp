@@ -0,0 +1,44 @@
+#include "catch.hpp"
+
+#include <random>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/proximity.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Sparse Proximity", "[proximity]"){
+ std::mt19937 gen( 42);
+ std::normal_distribution<> normal;
+ const std::size_t n = 400, k = 7;
+ ml::Matrix< double> X( n, 3);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  for( std::size_t j = 0; j < X.width(); ++j){ X( i, j) = normal( gen); }
+  y[ i] = (X( i, 0) > 0) + (X( i, 1) > 0.5);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 10;
+ params.min_samples_leaf = 5;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ const auto p = ml::proximity( forest, X, k, 3);
+ REQUIRE( p.height() == n);
+
+ //Dense reference
+ const auto leaves = forest.apply( X);
+ for( std::size_t i = 0; i < n; ++i){
+  std::vector< std::pair< int, std::size_t> > dense;
+  for( std::size_t j = 0; j < n; ++j){
+   int shared = 0;
+   for( std::size_t t = 0; t < forest.size(); ++t){ shared += (leaves( i, t) == leaves( j, t)); }
+   if( j != i && shared){ dense.emplace_back( -shared, j); }
+  }
+  std::sort( dense.begin(), dense.end());
+  REQUIRE( p.size( i) == std::min( k, dense.size()));
+  for( std::size_t m = 0; m < p.size( i); ++m){
+   REQUIRE( p.neighbors_of( i)[ m] == dense[ m].second);
+   REQUIRE( p.values_of( i)[ m] == Approx( -dense[ m].first/10.0));
+  }
+ }
+}
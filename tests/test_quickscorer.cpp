@@ -0,0 +1,59 @@
+#include "catch.hpp"
+
+#include <random>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/quickscorer.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("QuickScorer", "[quickscorer]"){
+ std::mt19937 gen( 5);
+ std::normal_distribution<> normal;
+ const std::size_t n = 1000;
+ ml::Matrix< double> X( n, 5);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  for( std::size_t j = 0; j < X.width(); ++j){ X( i, j) = std::round( 10*normal( gen))/10; }
+  y[ i] = (X( i, 0) + X( i, 1) > 0) + (X( i, 2) > 1);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 20;
+ params.max_depth = 6;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+
+ ml::quickscorer< int> scorer( forest);
+ REQUIRE( scorer.size() == forest.size());
+ SECTION("Same Labels As Tree Traversal"){
+  std::vector< int> labels( n);
+  scorer.predict( X, labels.data());
+  REQUIRE( labels == forest.predict( X));
+ }
+ SECTION("Rows On Thresholds And Missing Values"){
+  const double row[ 5] = { 0, 0.1, 1, NAN, -0.2};
+  REQUIRE( scorer.predict( row) == forest.predict( row));
+ }
+ SECTION("Deep Trees Are Rejected"){
+  ml::rf_train_params deep;
+  deep.n_estimators = 1;
+  deep.max_features = "all";
+  //Random labels need far more than 64 leaves to fit
+  std::vector< std::size_t> noise( n);
+  for( auto& label: noise){ label = gen() % 3; }
+  ml::random_forest_classifier< int> f( deep);
+  ml::fit( f, ml::make_columnar( X), noise);
+  REQUIRE_THROWS_AS( ml::quickscorer< int>{ f}, std::invalid_argument&);
+ }
+ SECTION("Votes Beyond The Class Count Are Rejected"){
+  ml::random_forest_classifier< int> built;
+  std::size_t n_classes = 2;
+  built.n_classes( n_classes);
+  auto& t = built.insert_next_tree();
+  t.set_split( t.insert_root(), 0, 0.5);
+  auto children = t.insert_children( t.root());
+  t.generate_leaf_node( std::get< 0>( children), 1);
+  t.generate_leaf_node( std::get< 1>( children), 70);
+  REQUIRE_THROWS_AS( ml::quickscorer< int>{ built}, std::invalid_argument&);
+ }
+}
@@ -0,0 +1,210 @@
+#include "catch.hpp"
+
+#include <random>
+#include <numeric>
+#include <cmath>
+#include <thread>
+#include <stdexcept>
+//Project
+#include <random_forest/train_rf.hpp>
+
+namespace ml = ayasdi::ml;
+
+namespace {
+//Rows with four features and three classes
+struct synthetic_data {
+ synthetic_data( std::size_t n, unsigned seed=11): X( n, 4), y( n) {
+  std::mt19937 gen( seed);
+  std::uniform_int_distribution<> day( 1, 7);
+  std::normal_distribution<> normal;
+  for( std::size_t i = 0; i < n; ++i){
+   X( i, 0) = day( gen);
+   X( i, 1) = normal( gen);
+   X( i, 2) = normal( gen);
+   X( i, 3) = std::round( 100*normal( gen));
+   y[ i] = (X( i, 1) > 0) + (X( i, 0) > 5 && X( i, 2) > -0.5);
+  }
+ }
+ ml::Matrix< double> X;
+ std::vector< std::size_t> y;
+};
+} //end anonymous namespace
+
+TEST_CASE("Forest Prediction", "[random_forest]"){
+ synthetic_data train( 800), test( 300, 12);
+ ml::rf_train_params params;
+ params.n_estimators = 12;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( train.X), train.y);
+ REQUIRE( forest.size() == 12);
+ REQUIRE( forest.n_classes() == 3);
+
+ std::vector< int> expected( test.X.height());
+ for( std::size_t i = 0; i < test.X.height(); ++i){
+  auto row = test.X.row( i);
+  expected[ i] = forest.predict( row);
+ }
+ SECTION("Batch Predict Matches Row By Row"){
+  REQUIRE( forest.predict( test.X) == expected);
+ }
+ SECTION("Batch Predict On A Row Major Copy"){
+  ml::Matrix< double> rows( test.X.height(), test.X.width(), ml::storage_order::row_major);
+  for( std::size_t i = 0; i < rows.height(); ++i){
+   for( std::size_t j = 0; j < rows.width(); ++j){ rows( i, j) = test.X( i, j); }
+  }
+  REQUIRE( forest.predict( rows) == expected);
+ }
+ SECTION("Forest Generalizes"){
+  std::size_t correct = 0;
+  for( std::size_t i = 0; i < expected.size(); ++i){ correct += ((std::size_t)expected[ i] == test.y[ i]); }
+  REQUIRE( correct > 0.8*expected.size());
+ }
+ SECTION("Parallel Batch Equals Serial"){
+  REQUIRE( forest.predict_parallel( test.X, 4) == expected);
+  REQUIRE( forest.predict_parallel( test.X.block( 3, 0, 280, test.X.width()), 3) ==
+           std::vector< int>( expected.begin()+3, expected.begin()+283));
+ }
+ SECTION("Concurrent Single Row Predictions"){
+  std::vector< std::vector< int> > labels( 4, std::vector< int>( test.X.height()));
+  std::vector< std::thread> threads;
+  for( std::size_t t = 0; t < labels.size(); ++t){
+   threads.emplace_back( [&, t](){
+    for( std::size_t i = 0; i < test.X.height(); ++i){ labels[ t][ i] = forest.predict( test.X.row( i)); }
+   });
+  }
+  for( auto& t: threads){ t.join(); }
+  for( auto& l: labels){ REQUIRE( l == expected); }
+ }
+ SECTION("Leaf Distributions Give Probabilities"){
+  for( auto& t: forest){ REQUIRE( t.has_distributions()); }
+  const auto proba = forest.predict_proba( test.X);
+  REQUIRE( proba.size() == 3*test.X.height());
+  for( std::size_t i = 0; i < test.X.height(); ++i){
+   const auto row_proba = forest.predict_proba( test.X.row( i));
+   double total = 0;
+   for( std::size_t c = 0; c < 3; ++c){
+    REQUIRE( row_proba[ c] == Approx( proba[ 3*i+c]));
+    total += row_proba[ c];
+   }
+   REQUIRE( total == Approx( 1.0));
+  }
+ }
+ SECTION("Impure Leaves Keep Their Class Mix"){
+  ml::rf_train_params shallow( params);
+  shallow.max_depth = 2;
+  ml::random_forest_classifier< int> stumps( shallow);
+  ml::fit( stumps, ml::make_columnar( train.X), train.y);
+  const auto proba = stumps.predict_proba( test.X);
+  REQUIRE( std::count_if( proba.begin(), proba.end(), []( float p){ return p > 0.01 && p < 0.99; }) > 0);
+ }
+ SECTION("Early Exit Agrees And Stops Early"){
+  std::size_t total = 0;
+  for( std::size_t i = 0; i < test.X.height(); ++i){
+   std::size_t n_evaluated = 0;
+   REQUIRE( forest.predict_early_exit( test.X.row( i), &n_evaluated) == expected[ i]);
+   REQUIRE( n_evaluated <= forest.size());
+   total += n_evaluated;
+  }
+  REQUIRE( total < forest.size()*test.X.height());
+  REQUIRE( forest.predict_early_exit( test.X) == expected);
+ }
+ SECTION("Trees Ordered By Out Of Bag Accuracy"){
+  REQUIRE( forest.oob_scores().size() == forest.size());
+  auto ordered = forest;
+  ordered.order_trees_by_oob();
+  const auto& scores = ordered.oob_scores();
+  REQUIRE( std::is_sorted( scores.rbegin(), scores.rend()));
+  REQUIRE( ordered.predict( test.X) == expected);
+  REQUIRE( ordered.predict_early_exit( test.X) == expected);
+ }
+ SECTION("Apply Returns Leaf Indices"){
+  const auto leaves = forest.apply( test.X, 3);
+  REQUIRE( leaves.height() == test.X.height());
+  REQUIRE( leaves.width() == forest.size());
+  for( std::size_t i = 0; i < test.X.height(); ++i){
+   for( std::size_t t = 0; t < forest.size(); ++t){
+    const auto& leaf = forest[ t][ leaves( i, t)];
+    REQUIRE( leaf.is_leaf());
+    REQUIRE( &leaf == &forest[ t].leaf( test.X.row( i)));
+   }
+  }
+  ml::Matrix< std::int32_t> rows( test.X.height(), forest.size(), ml::storage_order::row_major);
+  forest.apply( test.X, rows, 1);
+  for( std::size_t i = 0; i < test.X.height(); ++i){ REQUIRE( rows( i, 2) == leaves( i, 2)); }
+  ml::Matrix< std::int32_t> wrong( test.X.height(), 1);
+  REQUIRE_THROWS_AS( forest.apply( test.X, wrong), std::invalid_argument&);
+ }
+ SECTION("Feature Importances"){
+  //Feature 3 is noise, feature 1 decides the most rows
+  const auto& mdi = forest.feature_importances();
+  REQUIRE( mdi.size() == 4);
+  REQUIRE( std::accumulate( mdi.begin(), mdi.end(), 0.0) == Approx( 1.0));
+  REQUIRE( mdi[ 1] > mdi[ 3]);
+  REQUIRE( forest.permutation_importances().empty());
+  ml::rf_train_params with_permutation( params);
+  with_permutation.permutation_importance = true;
+  ml::random_forest_classifier< int> permuted( with_permutation);
+  ml::fit( permuted, ml::make_columnar( train.X), train.y);
+  const auto& drop = permuted.permutation_importances();
+  REQUIRE( drop.size() == 4);
+  REQUIRE( drop[ 1] > 0.1);
+  REQUIRE( drop[ 1] > drop[ 3]);
+  REQUIRE( std::abs( drop[ 3]) < 0.05);
+ }
+ SECTION("Progress And Cancellation"){
+  ml::training_progress progress;
+  ml::random_forest_classifier< int> observed( params);
+  ml::fit( observed, ml::make_columnar( train.X), train.y, progress);
+  REQUIRE( progress.trees_completed() == params.n_estimators);
+  REQUIRE( progress.tree_seconds().size() == params.n_estimators);
+  REQUIRE( progress.oob_error() >= 0);
+  REQUIRE( progress.oob_error() < 0.5);
+  REQUIRE( observed.predict( test.X) == forest.predict( test.X));
+
+  ml::training_progress cancelled_early;
+  cancelled_early.cancel();
+  ml::random_forest_classifier< int> empty( params);
+  ml::fit( empty, ml::make_columnar( train.X), train.y, cancelled_early);
+  REQUIRE( empty.size() == 0);
+
+  ml::rf_train_params many( params);
+  many.n_estimators = 100000;
+  ml::random_forest_classifier< int> partial( many);
+  ml::training_progress stop;
+  const auto dataset = ml::make_columnar( train.X);
+  std::thread training( [&](){ ml::fit( partial, dataset, train.y, stop); });
+  while( stop.trees_completed() < 3){ std::this_thread::yield(); }
+  stop.cancel();
+  training.join();
+  REQUIRE( partial.size() >= 3);
+  REQUIRE( partial.size() < many.n_estimators);
+  REQUIRE( partial.size() == stop.trees_completed());
+  REQUIRE( partial.oob_scores().size() == partial.size());
+  for( std::size_t t = 0; t < 3; ++t){ REQUIRE( partial[ t] == observed[ t]); }
+  const auto& mdi = partial.feature_importances();
+  REQUIRE( std::accumulate( mdi.begin(), mdi.end(), 0.0) == Approx( 1.0));
+ }
+ SECTION("Parallel For Rethrows"){
+  REQUIRE_THROWS_AS( ml::parallel_for( 1000, 4, 10, []( std::size_t begin, std::size_t){
+   if( begin == 500){ throw std::runtime_error( "chunk failed"); }
+  }), std::runtime_error&);
+ }
+ SECTION("Votes Beyond The Class Count Throw"){
+  //A hand built forest whose leaf labels exceed the stack vote buffer
+  ml::random_forest_classifier< int> built;
+  std::size_t n_classes = 2;
+  built.n_classes( n_classes);
+  auto& t = built.insert_next_tree();
+  t.set_split( t.insert_root(), 0, 0.5);
+  auto children = t.insert_children( t.root());
+  t.generate_leaf_node( std::get< 0>( children), 1);
+  t.generate_leaf_node( std::get< 1>( children), 70);
+  const double left[ 1] = { 0 }, right[ 1] = { 1 };
+  REQUIRE( built.predict( left) == 1);
+  REQUIRE_THROWS_AS( built.predict( right), std::out_of_range&);
+  REQUIRE_THROWS_AS( built.predict_early_exit( right), std::out_of_range&);
+  ml::Matrix< double> X( 1, 1);
+  X( 0, 0) = 1;
+  REQUIRE_THROWS_AS( built.predict( X), std::out_of_range&);
+ }
+}
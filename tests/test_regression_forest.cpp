@@ -0,0 +1,105 @@
+#include "catch.hpp"
+
+#include <random>
+#include <algorithm>
+//Project
+#include <random_forest/regression_forest.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Quantile Regression Forest", "[regression]"){
+ std::mt19937 gen( 7);
+ std::normal_distribution<> normal;
+ std::uniform_real_distribution<> uniform;
+ const std::size_t n = 2000;
+ //The noise grows with x0, so the spread of the quantiles must too
+ ml::Matrix< double> X( n, 2);
+ std::vector< double> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  X( i, 0) = uniform( gen);
+  X( i, 1) = uniform( gen);
+  y[ i] = 4*X( i, 0) + (0.1 + X( i, 0))*normal( gen);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 30;
+ params.min_samples_leaf = 10;
+ ml::random_forest_regressor forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ REQUIRE( forest.size() == 30);
+
+ const std::vector< double> qs = { 0.9, 0.1, 0.5, 0, 1 };
+
+ SECTION("Merge matches a sort of the weighted samples"){
+  for( std::size_t i = 0; i < 50; ++i){
+   std::vector< std::pair< float, double> > weighted;
+   for( auto& t: forest){
+    const auto& leaf = t.leaf( X.row( i));
+    const float* b = forest.leaf_begin( leaf);
+    const float* e = forest.leaf_end( leaf);
+    for( const float* s = b; s != e; ++s){ weighted.emplace_back( *s, 1.0/((e-b)*forest.size())); }
+   }
+   std::sort( weighted.begin(), weighted.end());
+   std::vector< double> out( qs.size());
+   forest.predict_quantiles( X.row( i), qs, out.data());
+   for( std::size_t k = 0; k < qs.size(); ++k){
+    double mass = 0;
+    float expected = weighted.back().first;
+    for( auto& w: weighted){
+     mass += w.second;
+     if( mass + 1e-9 >= qs[ k]){ expected = w.first; break; }
+    }
+    REQUIRE( out[ k] == expected);
+   }
+   REQUIRE( out[ 3] <= out[ 1]);
+   REQUIRE( out[ 1] <= out[ 2]);
+   REQUIRE( out[ 2] <= out[ 0]);
+   REQUIRE( out[ 0] <= out[ 4]);
+  }
+ }
+
+ SECTION("Batch, coverage and spread"){
+  ml::Matrix< double> T( 1000, 2);
+  std::vector< double> truth( T.height());
+  for( std::size_t i = 0; i < T.height(); ++i){
+   T( i, 0) = uniform( gen);
+   T( i, 1) = uniform( gen);
+   truth[ i] = 4*T( i, 0) + (0.1 + T( i, 0))*normal( gen);
+  }
+  const auto Q = forest.predict_quantiles( T, qs, 3);
+  REQUIRE( Q.height() == T.height());
+  REQUIRE( Q.width() == qs.size());
+  std::size_t inside = 0;
+  double narrow = 0, wide = 0;
+  std::vector< double> row( qs.size());
+  for( std::size_t i = 0; i < T.height(); ++i){
+   forest.predict_quantiles( T.row( i), qs, row.data());
+   for( std::size_t k = 0; k < qs.size(); ++k){ REQUIRE( Q( i, k) == row[ k]); }
+   inside += (truth[ i] >= Q( i, 1) && truth[ i] <= Q( i, 0));
+   if( T( i, 0) < 0.3){ narrow += Q( i, 0) - Q( i, 1); }
+   if( T( i, 0) > 0.7){ wide += Q( i, 0) - Q( i, 1); }
+  }
+  //Nominal coverage of the 10% to 90% band is 80%
+  REQUIRE( inside > 700);
+  REQUIRE( inside < 900);
+  REQUIRE( wide > 2*narrow);
+  const auto mean = forest.predict( T);
+  double error = 0;
+  for( std::size_t i = 0; i < T.height(); ++i){ error += std::abs( mean[ i] - 4*T( i, 0)); }
+  error /= T.height();
+  REQUIRE( error < 0.3);
+ }
+
+ SECTION("Quantiles outside [0, 1] are rejected"){
+  std::vector< double> out( 1);
+  REQUIRE_THROWS_AS( forest.predict_quantiles( X.row( 0), { 1.5}, out.data()), std::invalid_argument&);
+  REQUIRE_THROWS_AS( forest.predict_quantiles( X, { -0.1}), std::invalid_argument&);
+ }
+
+ SECTION("Empty datasets are rejected"){
+  const ml::Matrix< double> empty( 0, 2);
+  const std::vector< double> no_targets;
+  ml::random_forest_regressor unfit( params);
+  REQUIRE_THROWS_AS( ml::fit( unfit, ml::make_columnar( empty), no_targets), std::invalid_argument&);
+  REQUIRE( unfit.size() == 0);
+ }
+}
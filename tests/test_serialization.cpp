@@ -0,0 +1,93 @@
+#include "catch.hpp"
+
+#include <random>
+#include <cstdio>
+#include <cstring>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/tree_layout.hpp>
+#include <random_forest/serialization.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Forest Serialization", "[serialization]"){
+ std::mt19937 gen( 3);
+ std::normal_distribution<> normal;
+ const std::size_t n = 600;
+ ml::Matrix< double> X( n, 4);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  for( std::size_t j = 0; j < X.width(); ++j){ X( i, j) = normal( gen); }
+  y[ i] = (X( i, 0) > 0) + (X( i, 1) > 0.3) + (X( i, 2) > 1);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 12;
+ params.min_samples_leaf = 3;
+ params.permutation_importance = true;
+ params.criterion = "entropy";
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ ml::optimize_layout( forest, X);
+
+ const std::string bytes = ml::serialize( forest);
+
+ SECTION("Round trip"){
+  const auto copy = ml::deserialize< int>( bytes.data(), bytes.size());
+  REQUIRE( copy.size() == forest.size());
+  for( std::size_t t = 0; t < forest.size(); ++t){ REQUIRE( copy[ t] == forest[ t]); }
+  REQUIRE( copy.n_classes() == forest.n_classes());
+  REQUIRE( copy.params().criterion == "entropy");
+  REQUIRE( copy.params().min_samples_leaf == 3);
+  REQUIRE( copy.params().permutation_importance);
+  REQUIRE( copy.feature_importances() == forest.feature_importances());
+  REQUIRE( copy.permutation_importances() == forest.permutation_importances());
+  REQUIRE( copy.oob_scores().size() == forest.oob_scores().size());
+  REQUIRE( copy.predict( X) == forest.predict( X));
+  REQUIRE( copy.predict_proba( X) == forest.predict_proba( X));
+  REQUIRE( ml::serialize( copy) == bytes);
+ }
+
+ SECTION("Files"){
+  const std::string path = "test_serialization.forest";
+  ml::save_forest( forest, path);
+  const auto copy = ml::load_forest< int>( path);
+  std::remove( path.c_str());
+  REQUIRE( copy.predict( X) == forest.predict( X));
+  REQUIRE_THROWS_AS( ml::load_forest< int>( path), std::system_error&);
+ }
+
+ SECTION("Corrupt input is rejected"){
+  for( std::size_t size: { std::size_t( 0), std::size_t( 7), bytes.size()/2, bytes.size()-1}){
+   REQUIRE_THROWS_AS( ml::deserialize< int>( bytes.data(), size), std::runtime_error&);
+  }
+  std::string trailing = bytes + '\0';
+  REQUIRE_THROWS_AS( ml::deserialize< int>( trailing.data(), trailing.size()), std::runtime_error&);
+  std::string magic = bytes;
+  magic[ 0] = 'X';
+  REQUIRE_THROWS_AS( ml::deserialize< int>( magic.data(), magic.size()), std::runtime_error&);
+  //The nodes of the first tree follow the max_features string, the three importance arrays and the node count
+  const std::size_t names = bytes.find( params.max_features);
+  REQUIRE( names != std::string::npos);
+  const std::size_t root = names + params.max_features.size() +
+                           3*8 + 8*(forest.oob_scores().size() + forest.feature_importances().size() +
+                                    forest.permutation_importances().size()) + 8;
+  //Root whose left child is itself
+  std::string cycle = bytes;
+  const std::int32_t zero = 0;
+  std::memcpy( &cycle[ root + 16], &zero, sizeof( zero));
+  REQUIRE_THROWS_AS( ml::deserialize< int>( cycle.data(), cycle.size()), std::runtime_error&);
+  std::string bad_child = bytes;
+  const std::int32_t far = 1 << 30;
+  std::memcpy( &bad_child[ root + 16], &far, sizeof( far));
+  REQUIRE_THROWS_AS( ml::deserialize< int>( bad_child.data(), bad_child.size()), std::runtime_error&);
+  //A leaf labelled beyond the class count, in a tree that also carries distributions
+  const auto& tree = forest[ 0];
+  REQUIRE( tree.has_distributions());
+  std::size_t leaf = 0;
+  while( !tree[ leaf].is_leaf()){ ++leaf; }
+  std::string bad_label = bytes;
+  const double label = forest.n_classes();
+  std::memcpy( &bad_label[ root + 24*leaf + 8], &label, sizeof( label));
+  REQUIRE_THROWS_AS( ml::deserialize< int>( bad_label.data(), bad_label.size()), std::runtime_error&);
+ }
+}
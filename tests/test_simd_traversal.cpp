@@ -0,0 +1,54 @@
+#include "catch.hpp"
+
+#include <random>
+#include <limits>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/simd_traversal.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("SIMD Traversal", "[simd]"){
+ std::mt19937 gen( 34);
+ std::normal_distribution<> normal;
+ //Not a multiple of 8 or 16, so the last pass is partial
+ const std::size_t n = 1003;
+ ml::Matrix< double> X( n, 5);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  for( std::size_t j = 0; j < X.width(); ++j){ X( i, j) = normal( gen); }
+  y[ i] = (X( i, 0) + X( i, 3) > 0) + (X( i, 1) > 0.7);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 12;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ auto frozen = ml::freeze( forest);
+ const auto expected = frozen.predict( X);
+
+ std::vector< ml::simd_level> levels{ ml::simd_level::scalar};
+ if( ml::best_simd_level() >= ml::simd_level::avx2){ levels.push_back( ml::simd_level::avx2); }
+ if( ml::best_simd_level() >= ml::simd_level::avx512){ levels.push_back( ml::simd_level::avx512); }
+
+ SECTION("Every Level Matches The Scalar Walk"){
+  for( auto level: levels){ REQUIRE( ml::simd_predict( frozen, X, level) == expected); }
+ }
+ SECTION("Row Major Floats With Missing Values"){
+  ml::Matrix< float> F( n, X.width(), ml::storage_order::row_major);
+  for( std::size_t i = 0; i < n; ++i){
+   for( std::size_t j = 0; j < X.width(); ++j){
+    F( i, j) = (i % 7 == j) ? std::numeric_limits< float>::quiet_NaN() : (float)X( i, j);
+   }
+  }
+  const auto float_expected = frozen.predict( F);
+  for( auto level: levels){ REQUIRE( ml::simd_predict( frozen, F, level) == float_expected); }
+ }
+ SECTION("Leaves Of One Tree On A Slice"){
+  auto v = frozen.view();
+  std::vector< std::uint32_t> leaves( 37);
+  for( auto level: levels){
+   ml::tree_leaves( v, 3, X, 100, 137, leaves.data(), level);
+   for( std::size_t i = 100; i < 137; ++i){ REQUIRE( leaves[ i-100] == v.leaf( 3, X.row( i))); }
+  }
+ }
+}
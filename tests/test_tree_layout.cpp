@@ -0,0 +1,74 @@
+#include "catch.hpp"
+
+#include <random>
+#include <cstdint>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/tree_layout.hpp>
+
+namespace ml = ayasdi::ml;
+
+TEST_CASE("Tree Layout", "[tree_layout]"){
+ std::mt19937 gen( 21);
+ std::normal_distribution<> normal;
+ const std::size_t n = 1200;
+ ml::Matrix< double> X( n, 4);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  for( std::size_t j = 0; j < X.width(); ++j){ X( i, j) = normal( gen); }
+  y[ i] = (X( i, 0) > 0.5) + (X( i, 1)*X( i, 2) > 0);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 6;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ const auto expected = forest.predict( X);
+ const auto& t = forest[ 0];
+
+ SECTION("Orders Are Permutations Fixing The Root"){
+  ml::layout_options options;
+  for( auto subtrees: { ml::subtree_layout::hot_path, ml::subtree_layout::van_emde_boas}){
+   for( std::size_t levels: { 0, 1, 4, 40}){
+    options.subtrees = subtrees;
+    options.bfs_levels = levels;
+    auto order = ml::layout_order( t, options);
+    REQUIRE( order.size() == t.size());
+    REQUIRE( order[ 0] == 0);
+    std::vector< std::size_t> sorted( order);
+    std::sort( sorted.begin(), sorted.end());
+    for( std::size_t k = 0; k < sorted.size(); ++k){ REQUIRE( sorted[ k] == k); }
+   }
+  }
+ }
+ SECTION("Breadth First Top Levels"){
+  ml::layout_options options;
+  options.bfs_levels = 2;
+  auto copy = t;
+  copy.permute( ml::layout_order( copy, options));
+  REQUIRE( copy.root().left_child_index() == 1);
+  REQUIRE( copy.root().right_child_index() == 2);
+  REQUIRE( (reinterpret_cast< std::uintptr_t>( &copy.root()) % ml::matrix_alignment) == 0);
+ }
+ SECTION("Hot Child First"){
+  auto visits = ml::count_visits( t, X);
+  REQUIRE( visits[ 0] == n);
+  ml::layout_options options;
+  options.bfs_levels = 0;
+  auto copy = t;
+  copy.permute( ml::layout_order( copy, options, &visits));
+  const auto& root = copy.root();
+  const std::size_t hot = (visits[ t.root().left_child_index()] >= visits[ t.root().right_child_index()]) ?
+                           root.left_child_index() : root.right_child_index();
+  REQUIRE( hot == 1);
+ }
+ SECTION("Predictions Are Unchanged"){
+  auto hot = forest;
+  ml::optimize_layout( hot, X);
+  REQUIRE( hot.predict( X) == expected);
+  ml::layout_options options;
+  options.subtrees = ml::subtree_layout::van_emde_boas;
+  auto veb = forest;
+  ml::optimize_layout( veb, options);
+  REQUIRE( veb.predict( X) == expected);
+ }
+}
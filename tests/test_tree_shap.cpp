@@ -0,0 +1,77 @@
+#include "catch.hpp"
+
+#include <random>
+#include <cmath>
+//Project
+#include <random_forest/train_rf.hpp>
+#include <random_forest/tree_shap.hpp>
+
+namespace ml = ayasdi::ml;
+
+namespace {
+//Expected output of tree t given the features in the bit set S, following the covers elsewhere
+template< typename Tree, typename Row>
+double conditional_expectation( const Tree& t, std::size_t i, const Row& x, unsigned S, std::size_t c){
+ const auto& n = t[ i];
+ if( n.is_leaf()){ return t.leaf_distribution( n)[ c]; }
+ const std::size_t l = n.left_child_index(), r = n.right_child_index();
+ if( S & (1u << n.split_)){ return conditional_expectation( t, x[ n.split_] < n.split_value_ ? l : r, x, S, c); }
+ return (t.cover( l)*conditional_expectation( t, l, x, S, c) + t.cover( r)*conditional_expectation( t, r, x, S, c))/t.cover( i);
+}
+} //end anonymous namespace
+
+TEST_CASE("TreeSHAP", "[tree_shap]"){
+ std::mt19937 gen( 43);
+ std::normal_distribution<> normal;
+ const std::size_t n = 300, M = 4;
+ ml::Matrix< double> X( n, M);
+ std::vector< std::size_t> y( n);
+ for( std::size_t i = 0; i < n; ++i){
+  for( std::size_t j = 0; j < M; ++j){ X( i, j) = normal( gen); }
+  y[ i] = (X( i, 0) > 0) + (X( i, 1) + X( i, 2) > 0.5);
+ }
+ ml::rf_train_params params;
+ params.n_estimators = 5;
+ params.max_depth = 6;
+ params.min_samples_leaf = 3;
+ ml::random_forest_classifier< int> forest( params);
+ ml::fit( forest, ml::make_columnar( X), y);
+ const std::size_t c = 1;
+ const auto phi = ml::shap_values( forest, X, c, 2);
+ REQUIRE( phi.width() == M+1);
+
+ SECTION("Attributions Sum To The Prediction"){
+  for( std::size_t i = 0; i < n; ++i){
+   double total = 0;
+   for( std::size_t j = 0; j <= M; ++j){ total += phi( i, j); }
+   REQUIRE( total == Approx( forest.predict_proba( X.row( i))[ c]).epsilon( 1e-5));
+  }
+ }
+ SECTION("Matches Brute Force Shapley Values"){
+  std::vector< double> factorial( M+1, 1);
+  for( std::size_t m = 1; m <= M; ++m){ factorial[ m] = factorial[ m-1]*m; }
+  for( std::size_t i = 0; i < 20; ++i){
+   const auto x = X.row( i);
+   for( std::size_t j = 0; j < M; ++j){
+    double shapley = 0;
+    for( unsigned S = 0; S < (1u << M); ++S){
+     if( S & (1u << j)){ continue; }
+     const std::size_t size = __builtin_popcount( S);
+     const double weight = factorial[ size]*factorial[ M-size-1]/factorial[ M];
+     for( auto& t: forest){
+      shapley += weight*(conditional_expectation( t, 0, x, S | (1u << j), c) -
+                         conditional_expectation( t, 0, x, S, c))/forest.size();
+     }
+    }
+    REQUIRE( std::abs( phi( i, j) - shapley) < 1e-9);
+   }
+  }
+ }
+ SECTION("Trees Without Covers Are Rejected"){
+  ml::random_forest_classifier< int> bare;
+  auto& t = bare.insert_next_tree();
+  t.insert_root();
+  bare.n_classes( 2);
+  REQUIRE_THROWS_AS( ml::shap_values( bare, X, 0), std::invalid_argument&);
+ }
+}